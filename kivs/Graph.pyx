@@ -12,11 +12,11 @@ from npstructures import RaggedArray
 cimport kivs.kivs_cpp as cpp
 from kivs.hashing cimport pack_max_kmer_with_offset, decode_kmer_by_map, fill_map_by_encoding, hash_min_kmer_by_encoding
 
-cdef uint8_t get_node_base(cpp.node *n, uint32_t index):
+cdef uint8_t get_node_base(cpp.Graph *g, cpp.node *n, uint32_t index):
     cdef uint32_t sequence_index = index // 32
     cdef uint8_t sub_index = index % 32
 
-    return ((n.sequences[sequence_index]) >> ((31 - sub_index) * 2)) & 3
+    return (g.GetSequence(n, sequence_index) >> ((31 - sub_index) * 2)) & 3
 
 cdef class Graph:
     cdef cpp.Graph *data
@@ -27,34 +27,27 @@ cdef class Graph:
     def __dealloc__(self):
         del self.data
 
-    cdef void init_node(self, cpp.node *n, sequence, uint32_t sequence_len, edges, uint8_t edges_len, is_ascii):
+    cdef void init_node(self, uint32_t node_id, sequence, uint32_t sequence_len, edges, uint32_t edges_len, is_ascii):
         cdef char *ascii_seq
         cdef cnp.ndarray[char, ndim=1, mode="c"] numpy_seq
         cdef uint32_t i
-        cdef uint64_t hashed_seq
-        n.reference = 0
-        n.reference_index = 0
-        n.length = sequence_len
-        if sequence_len != 0:
-            n.sequences_len = 1 + sequence_len // 32
+        cdef uint64_t sequence_offset
+        if is_ascii:
+            ascii_seq = strdup(sequence)
+            self.data.SetNodeSequence(node_id, ascii_seq, sequence_len)
+            free(ascii_seq)
+        elif sequence_len <= 32:
+            numpy_seq = sequence
+            self.data.SetNodePackedSequence(node_id, pack_max_kmer_with_offset(numpy_seq.data, 0, sequence_len), sequence_len)
         else:
-            n.sequences_len = 0
-        n.sequences = <uint64_t *> malloc(n.sequences_len * sizeof(uint64_t))
-        for i in range(n.sequences_len):
-            segment_end = min((i + 1) * 32, n.length)
-            if is_ascii:
-                ascii_seq = strdup(sequence)
-                n.sequences[i] = self.data.HashMaxKmer(ascii_seq + (i * 32), segment_end - (i * 32))
-                free(ascii_seq)
-            else:
-                numpy_seq = sequence
-                n.sequences[i] = pack_max_kmer_with_offset(numpy_seq.data, i * 32, segment_end - (i * 32))
-        n.edges_len = edges_len
-        n.edges = <uint32_t *> malloc(edges_len * sizeof(uint32_t))
+            sequence_offset = self.data.sequences_len
+            numpy_seq = sequence
+            for i in range(0, sequence_len, 32):
+                segment_end = min(i + 32, sequence_len)
+                self.data.AppendPackedSequence(pack_max_kmer_with_offset(numpy_seq.data, i, segment_end - i), segment_end - i)
+            self.data.SetNodeSequenceOffset(node_id, sequence_offset, sequence_len)
         for i in range(edges_len):
-            n.edges[i] = edges[i]
-        n.edges_in_len = 0
-        n.edges_in = NULL
+            self.data.AddEdge(node_id, edges[i])
     
     @staticmethod
     def from_obgraph(obg, encoding="ACGT"):
@@ -72,20 +65,19 @@ cdef class Graph:
         cdef uint32_t j
         cdef uint32_t index
         cdef uint8_t byte
-        g.data.nodes = <cpp.node *> malloc(node_count * sizeof(cpp.node))
-        g.data.nodes_len = node_count
+        g.data.AppendEmptyNodes(node_count)
         for i in range(node_count):
-            n = g.data.nodes + i
-            g.init_node(n,
+            g.init_node(i,
                         obg.sequences[i],
                         obg.sequences[i].shape[0],
                         obg.edges[i],
                         obg.edges[i].shape[0],
                         False)
-        g.data.AddInEdges()
+        g.data.Finalize()
         ref = obg.linear_ref_nodes_and_dummy_nodes_index
         for i, byte in enumerate(ref):
-            (g.data.nodes + i).reference = byte
+            g.data.SetReference(i, byte)
+        g.data.Finalize()
 
         return g
 
@@ -97,22 +89,20 @@ cdef class Graph:
         cdef uint32_t j
         cdef uint64_t reference_length = 0
         cdef uint32_t root_id
-        cdef cpp.node *root
 
+        self.data.Finalize()
         node_count = self.data.nodes_len
 
         node_lengths = np.empty((node_count,), dtype=np.uint32)
-        edge_lengths = np.empty((node_count,), dtype=np.uint8)
+        edge_lengths = np.empty((node_count,), dtype=np.uint32)
         chromosome_start_nodes = None
         for i in range(node_count):
-            n = self.data.nodes + i
-            node_lengths[i] = n.length
-            edge_lengths[i] = n.edges_len
+            node_lengths[i] = self.data.GetNodeLength(i)
+            edge_lengths[i] = self.data.GetEdgesLen(i)
 
             if chromosome_start_nodes is None:
-                if n.edges_len > 0 and n.edges_in_len == 0:
-                    if not self.node_has_parent(i):
-                        chromosome_start_nodes = [i]
+                if edge_lengths[i] > 0 and self.data.GetEdgesInLen(i) == 0:
+                    chromosome_start_nodes = [i]
 
         sequences_val = np.empty((sum(node_lengths),), dtype=np.uint8)
         edges_val = np.empty((sum(edge_lengths),), dtype=np.uint32)
@@ -121,10 +111,10 @@ cdef class Graph:
         for i in range(node_count):
             n = self.data.nodes + i
             for j in range(n.length):
-                sequences_val[base_index] = get_node_base(n, j)
+                sequences_val[base_index] = get_node_base(self.data, n, j)
                 base_index += 1
-            for j in range(n.edges_len):
-                edges_val[edge_index] = n.edges[j]
+            for j in range(self.data.edges_offsets[i], self.data.edges_offsets[i + 1]):
+                edges_val[edge_index] = self.data.edges[j]
                 edge_index += 1
 
         sequences = RaggedArray(sequences_val, node_lengths)
@@ -133,27 +123,24 @@ cdef class Graph:
         linear_ref_nodes_index = np.zeros((node_count,), dtype=np.uint8)
         linear_ref_nodes_and_dummy_nodes_index = np.zeros((node_count,), dtype=np.uint8)
         for i in range(node_count):
-            n = self.data.nodes + i
-            if n.reference:
+            if self.data.IsReference(i):
                 linear_ref_nodes_and_dummy_nodes_index[i] = 1
-                if n.length > 0:
+                if self.data.GetNodeLength(i) > 0:
                     linear_ref_nodes_index[i] = 1
 
         node_to_ref_offset = None
         ref_to_node_offset = None
-        if False and chromosome_start_nodes is not None:
-            #node_to_ref_offset = np.zeros((node_count,), dtype=np.uint64)
-            root_id = chromosome_start_nodes[0]
-            root = self.data.nodes + root_id
-            count = 0
-            while root.edges_len > 0:
-                for i in range(root.edges_len):
-                    n = self.data.nodes + root.edges[i]
-                    print(root_id, root.reference_index, "->", root.edges[i], n.reference_index)
-                root_id = self.data.GetNextReferenceNodeID(root_id)
-                root = self.data.nodes + root_id
-                count += 1
-            print(count)
+        cdef uint32_t reference_path_len = self.data.GetReferencePathLen()
+        cdef uint64_t offset = 0
+        if reference_path_len > 0:
+            node_to_ref_offset = np.zeros((node_count,), dtype=np.uint64)
+            ref_to_node_offset = np.empty((self.data.GetReferenceLength(),), dtype=np.uint32)
+            # Offsets run on across contigs, whose paths follow each other
+            for i in range(reference_path_len):
+                root_id = self.data.GetReferenceNodeID(i)
+                node_to_ref_offset[root_id] = offset
+                ref_to_node_offset[offset:offset + self.data.GetNodeLength(root_id)] = root_id
+                offset += self.data.GetNodeLength(root_id)
 
         return ob.Graph(
             node_lengths,
@@ -166,45 +153,101 @@ cdef class Graph:
             linear_ref_nodes_and_dummy_nodes_index=linear_ref_nodes_and_dummy_nodes_index
         )
 
-    cdef node_has_parent(self, node_id):
-        cdef uint32_t i
-        cdef uint32_t j
-        for i in range(self.data.nodes_len):
-            parent = self.data.nodes + i
-            for j in range(parent.edges_len):
-                if parent.edges[j] == node_id:
-                    return True
-        return False
+    cdef node_has_parent(self, uint32_t node_id):
+        self.data.Finalize()
+        return self.data.GetEdgesInLen(node_id) > 0
 
     @staticmethod
-    def from_gfa(filepath, encoding="ACGT", compress=True):
+    def from_gfa(filepath, encoding="ACGT", compress=True, uint32_t thread_count=0):
         cdef char flags = 0
         cdef char *fpath = strdup(filepath.encode('ASCII'))
-        cdef cpp.Graph *cpp_graph = cpp.Graph.FromGFAFileEncoded(fpath, encoding.encode('ASCII'))
+        cdef cpp.Graph *cpp_graph = cpp.Graph.FromGFAFileEncoded(fpath, encoding.encode('ASCII'), thread_count)
+        free(fpath)
+        if cpp_graph == NULL:
+            raise Exception("Could not read the GFA file %s." % filepath)
         if compress:
-            cpp_graph.Compress()
+            free(cpp_graph.Compress(0))
         g = Graph()
         g.data = cpp_graph
-        free(fpath)
         return g
 
+    def get_contig_roots(self):
+        """Returns the root node ID of every contig of a graph built from a whole genome, by contig name."""
+        cdef uint32_t i
+        roots = {}
+        for i in range(self.data.contigs_len):
+            roots[self.data.GetContigName(i).decode('ASCII')] = self.data.GetContigRootNodeID(i)
+        return roots
+
+    def compress(self, uint32_t thread_count=0):
+        """Compacts chains of nodes into single nodes.
+        Returns an array mapping old node IDs to new ones, or None if the graph was not changed."""
+        cdef uint32_t old_nodes_len = self.data.nodes_len
+        cdef uint32_t *id_map = self.data.Compress(thread_count)
+        cdef uint32_t i
+        if id_map == NULL:
+            return None
+        result = np.empty((old_nodes_len,), dtype=np.uint32)
+        for i in range(old_nodes_len):
+            result[i] = id_map[i]
+        free(id_map)
+        return result
+
+    def renumber_nodes(self):
+        """Renumbers the nodes in topological order, keeping variant bubbles next to their reference nodes.
+        Returns an array mapping old node IDs to new ones, or None if the graph has a cycle."""
+        cdef uint32_t *id_map = self.data.RenumberNodes()
+        cdef uint32_t i
+        if id_map == NULL:
+            return None
+        result = np.empty((self.data.nodes_len,), dtype=np.uint32)
+        for i in range(self.data.nodes_len):
+            result[i] = id_map[i]
+        free(id_map)
+        return result
+
     @staticmethod
-    def from_fasta_vcf(fasta_filepath, vcf_filepath, int chromosome, encoding="ACGT"):
+    def from_fasta_vcf(fasta_filepath, vcf_filepath, chromosome, encoding="ACGT", uint32_t thread_count=0, pipelined=False):
+        """Builds the graph of a chromosome, or of every contig in the FASTA if chromosome is -1.
+        A chromosome given as a str is the exact contig name in both files. One given as a number is matched
+        by the leading digits of contig names, so it cannot pick out names like chrX or MT.
+        Contigs are built on thread_count threads, or on all hardware threads if it is 0.
+        A pipelined build of a chromosome parses the VCF and reads the FASTA on threads of their own while
+        the graph is built, without holding the whole VCF in memory. Its records must be sorted by position."""
         cdef char flags = 0
         cdef char *fasta_fpath = strdup(fasta_filepath.encode('ASCII'))
         cdef char *vcf_fpath = strdup(vcf_filepath.encode('ASCII'))
-        cdef int16_t chromosome_int = chromosome
-        cdef cpp.Graph *cpp_graph = cpp.Graph.FromFastaVCFEncoded(fasta_fpath, vcf_fpath, chromosome_int, encoding.encode('ASCII'))
-        g = Graph()
-        g.data = cpp_graph
+        cdef int16_t chromosome_int
+        cdef bytes contig
+        cdef cpp.Graph *cpp_graph
+        if isinstance(chromosome, str):
+            contig = chromosome.encode('ASCII')
+            if pipelined:
+                cpp_graph = cpp.Graph.FromFastaVCFContigPipelined(fasta_fpath, vcf_fpath, contig, encoding.encode('ASCII'))
+            else:
+                cpp_graph = cpp.Graph.FromFastaVCFContig(fasta_fpath, vcf_fpath, contig, encoding.encode('ASCII'))
+        else:
+            chromosome_int = chromosome
+            if pipelined:
+                cpp_graph = cpp.Graph.FromFastaVCFPipelined(fasta_fpath, vcf_fpath, chromosome_int, encoding.encode('ASCII'))
+            else:
+                cpp_graph = cpp.Graph.FromFastaVCFEncoded(fasta_fpath, vcf_fpath, chromosome_int, encoding.encode('ASCII'), thread_count)
         free(fasta_fpath)
         free(vcf_fpath)
+        if cpp_graph == NULL:
+            raise IOError("Could not build a graph from the FASTA file %s and the VCF file %s." % (fasta_filepath, vcf_filepath))
+        g = Graph()
+        g.data = cpp_graph
         return g
 
     @staticmethod
-    def from_file(filepath):
+    def from_file(filepath, mmap=True):
         cdef char *fpath = strdup(filepath.encode('ASCII'))
-        cdef cpp.Graph *cpp_graph = cpp.Graph.FromFile(fpath)
+        cdef cpp.Graph *cpp_graph
+        if mmap:
+            cpp_graph = cpp.Graph.FromFile(fpath)
+        else:
+            cpp_graph = cpp.Graph.FromFileUnmapped(fpath)
         free(fpath)
         if cpp_graph == NULL:
             print("The specified file was of an invalid format.")
@@ -213,25 +256,57 @@ cdef class Graph:
         g.data = cpp_graph
         return g
 
+    @staticmethod
+    def read_file_header(filepath):
+        cdef char *fpath = strdup(filepath.encode('ASCII'))
+        cdef cpp.bcg_header header
+        valid = cpp.Graph.ReadFileHeader(fpath, &header)
+        free(fpath)
+        if not valid:
+            return None
+        return {
+            'version': header.version,
+            'encoding': header.encoding[:4].decode('ASCII'),
+            'nodes_len': header.nodes_len,
+            'edges_len': header.edges_len,
+            'sequences_len': header.sequences_len,
+            'reference_path_len': header.reference_path_len,
+            'contigs_len': header.contigs_len,
+        }
+
+    def find_reference_position(self, uint64_t position, uint32_t contig=0):
+        """Returns the reference node covering a linear reference coordinate of a contig and the offset into it,
+        or None if the coordinate is past the end of the contig."""
+        cdef uint32_t node_id
+        cdef uint32_t offset
+        if not self.data.FindReferencePosition(position, &node_id, &offset, contig):
+            return None
+        return node_id, offset
+
     def to_file(self, filepath):
         cdef char *fpath = strdup(filepath.encode('ASCII'))
         self.data.ToFile(fpath)
         free(fpath)
 
+    def to_gfa(self, filepath):
+        cdef char *fpath = strdup(filepath.encode('ASCII'))
+        self.data.ToGFAFile(fpath)
+        free(fpath)
+
     def print_node_data(self, node_id):
         cdef uint32_t i = node_id
-        cdef uint8_t j
-        cdef cpp.node *n = self.data.nodes + i
+        cdef uint32_t j
+        self.data.Finalize()
         output = "Node ID: " + str(node_id)
-        output += "\nLength: " + str(n.length)
-        output += "\nEdges Out Len: " + str(n.edges_len)
+        output += "\nLength: " + str(self.data.GetNodeLength(i))
+        output += "\nEdges Out Len: " + str(self.data.GetEdgesLen(i))
         output += "\nEdges Out:"
-        for j in range(n.edges_len):
-            output += " " + str(n.edges[j])
-        output += "\nEdges In Len: " + str(n.edges_in_len)
+        for j in range(self.data.GetEdgesLen(i)):
+            output += " " + str(self.data.GetEdges(i)[j])
+        output += "\nEdges In Len: " + str(self.data.GetEdgesInLen(i))
         output += "\nEdges In:"
-        for j in range(n.edges_in_len):
-            output += " " + str(n.edges_in[j])
+        for j in range(self.data.GetEdgesInLen(i)):
+            output += " " + str(self.data.GetEdgesIn(i)[j])
         print(output)
 
 
@@ -252,25 +327,24 @@ cdef class Graph:
         cdef unsigned int i
         cdef char *sequence
         g.data = new cpp.Graph(encoding.encode('ASCII'))
-        g.data.nodes = <cpp.node *> malloc(node_count * sizeof(cpp.node))
-        g.data.nodes_len = node_count
+        g.data.AppendEmptyNodes(node_count)
         for i in range(node_count):
-            n = g.data.nodes + i
             sequence = strdup(sequences[i].encode('ASCII'))
-            g.init_node(n,
+            g.init_node(i,
                         sequence,
                         len(sequences[i]),
                         edges[i],
                         len(edges[i]),
                         True)
             free(sequence)
-        g.data.AddInEdges()
+        g.data.Finalize()
         if ref is not None:
             for i in ref:
-                (g.data.nodes + i).reference = 1
+                g.data.SetReference(i, True)
         else:
             for i in range(node_count):
-                (g.data.nodes + i).reference = 1
+                g.data.SetReference(i, True)
+        g.data.Finalize()
         return g
 
     @staticmethod
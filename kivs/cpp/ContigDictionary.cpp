@@ -0,0 +1,67 @@
+#include "ContigDictionary.hpp"
+
+uint64_t ContigDictionary::HashName(const char *name, uint32_t name_len) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (uint32_t i = 0; i < name_len; i++) {
+		hash ^= (uint8_t) name[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+uint32_t ContigDictionary::Find(const char *name, uint32_t name_len) {
+	if (table_cap == 0) return UINT32_MAX;
+	uint64_t mask = table_cap - 1;
+	uint64_t slot = HashName(name, name_len) & mask;
+	while (table[slot] != UINT32_MAX) {
+		if (NameEquals(table[slot], name, name_len)) return table[slot];
+		slot = (slot + 1) & mask;
+	}
+	return UINT32_MAX;
+}
+
+uint32_t ContigDictionary::Add(const char *name, uint32_t name_len) {
+	uint32_t contig_id = Find(name, name_len);
+	if (contig_id != UINT32_MAX) return contig_id;
+
+	if (contigs_len == contigs_cap) {
+		contigs_cap = (contigs_cap == 0) ? 64 : contigs_cap * 2;
+		lengths = (uint64_t *) realloc(lengths, sizeof(uint64_t) * contigs_cap);
+		name_offsets = (uint64_t *) realloc(name_offsets, sizeof(uint64_t) * contigs_cap);
+		name_lengths = (uint32_t *) realloc(name_lengths, sizeof(uint32_t) * contigs_cap);
+	}
+	if (names_len + name_len + 1 > names_cap) {
+		while (names_len + name_len + 1 > names_cap) names_cap = (names_cap == 0) ? 1024 : names_cap * 2;
+		names = (char *) realloc(names, sizeof(char) * names_cap);
+	}
+	memcpy(names + names_len, name, name_len);
+	names[names_len + name_len] = '\0';
+	contig_id = contigs_len++;
+	lengths[contig_id] = 0;
+	name_offsets[contig_id] = names_len;
+	name_lengths[contig_id] = name_len;
+	names_len += name_len + 1;
+
+	// The table is kept at most half full
+	if ((uint64_t) contigs_len * 2 > table_cap) {
+		GrowTable();
+	} else {
+		uint64_t mask = table_cap - 1;
+		uint64_t slot = HashName(name, name_len) & mask;
+		while (table[slot] != UINT32_MAX) slot = (slot + 1) & mask;
+		table[slot] = contig_id;
+	}
+	return contig_id;
+}
+
+void ContigDictionary::GrowTable() {
+	table_cap = (table_cap == 0) ? 128 : table_cap * 2;
+	table = (uint32_t *) realloc(table, sizeof(uint32_t) * table_cap);
+	memset(table, 0xFF, sizeof(uint32_t) * table_cap);
+	uint64_t mask = table_cap - 1;
+	for (uint32_t contig_id = 0; contig_id < contigs_len; contig_id++) {
+		uint64_t slot = HashName(GetName(contig_id), name_lengths[contig_id]) & mask;
+		while (table[slot] != UINT32_MAX) slot = (slot + 1) & mask;
+		table[slot] = contig_id;
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef KIVS_CONTIG_DICTIONARY
+#define KIVS_CONTIG_DICTIONARY
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+
+// Numbers contig names, such as chr1, X, MT or alt contigs, in the order they are first added
+class ContigDictionary {
+public:
+	uint32_t contigs_len;
+	// Length of every contig in bases, or 0 if it is not known
+	uint64_t *lengths;
+
+private:
+	// Every name ends with a 0, so GetName can hand them out directly
+	char *names;
+	uint64_t names_len;
+	uint64_t names_cap;
+	uint64_t *name_offsets;
+	uint32_t *name_lengths;
+	uint32_t contigs_cap;
+	// Open addressing table of contig IDs, hashed by name
+	uint32_t *table;
+	uint64_t table_cap;
+
+public:
+	ContigDictionary() {
+		contigs_len = 0;
+		lengths = NULL;
+		names = NULL;
+		names_len = 0;
+		names_cap = 0;
+		name_offsets = NULL;
+		name_lengths = NULL;
+		contigs_cap = 0;
+		table = NULL;
+		table_cap = 0;
+	}
+
+	~ContigDictionary() {
+		if (lengths) free(lengths);
+		if (names) free(names);
+		if (name_offsets) free(name_offsets);
+		if (name_lengths) free(name_lengths);
+		if (table) free(table);
+	}
+
+	// Returns the ID of the name, adding it if it is new
+	uint32_t Add(const char *name, uint32_t name_len);
+	// Returns UINT32_MAX for names that were never added
+	uint32_t Find(const char *name, uint32_t name_len);
+
+	const char *GetName(uint32_t contig_id) {
+		return names + name_offsets[contig_id];
+	}
+	uint32_t GetNameLength(uint32_t contig_id) {
+		return name_lengths[contig_id];
+	}
+	bool NameEquals(uint32_t contig_id, const char *name, uint32_t name_len) {
+		return name_lengths[contig_id] == name_len && memcmp(names + name_offsets[contig_id], name, name_len) == 0;
+	}
+
+private:
+	uint64_t HashName(const char *name, uint32_t name_len);
+	void GrowTable();
+};
+
+#endif
@@ -1,34 +1,214 @@
 #include "FASTA.hpp"
 #include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hashing.hpp"
+
+FASTA *FASTA::ReadFile(char *filepath, uint32_t thread_count) {
+	FileStream *stream = FileStream::Open(filepath, thread_count);
+	if (stream == NULL) {
+		printf("Failed to open FASTA file %s\n", filepath);
+		return NULL;
+	}
 
-FASTA *FASTA::ReadFile(char *filepath) {
 	FASTA *fasta = new FASTA(filepath);
-	fasta->source_file = fopen(filepath, "rb");
+	fasta->stream = stream;
+	if (stream->IsSeekable()) {
+		fasta->index = FASTAIndex::ReadFile(filepath);
+		if (fasta->index == NULL) {
+			fasta->index = FASTAIndex::Build(stream);
+			if (fasta->index == NULL) {
+				printf("Could not index FASTA file %s, contigs will be found by reading it\n", filepath);
+			} else if (!fasta->index->WriteFile(filepath)) {
+				printf("Could not write the index of FASTA file %s\n", filepath);
+			}
+		}
+	}
 
 	return fasta;
 }
 
+FASTA *FASTA::ReadFile(char *filepath, FASTAIndex *index, uint32_t thread_count) {
+	FileStream *stream = FileStream::Open(filepath, thread_count);
+	if (stream == NULL) {
+		printf("Failed to open FASTA file %s\n", filepath);
+		return NULL;
+	}
+
+	FASTA *fasta = new FASTA(filepath);
+	fasta->stream = stream;
+	if (stream->IsSeekable()) {
+		fasta->index = index;
+		fasta->owns_index = false;
+	}
+	return fasta;
+}
+
 void FASTA::GoToStart() {
-	fseek(source_file, 0, SEEK_SET);
+	stream->Rewind();
+	chunk = NULL;
+	chunk_len = 0;
+	chunk_pos = 0;
+}
+
+// Skips ahead to the next header line with memchr and reads it into line_buffer.
+// The name is the header up to the first space or tab.
+bool FASTA::NextHeader(uint32_t *name_len) {
+	while (true) {
+		const char *header = (chunk_pos < chunk_len) ? (const char *) memchr(chunk + chunk_pos, '>', chunk_len - chunk_pos) : NULL;
+		if (header != NULL) {
+			chunk_pos = (header - chunk) + 1;
+			break;
+		}
+		chunk_pos = chunk_len;
+		int c = NextChar();
+		if (c == EOF) return false;
+		if (c == '>') break;
+	}
+
+	uint32_t line_len = 0;
+	int c;
+	while ((c = NextChar()) != EOF && c != '\n') {
+		if (line_len < sizeof(line_buffer) - 1) line_buffer[line_len++] = c;
+	}
+	if (line_len > 0 && line_buffer[line_len - 1] == '\r') line_len--;
+	line_buffer[line_len] = '\0';
+	*name_len = strcspn(line_buffer, " \t");
+	return true;
+}
+
+bool FASTA::SeekContig(uint32_t contig_id, uint64_t position) {
+	if (!stream->Seek(index->GetOffset(contig_id, position))) return false;
+	chunk = NULL;
+	chunk_len = 0;
+	chunk_pos = 0;
+	return true;
 }
 
 bool FASTA::GoToChromosome(int16_t chromosome) {
-	fseek(source_file, 0, SEEK_SET);
-	int16_t current_chromosome = -1;
-	char c;
-	while (current_chromosome != chromosome) {
-		while ((c = fgetc(source_file)) != '>') {
-			if (c == EOF) {
-				printf("Failed to find chromosome #%d in file.\n", chromosome);
-				return false;
-			}
+	if (index != NULL) {
+		for (uint32_t i = 0; i < index->contigs->contigs_len; i++) {
+			if (strtol(index->contigs->GetName(i), NULL, 10) == chromosome) return SeekContig(i, 0);
 		}
-		fgets(line_buffer, 2047, source_file);
-		if (strtol(line_buffer, NULL, 10) == chromosome) {
-			current_chromosome = chromosome;
+		printf("Failed to find chromosome #%d in file.\n", chromosome);
+		return false;
+	}
+
+	GoToStart();
+	uint32_t name_len;
+	while (NextHeader(&name_len)) {
+		if (strtol(line_buffer, NULL, 10) == chromosome) return true;
+	}
+	printf("Failed to find chromosome #%d in file.\n", chromosome);
+	return false;
+}
+
+bool FASTA::GoToContig(const char *name) {
+	if (index != NULL) {
+		uint32_t contig_id = index->contigs->Find(name, strlen(name));
+		if (contig_id != UINT32_MAX) return SeekContig(contig_id, 0);
+		printf("Failed to find contig %s in file.\n", name);
+		return false;
+	}
+
+	// The rest of the file is searched before going back to the start
+	uint32_t name_len;
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		while (NextHeader(&name_len)) {
+			if (name_len == strlen(name) && memcmp(line_buffer, name, name_len) == 0) return true;
 		}
+		GoToStart();
 	}
-	return (current_chromosome != -1);
+	printf("Failed to find contig %s in file.\n", name);
+	return false;
+}
+
+bool FASTA::GoToPosition(const char *name, uint64_t position) {
+	if (index != NULL) {
+		uint32_t contig_id = index->contigs->Find(name, strlen(name));
+		if (contig_id == UINT32_MAX) {
+			printf("Failed to find contig %s in file.\n", name);
+			return false;
+		}
+		if (position > index->contigs->lengths[contig_id]) return false;
+		return SeekContig(contig_id, position);
+	}
+
+	// Without an index the bases before the position are read and dropped
+	if (!GoToContig(name)) return false;
+	const char *bases;
+	uint32_t bases_len;
+	while (position > 0) {
+		uint32_t max_len = (position > UINT32_MAX) ? UINT32_MAX : position;
+		if (!NextBases(max_len, &bases, &bases_len)) return false;
+		position -= bases_len;
+	}
+	return true;
+}
+
+ContigDictionary *FASTA::ReadContigs() {
+	ContigDictionary *contigs = new ContigDictionary();
+	if (index != NULL) {
+		for (uint32_t i = 0; i < index->contigs->contigs_len; i++) {
+			uint32_t contig_id = contigs->Add(index->contigs->GetName(i), index->contigs->GetNameLength(i));
+			contigs->lengths[contig_id] = index->contigs->lengths[i];
+		}
+		return contigs;
+	}
+
+	GoToStart();
+	uint32_t name_len;
+	while (NextHeader(&name_len)) {
+		contigs->Add(line_buffer, name_len);
+	}
+	return contigs;
+}
+
+// Only A, C, G, T and N in either case are bases, the rest of a sequence line is skipped
+static inline bool is_base(char c) {
+	char lower = c | 0x20;
+	return lower == 'a' || lower == 'c' || lower == 'g' || lower == 't' || lower == 'n';
+}
+
+// Counts the bases at the start of data, 16 at a time while they are all bases
+static uint32_t count_bases(const char *data, uint32_t len) {
+	uint32_t count = 0;
+#ifdef __SSE2__
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	const __m128i a = _mm_set1_epi8('a');
+	const __m128i c = _mm_set1_epi8('c');
+	const __m128i g = _mm_set1_epi8('g');
+	const __m128i t = _mm_set1_epi8('t');
+	const __m128i n = _mm_set1_epi8('n');
+	while (count + 16 <= len) {
+		__m128i lower = _mm_or_si128(_mm_loadu_si128((const __m128i *) (data + count)), case_bit);
+		__m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, a), _mm_cmpeq_epi8(lower, c)),
+		                             _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, g), _mm_cmpeq_epi8(lower, t)), _mm_cmpeq_epi8(lower, n)));
+		uint32_t mask = _mm_movemask_epi8(valid);
+		if (mask != 0xFFFF) return count + __builtin_ctz(~mask);
+		count += 16;
+	}
+#endif
+	while (count < len && is_base(data[count])) count++;
+	return count;
+}
+
+bool FASTA::NextBases(uint32_t max_len, const char **bases, uint32_t *bases_len) {
+	while (FillChunk()) {
+		uint64_t available = chunk_len - chunk_pos;
+		uint32_t run = count_bases(chunk + chunk_pos, (available < max_len) ? available : max_len);
+		if (run > 0) {
+			*bases = chunk + chunk_pos;
+			*bases_len = run;
+			chunk_pos += run;
+			return true;
+		}
+		// The header of the next contig is left for GoToContig and NextHeader
+		if (chunk[chunk_pos] == '>') return false;
+		chunk_pos++;
+	}
+	return false;
 }
 
 char *FASTA::ReadNext(uint32_t count) {
@@ -36,16 +216,13 @@ char *FASTA::ReadNext(uint32_t count) {
 		buffer_len = count;
 		buffer = (char *) realloc(buffer, sizeof(char) * (buffer_len + 1));
 	}
-	
+
 	uint32_t buffer_pos = 0;
-	char c;
-	while (buffer_pos < count) {
-		c = fgetc(source_file);
-		if (c == EOF || c == '>') break;
-		if (c == 'A' || c == 'a' || c == 'C' || c == 'c' || c == 'G' || c == 'g' ||
-				c == 'T' || c == 't' || c == 'N' || c == 'n') {
-			buffer[buffer_pos++] = c;
-		}
+	const char *bases;
+	uint32_t bases_len;
+	while (buffer_pos < count && NextBases(count - buffer_pos, &bases, &bases_len)) {
+		memcpy(buffer + buffer_pos, bases, bases_len);
+		buffer_pos += bases_len;
 	}
 	if (buffer_pos == 0) return NULL;
 
@@ -53,3 +230,30 @@ char *FASTA::ReadNext(uint32_t count) {
 
 	return buffer;
 }
+
+uint32_t FASTA::ReadNextPacked(uint32_t count, uint8_t *encoding_map) {
+	uint32_t words = (count + 31) / 32 + 1;
+	if (words > packed_cap) {
+		packed_cap = words;
+		packed = (uint64_t *) realloc(packed, sizeof(uint64_t) * packed_cap);
+	}
+	memset(packed, 0, sizeof(uint64_t) * words);
+
+	uint32_t packed_len = 0;
+	const char *bases;
+	uint32_t bases_len;
+	uint64_t hashes[ENCODE_CHUNK_WORDS];
+	while (packed_len < count && NextBases((count - packed_len < ENCODE_CHUNK_WORDS * 32) ? count - packed_len : ENCODE_CHUNK_WORDS * 32, &bases, &bases_len)) {
+		// Runs are packed 32 bases at a time and shifted in after the bases before them
+		hash_bases_by_map(bases, bases_len, encoding_map, hashes);
+		for (uint32_t i = 0; i < bases_len; i += 32) {
+			uint8_t word_len = (bases_len - i > 32) ? 32 : (bases_len - i);
+			uint64_t word = hashes[i / 32];
+			uint8_t shift = (packed_len & 31) * 2;
+			packed[packed_len / 32] |= word >> shift;
+			if (shift != 0) packed[packed_len / 32 + 1] |= word << (64 - shift);
+			packed_len += word_len;
+		}
+	}
+	return packed_len;
+}
@@ -5,33 +5,103 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <cstring>
+#include "FileStream.hpp"
+#include "ContigDictionary.hpp"
+#include "FASTAIndex.hpp"
 
 class FASTA {
 public:
 	char *buffer;
 	uint32_t buffer_len;
+	// Bases read by ReadNextPacked, 2 bits each from the most significant bits of every word
+	uint64_t *packed;
 private:
+	uint32_t packed_cap;
 	char *filepath;
-	FILE *source_file;
+	FileStream *stream;
+	// Index of where every contig starts, NULL for gzip files, which cannot seek, and files that cannot be indexed
+	FASTAIndex *index;
+	// False for an index shared with other readers of the same file
+	bool owns_index;
+	// The part of the file currently being read
+	const char *chunk;
+	uint64_t chunk_len;
+	uint64_t chunk_pos;
 	char line_buffer[2048];
 public:
 	~FASTA() {
 		if (buffer) free(buffer);
-		fclose(source_file);
+		if (packed) free(packed);
+		if (owns_index) delete index;
+		delete stream;
 		free(filepath);
 	}
 
-	static FASTA *ReadFile(char *filepath);
+	// Plain, gzip and BGZF files are all accepted. A thread_count of 0 decompresses BGZF files on all hardware threads.
+	// Plain and BGZF files are indexed through filepath.fai, which is written if it is missing or out of date.
+	static FASTA *ReadFile(char *filepath, uint32_t thread_count = 0);
+	// Opens another reader of a file that has already been indexed, sharing the index read-only instead of loading it again
+	static FASTA *ReadFile(char *filepath, FASTAIndex *index, uint32_t thread_count = 0);
+	// The index, or NULL if the file has none. It lives as long as the reader that loaded it.
+	FASTAIndex *GetIndex() {
+		return index;
+	}
 	void GoToStart();
+	// Goes to the first contig whose name starts with the number
 	bool GoToChromosome(int16_t chromosome);
+	// Goes to the contig whose name, the header up to the first space, matches exactly.
+	// Without an index the file is searched from the current position first, so going through
+	// the contigs in file order reads it once.
+	bool GoToContig(const char *name);
+	// Goes to a 0-based position of the contig. With an index every character of its sequence lines counts as
+	// a base, as in samtools, and without one only A, C, G, T and N do.
+	bool GoToPosition(const char *name, uint64_t position);
+	// Lists the contig names in file order, with their lengths if the file is indexed. Without an index the
+	// reader is left at the end of the file.
+	ContigDictionary *ReadContigs();
 	char *ReadNext(uint32_t count);
+	// Reads like ReadNext, but encodes the bases with the map into packed words instead of copying them.
+	// Returns the number of bases read.
+	uint32_t ReadNextPacked(uint32_t count, uint8_t *encoding_map);
 private:
 
 	FASTA(char *filepath) {
 		this->filepath = strdup(filepath);
 		buffer_len = 32;
 		buffer = (char *) malloc(sizeof(char) * (buffer_len + 1));
+		packed = NULL;
+		packed_cap = 0;
+		stream = NULL;
+		index = NULL;
+		owns_index = true;
+		chunk = NULL;
+		chunk_len = 0;
+		chunk_pos = 0;
+	}
+
+	// Loads the next chunk once the current one is used up. Returns false at the end of the file.
+	bool FillChunk() {
+		if (chunk_pos < chunk_len) return true;
+		chunk = stream->Next(&chunk_len);
+		chunk_pos = 0;
+		if (chunk == NULL) {
+			chunk_len = 0;
+			return false;
+		}
+		return true;
 	}
+
+	int NextChar() {
+		if (!FillChunk()) return EOF;
+		return (unsigned char) chunk[chunk_pos++];
+	}
+
+	// Finds the next run of bases of the contig in the current chunk, stepping over line breaks and
+	// other characters that are not bases. Returns false at the end of the contig.
+	bool NextBases(uint32_t max_len, const char **bases, uint32_t *bases_len);
+
+	bool NextHeader(uint32_t *name_len);
+	bool SeekContig(uint32_t contig_id, uint64_t position);
 };
 
 #endif
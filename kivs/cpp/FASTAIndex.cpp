@@ -0,0 +1,218 @@
+#include "FASTAIndex.hpp"
+#include <iostream>
+#include <sys/stat.h>
+
+static char *index_filepath_of(char *fasta_filepath) {
+	uint64_t filepath_len = strlen(fasta_filepath);
+	char *index_filepath = (char *) malloc(sizeof(char) * (filepath_len + 5));
+	memcpy(index_filepath, fasta_filepath, filepath_len);
+	memcpy(index_filepath + filepath_len, ".fai", 5);
+	return index_filepath;
+}
+
+// An index written before the FASTA file was last changed may point anywhere
+static bool is_older(struct stat *a, struct stat *b) {
+	if (a->st_mtim.tv_sec != b->st_mtim.tv_sec) return a->st_mtim.tv_sec < b->st_mtim.tv_sec;
+	return a->st_mtim.tv_nsec < b->st_mtim.tv_nsec;
+}
+
+bool FASTAIndex::AddContig(const char *name, uint32_t name_len, uint64_t length, struct fasta_index_entry entry) {
+	uint32_t contigs_len = contigs->contigs_len;
+	uint32_t contig_id = contigs->Add(name, name_len);
+	if (contig_id != contigs_len) return false;
+
+	if (contig_id == entries_cap) {
+		entries_cap = (entries_cap == 0) ? 64 : entries_cap * 2;
+		entries = (struct fasta_index_entry *) realloc(entries, sizeof(struct fasta_index_entry) * entries_cap);
+	}
+	entries[contig_id] = entry;
+	contigs->lengths[contig_id] = length;
+	return true;
+}
+
+FASTAIndex *FASTAIndex::ReadFile(char *fasta_filepath) {
+	char *index_filepath = index_filepath_of(fasta_filepath);
+	struct stat fasta_stat, index_stat;
+	if (stat(fasta_filepath, &fasta_stat) == -1 || stat(index_filepath, &index_stat) == -1 || is_older(&index_stat, &fasta_stat)) {
+		free(index_filepath);
+		return NULL;
+	}
+	FileStream *stream = FileStream::Open(index_filepath, 1);
+	if (stream == NULL) {
+		free(index_filepath);
+		return NULL;
+	}
+
+	uint64_t data_len;
+	const char *data = stream->ReadAll(&data_len);
+	FASTAIndex *index = new FASTAIndex();
+	char number[32];
+	uint64_t pos = 0;
+	// Every line holds the name, length, offset, bases per line and bytes per line, separated by tabs.
+	// FASTQ indexes add a sixth column, which is ignored.
+	while (pos < data_len && index != NULL) {
+		const char *line_end = (const char *) memchr(data + pos, '\n', data_len - pos);
+		uint64_t line_len = (line_end ? line_end - data : data_len) - pos;
+		const char *line = data + pos;
+		pos += line_len + 1;
+		if (line_len == 0) continue;
+
+		uint64_t fields[4] = {0, 0, 0, 0};
+		const char *field = (const char *) memchr(line, '\t', line_len);
+		uint32_t name_len = field ? field - line : line_len;
+		bool valid = (field != NULL && name_len > 0);
+		for (uint8_t i = 0; i < 4 && valid; i++) {
+			const char *field_end = field + 1;
+			while (field_end < line + line_len && *field_end != '\t' && *field_end != '\r') field_end++;
+			uint64_t field_len = field_end - (field + 1);
+			if (field_len == 0 || field_len >= sizeof(number)) {
+				valid = false;
+				break;
+			}
+			memcpy(number, field + 1, field_len);
+			number[field_len] = '\0';
+			char *number_end;
+			fields[i] = strtoull(number, &number_end, 10);
+			valid = (*number_end == '\0');
+			field = field_end;
+		}
+		// A contig with bases needs lines that hold some of them
+		valid = valid && fields[2] <= UINT32_MAX && fields[3] <= UINT32_MAX && fields[3] >= fields[2] && (fields[0] == 0 || fields[2] > 0);
+		struct fasta_index_entry entry = {fields[1], (uint32_t) fields[2], (uint32_t) fields[3]};
+		if (!valid || !index->AddContig(line, name_len, fields[0], entry)) {
+			printf("Failed to read index %s\n", index_filepath);
+			delete index;
+			index = NULL;
+		}
+	}
+
+	delete stream;
+	free(index_filepath);
+	return index;
+}
+
+// Line being read by Build, which may be split over chunks of the stream
+struct fasta_index_line {
+	uint64_t start;
+	bool header;
+	char last_char;
+	char name[2048];
+	uint32_t name_len;
+};
+
+// State of the contig being indexed by Build
+struct fasta_index_contig {
+	const char *name;
+	uint64_t length;
+	struct fasta_index_entry entry;
+	// A line shorter than the first has been seen, so it must have been the last one
+	bool ended;
+	bool open;
+};
+
+FASTAIndex *FASTAIndex::Build(FileStream *stream) {
+	FASTAIndex *index = new FASTAIndex();
+	struct fasta_index_line line = {0, false, 0, {0}, 0};
+	struct fasta_index_contig contig = {NULL, 0, {0, 0, 0}, false, false};
+	bool line_open = false;
+	bool valid = true;
+
+	// Ends the line, given the offset just past it
+	auto end_line = [&](uint64_t line_end, bool has_break) {
+		if (line.header) {
+			if (line.name_len > 0 && line.name[line.name_len - 1] == '\r') line.name_len--;
+			line.name[line.name_len] = '\0';
+			line.name[strcspn(line.name, " \t")] = '\0';
+			contig = {line.name, 0, {line_end, 0, 0}, false, true};
+			return true;
+		}
+		// Anything before the first header is not part of a contig
+		if (!contig.open) return true;
+
+		uint64_t width = line_end - line.start;
+		uint64_t bases = width - (has_break ? 1 : 0) - (line.last_char == '\r' ? 1 : 0);
+		if (bases == 0) {
+			contig.ended = true;
+			return true;
+		}
+		if (contig.ended) return false;
+		if (contig.entry.line_bases == 0) {
+			if (bases > UINT32_MAX || width > UINT32_MAX) return false;
+			contig.entry.line_bases = bases;
+			contig.entry.line_width = width;
+		} else if (bases > contig.entry.line_bases || (has_break && width - bases != contig.entry.line_width - contig.entry.line_bases)) {
+			return false;
+		} else if (bases < contig.entry.line_bases) {
+			contig.ended = true;
+		}
+		contig.length += bases;
+		return true;
+	};
+
+	stream->Rewind();
+	uint64_t offset = 0;
+	const char *data;
+	uint64_t data_len;
+	while (valid && (data = stream->Next(&data_len)) != NULL) {
+		uint64_t pos = 0;
+		while (pos < data_len) {
+			if (!line_open) {
+				line_open = true;
+				line.start = offset + pos;
+				line.header = (data[pos] == '>');
+				line.last_char = 0;
+				if (line.header) {
+					// The name of the previous contig is still needed until its entry is added
+					if (contig.open && !index->AddContig(contig.name, strlen(contig.name), contig.length, contig.entry)) {
+						valid = false;
+						break;
+					}
+					contig.open = false;
+					line.name_len = 0;
+					pos++;
+					continue;
+				}
+			}
+			const char *line_break = (const char *) memchr(data + pos, '\n', data_len - pos);
+			uint64_t end = line_break ? line_break - data : data_len;
+			if (line.header) {
+				uint64_t copy_len = end - pos;
+				if (copy_len > sizeof(line.name) - 1 - line.name_len) copy_len = sizeof(line.name) - 1 - line.name_len;
+				memcpy(line.name + line.name_len, data + pos, copy_len);
+				line.name_len += copy_len;
+			}
+			if (end > pos) line.last_char = data[end - 1];
+			pos = end;
+			if (line_break) {
+				pos++;
+				line_open = false;
+				if (!end_line(offset + pos, true)) {
+					valid = false;
+					break;
+				}
+			}
+		}
+		offset += data_len;
+	}
+	if (valid && line_open) valid = end_line(offset, false);
+	if (valid && contig.open) valid = index->AddContig(contig.name, strlen(contig.name), contig.length, contig.entry);
+	stream->Rewind();
+
+	if (!valid) {
+		delete index;
+		return NULL;
+	}
+	return index;
+}
+
+bool FASTAIndex::WriteFile(char *fasta_filepath) {
+	char *index_filepath = index_filepath_of(fasta_filepath);
+	FILE *f = fopen(index_filepath, "w");
+	free(index_filepath);
+	if (f == NULL) return false;
+
+	for (uint32_t i = 0; i < contigs->contigs_len; i++) {
+		fprintf(f, "%s\t%lu\t%lu\t%u\t%u\n", contigs->GetName(i), contigs->lengths[i], entries[i].offset, entries[i].line_bases, entries[i].line_width);
+	}
+	return fclose(f) == 0;
+}
@@ -0,0 +1,61 @@
+#ifndef KIVS_FILE_READER_FASTA_INDEX
+#define KIVS_FILE_READER_FASTA_INDEX
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+#include "FileStream.hpp"
+#include "ContigDictionary.hpp"
+
+// Where the sequence of a contig starts and how its lines are laid out
+struct fasta_index_entry {
+	// Offset of the first base in the decompressed file
+	uint64_t offset;
+	// Bases on every line but the last, and the bytes such a line takes up with its line break
+	uint32_t line_bases;
+	uint32_t line_width;
+};
+
+// samtools style .fai index of a FASTA file. Every contig is listed with its name, length, offset and line
+// layout, so any base can be found without reading the contigs before it.
+class FASTAIndex {
+public:
+	// Contig names and lengths, in file order
+	ContigDictionary *contigs;
+	struct fasta_index_entry *entries;
+
+private:
+	uint32_t entries_cap;
+
+public:
+	~FASTAIndex() {
+		delete contigs;
+		if (entries) free(entries);
+	}
+
+	// Reads fasta_filepath.fai. Returns NULL if there is none, it is older than the FASTA file, or it cannot be parsed.
+	static FASTAIndex *ReadFile(char *fasta_filepath);
+	// Indexes a FASTA file by reading it once. Returns NULL if the lines of a contig, other than its last, differ
+	// in length, or if a contig name appears twice.
+	static FASTAIndex *Build(FileStream *stream);
+	bool WriteFile(char *fasta_filepath);
+
+	// Offset in the decompressed file of a 0-based position of a contig
+	uint64_t GetOffset(uint32_t contig_id, uint64_t position) {
+		struct fasta_index_entry *entry = entries + contig_id;
+		if (entry->line_bases == 0) return entry->offset;
+		return entry->offset + (position / entry->line_bases) * entry->line_width + position % entry->line_bases;
+	}
+
+private:
+	FASTAIndex() {
+		contigs = new ContigDictionary();
+		entries = NULL;
+		entries_cap = 0;
+	}
+
+	bool AddContig(const char *name, uint32_t name_len, uint64_t length, struct fasta_index_entry entry);
+};
+
+#endif
@@ -0,0 +1,406 @@
+#include "FileStream.hpp"
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+FileStream::FileStream(char *filepath, uint32_t thread_count) {
+	this->filepath = strdup(filepath);
+	mode = FILE_STREAM_PLAIN;
+	data = NULL;
+	data_len = 0;
+	plain_returned = false;
+	plain_offset = 0;
+	memset(&gzip_stream, 0, sizeof(z_stream));
+	gzip_input_offset = 0;
+	gzip_buffer = NULL;
+	gzip_ended = false;
+	block_offsets = NULL;
+	block_output_offsets = NULL;
+	blocks_len = 0;
+	range_first_block = 0;
+	range_blocks_len = 0;
+	range_output_start = 0;
+	range_output_end = 0;
+	batches_len = 0;
+	this->thread_count = thread_count;
+	slots = NULL;
+	slots_len = 0;
+	next_claim = 0;
+	next_consume = 0;
+	released = 0;
+	stopping = false;
+	all_data = NULL;
+	all_data_len = 0;
+}
+
+FileStream::~FileStream() {
+	StopWorkers();
+	if (mode == FILE_STREAM_GZIP) inflateEnd(&gzip_stream);
+	if (slots) {
+		for (uint32_t i = 0; i < slots_len; i++) free(slots[i].buffer);
+		free(slots);
+	}
+	if (data) munmap((void *) data, data_len);
+	free(gzip_buffer);
+	free(block_offsets);
+	free(block_output_offsets);
+	free(all_data);
+	free(filepath);
+}
+
+FileStream *FileStream::Open(char *filepath, uint32_t thread_count) {
+	int fd = open(filepath, O_RDONLY);
+	if (fd == -1) return NULL;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	FileStream *stream = new FileStream(filepath, thread_count);
+	stream->data_len = file_stat.st_size;
+	if (stream->data_len > 0) {
+		void *mapped_data = mmap(NULL, stream->data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped_data == MAP_FAILED) {
+			close(fd);
+			printf("Failed to map file %s\n", filepath);
+			delete stream;
+			return NULL;
+		}
+		madvise(mapped_data, stream->data_len, MADV_SEQUENTIAL);
+		stream->data = (const uint8_t *) mapped_data;
+	}
+	close(fd);
+
+	if (stream->data_len >= 18 && stream->data[0] == 0x1f && stream->data[1] == 0x8b) {
+		if (stream->IndexBGZFBlocks()) {
+			stream->mode = FILE_STREAM_BGZF;
+			if (stream->thread_count == 0) stream->thread_count = std::thread::hardware_concurrency();
+			if (stream->thread_count == 0) stream->thread_count = 1;
+		} else {
+			stream->mode = FILE_STREAM_GZIP;
+			stream->gzip_buffer = (char *) malloc(GZIP_CHUNK_SIZE);
+			// 15 window bits, plus 16 to expect a gzip header
+			inflateInit2(&stream->gzip_stream, 15 + 16);
+		}
+	}
+
+	return stream;
+}
+
+// Every BGZF block is a gzip member with a BC extra field holding its compressed size minus one,
+// and ends with its uncompressed size. Returns false if the file is not BGZF.
+bool FileStream::IndexBGZFBlocks() {
+	uint64_t cap = 1024;
+	block_offsets = (uint64_t *) malloc(sizeof(uint64_t) * (cap + 1));
+	block_output_offsets = (uint64_t *) malloc(sizeof(uint64_t) * (cap + 1));
+	block_offsets[0] = 0;
+	block_output_offsets[0] = 0;
+	blocks_len = 0;
+
+	uint64_t offset = 0;
+	while (offset < data_len) {
+		const uint8_t *header = data + offset;
+		if (data_len - offset < 18 || header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4)) break;
+
+		uint16_t extra_len = header[10] | (header[11] << 8);
+		uint64_t block_size = 0;
+		for (uint64_t i = 12; i + 4 <= 12 + (uint64_t) extra_len && offset + i + 6 <= data_len; ) {
+			uint16_t field_len = header[i + 2] | (header[i + 3] << 8);
+			if (header[i] == 'B' && header[i + 1] == 'C' && field_len == 2) {
+				block_size = (header[i + 4] | (header[i + 5] << 8)) + 1;
+				break;
+			}
+			i += 4 + field_len;
+		}
+		if (block_size == 0 || offset + block_size > data_len) break;
+
+		if (blocks_len == cap) {
+			cap *= 2;
+			block_offsets = (uint64_t *) realloc(block_offsets, sizeof(uint64_t) * (cap + 1));
+			block_output_offsets = (uint64_t *) realloc(block_output_offsets, sizeof(uint64_t) * (cap + 1));
+		}
+		const uint8_t *footer = data + offset + block_size - 4;
+		uint32_t output_len = footer[0] | (footer[1] << 8) | (footer[2] << 16) | ((uint32_t) footer[3] << 24);
+		offset += block_size;
+		blocks_len++;
+		block_offsets[blocks_len] = offset;
+		block_output_offsets[blocks_len] = block_output_offsets[blocks_len - 1] + output_len;
+	}
+
+	if (blocks_len == 0 || offset != data_len) {
+		if (blocks_len > 0) printf("BGZF block structure of %s ends early, reading it as gzip\n", filepath);
+		free(block_offsets);
+		free(block_output_offsets);
+		block_offsets = NULL;
+		block_output_offsets = NULL;
+		blocks_len = 0;
+		return false;
+	}
+
+	SetBlockRange(0, blocks_len, 0, block_output_offsets[blocks_len]);
+	return true;
+}
+
+// Finds the block starting at a compressed offset, the end of the file counting as one past the last block
+bool FileStream::FindBlock(uint64_t offset, uint64_t *block) {
+	uint64_t low = 0;
+	uint64_t high = blocks_len + 1;
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if (block_offsets[middle] < offset) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	*block = low;
+	return low <= blocks_len && block_offsets[low] == offset;
+}
+
+void FileStream::SetBlockRange(uint64_t first_block, uint64_t last_block, uint64_t output_start, uint64_t output_end) {
+	StopWorkers();
+	range_first_block = first_block;
+	range_blocks_len = last_block - first_block;
+	range_output_start = output_start;
+	range_output_end = output_end;
+	batches_len = (range_blocks_len + BGZF_BLOCKS_PER_BATCH - 1) / BGZF_BLOCKS_PER_BATCH;
+	next_claim = 0;
+	next_consume = 0;
+	released = 0;
+}
+
+bool FileStream::SetRange(uint64_t virtual_start, uint64_t virtual_end) {
+	if (mode != FILE_STREAM_BGZF || virtual_end < virtual_start) return false;
+
+	uint64_t first_block, end_block;
+	if (!FindBlock(virtual_start >> 16, &first_block) || !FindBlock(virtual_end >> 16, &end_block)) return false;
+	uint64_t output_start = block_output_offsets[first_block] + (virtual_start & 0xffff);
+	uint64_t output_end = block_output_offsets[end_block] + (virtual_end & 0xffff);
+	// The block holding the end is only decompressed if some of it is in the range
+	uint64_t last_block = ((virtual_end & 0xffff) > 0) ? end_block + 1 : end_block;
+	if (last_block > blocks_len || output_start > block_output_offsets[last_block] || output_end > block_output_offsets[last_block]) return false;
+
+	SetBlockRange(first_block, last_block, output_start, output_end);
+	return true;
+}
+
+const char *FileStream::Next(uint64_t *len) {
+	if (mode == FILE_STREAM_GZIP) return NextGzip(len);
+	if (mode == FILE_STREAM_BGZF) return NextBGZF(len);
+
+	if (plain_returned || plain_offset >= data_len) return NULL;
+	plain_returned = true;
+	*len = data_len - plain_offset;
+	return (const char *) (data + plain_offset);
+}
+
+const char *FileStream::NextGzip(uint64_t *len) {
+	if (gzip_ended) return NULL;
+
+	gzip_stream.next_out = (Bytef *) gzip_buffer;
+	gzip_stream.avail_out = GZIP_CHUNK_SIZE;
+	while (gzip_stream.avail_out > 0) {
+		// zlib takes at most 4 GB of input at a time
+		if (gzip_stream.avail_in == 0 && gzip_input_offset < data_len) {
+			uint64_t input_len = (data_len - gzip_input_offset > (1UL << 30)) ? (1UL << 30) : (data_len - gzip_input_offset);
+			gzip_stream.next_in = (Bytef *) (data + gzip_input_offset);
+			gzip_stream.avail_in = input_len;
+			gzip_input_offset += input_len;
+		}
+		int status = inflate(&gzip_stream, Z_NO_FLUSH);
+		if (status == Z_STREAM_END) {
+			// Concatenated gzip members continue the same file
+			if (gzip_stream.avail_in == 0 && gzip_input_offset == data_len) {
+				gzip_ended = true;
+				break;
+			}
+			inflateReset(&gzip_stream);
+		} else if (status != Z_OK) {
+			printf("Failed to decompress %s: %s\n", filepath, gzip_stream.msg ? gzip_stream.msg : "corrupt data");
+			gzip_ended = true;
+			break;
+		}
+	}
+
+	*len = GZIP_CHUNK_SIZE - gzip_stream.avail_out;
+	if (*len == 0) return NULL;
+	return gzip_buffer;
+}
+
+const char *FileStream::NextBGZF(uint64_t *len) {
+	if (workers.empty() && next_consume < batches_len) StartWorkers();
+
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	// The batch returned by the previous call is no longer needed
+	if (released < next_consume) {
+		released = next_consume;
+		queue_condition.notify_all();
+	}
+
+	while (next_consume < batches_len) {
+		struct bgzf_slot *slot = slots + (next_consume % slots_len);
+		queue_condition.wait(lock, [this, slot]() { return slot->batch == next_consume; });
+		next_consume++;
+		if (slot->failed) {
+			next_consume = batches_len;
+			break;
+		}
+		// The first and last batch are cut to the range
+		uint64_t batch_start = block_output_offsets[range_first_block + slot->batch * BGZF_BLOCKS_PER_BATCH];
+		uint64_t start = (range_output_start > batch_start) ? range_output_start - batch_start : 0;
+		uint64_t end = (range_output_end < batch_start + slot->len) ? range_output_end - batch_start : slot->len;
+		if (end > start) {
+			*len = end - start;
+			return slot->buffer + start;
+		}
+		// Batches without output, such as the end-of-file block, are passed over
+		released = next_consume;
+		queue_condition.notify_all();
+	}
+	return NULL;
+}
+
+void FileStream::StartWorkers() {
+	if (slots == NULL) {
+		slots_len = thread_count * BGZF_BATCHES_PER_THREAD;
+		slots = (struct bgzf_slot *) calloc(slots_len, sizeof(struct bgzf_slot));
+	}
+	for (uint32_t i = 0; i < slots_len; i++) slots[i].batch = UINT64_MAX;
+	stopping = false;
+	for (uint32_t t = 0; t < thread_count; t++) {
+		workers.emplace_back(&FileStream::RunWorker, this);
+	}
+}
+
+void FileStream::StopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	queue_condition.notify_all();
+	for (std::thread &worker : workers) worker.join();
+	workers.clear();
+}
+
+// Workers claim batches in file order, and wait for the reader to free the slot of a batch before filling it
+void FileStream::RunWorker() {
+	z_stream stream;
+	memset(&stream, 0, sizeof(z_stream));
+	inflateInit2(&stream, 15 + 16);
+
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	while (!stopping && next_claim < batches_len) {
+		uint64_t batch = next_claim++;
+		queue_condition.wait(lock, [this, batch]() { return stopping || batch < released + slots_len; });
+		if (stopping) break;
+		struct bgzf_slot *slot = slots + (batch % slots_len);
+
+		lock.unlock();
+		bool valid = InflateBatch(&stream, batch, slot);
+		lock.lock();
+
+		slot->failed = !valid;
+		slot->batch = batch;
+		queue_condition.notify_all();
+	}
+
+	inflateEnd(&stream);
+}
+
+bool FileStream::InflateBatch(z_stream *stream, uint64_t batch, struct bgzf_slot *slot) {
+	uint64_t first_block = range_first_block + batch * BGZF_BLOCKS_PER_BATCH;
+	uint64_t last_block = first_block + BGZF_BLOCKS_PER_BATCH;
+	if (last_block > range_first_block + range_blocks_len) last_block = range_first_block + range_blocks_len;
+
+	uint64_t output_len = block_output_offsets[last_block] - block_output_offsets[first_block];
+	if (output_len > slot->cap) {
+		slot->buffer = (char *) realloc(slot->buffer, output_len);
+		slot->cap = output_len;
+	}
+	slot->len = output_len;
+
+	for (uint64_t block = first_block; block < last_block; block++) {
+		inflateReset(stream);
+		stream->next_in = (Bytef *) (data + block_offsets[block]);
+		stream->avail_in = block_offsets[block + 1] - block_offsets[block];
+		stream->next_out = (Bytef *) (slot->buffer + block_output_offsets[block] - block_output_offsets[first_block]);
+		stream->avail_out = block_output_offsets[block + 1] - block_output_offsets[block];
+		if (inflate(stream, Z_FINISH) != Z_STREAM_END) {
+			printf("Failed to decompress BGZF block %lu of %s\n", block, filepath);
+			return false;
+		}
+	}
+	return true;
+}
+
+const char *FileStream::ReadAll(uint64_t *len) {
+	if (mode == FILE_STREAM_PLAIN) {
+		*len = data_len;
+		return (const char *) data;
+	}
+
+	if (all_data == NULL) {
+		Rewind();
+		uint64_t all_len = 0;
+		uint64_t all_cap = (mode == FILE_STREAM_BGZF) ? block_output_offsets[blocks_len] : GZIP_CHUNK_SIZE;
+		if (all_cap == 0) all_cap = 1;
+		all_data = (char *) malloc(all_cap + 1);
+		uint64_t chunk_len;
+		const char *chunk;
+		while ((chunk = Next(&chunk_len)) != NULL) {
+			if (all_len + chunk_len > all_cap) {
+				while (all_len + chunk_len > all_cap) all_cap *= 2;
+				all_data = (char *) realloc(all_data, all_cap + 1);
+			}
+			memcpy(all_data + all_len, chunk, chunk_len);
+			all_len += chunk_len;
+		}
+		all_data_len = all_len;
+	}
+
+	*len = all_data_len;
+	return all_data;
+}
+
+bool FileStream::Seek(uint64_t offset) {
+	if (mode == FILE_STREAM_GZIP) return false;
+	if (mode == FILE_STREAM_PLAIN) {
+		if (offset > data_len) return false;
+		plain_returned = false;
+		plain_offset = offset;
+		return true;
+	}
+
+	uint64_t output_end = block_output_offsets[blocks_len];
+	if (offset > output_end) return false;
+	// The last block starting at or before the offset, skipping blocks without output
+	uint64_t low = 0;
+	uint64_t high = blocks_len;
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if (block_output_offsets[middle + 1] <= offset) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	SetBlockRange(low, blocks_len, offset, output_end);
+	return true;
+}
+
+void FileStream::Rewind() {
+	plain_returned = false;
+	plain_offset = 0;
+	if (mode == FILE_STREAM_GZIP) {
+		inflateReset(&gzip_stream);
+		gzip_stream.avail_in = 0;
+		gzip_input_offset = 0;
+		gzip_ended = false;
+	} else if (mode == FILE_STREAM_BGZF) {
+		SetBlockRange(0, blocks_len, 0, block_output_offsets[blocks_len]);
+	}
+}
@@ -0,0 +1,119 @@
+#ifndef KIVS_FILE_STREAM
+#define KIVS_FILE_STREAM
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <zlib.h>
+
+// Decompressed output of a plain gzip file is handed out in pieces of this size
+#define GZIP_CHUNK_SIZE (4 << 20)
+// BGZF blocks are decompressed in batches of this many blocks, about 4 MB of output
+#define BGZF_BLOCKS_PER_BATCH 64
+// Every decompression thread may run this many batches ahead of the reader
+#define BGZF_BATCHES_PER_THREAD 2
+
+#define FILE_STREAM_PLAIN 0
+#define FILE_STREAM_GZIP 1
+#define FILE_STREAM_BGZF 2
+
+// A batch of decompressed BGZF blocks
+struct bgzf_slot {
+	char *buffer;
+	uint64_t cap;
+	uint64_t len;
+	// The batch held by the slot once it is decompressed, UINT64_MAX while it is not
+	uint64_t batch;
+	bool failed;
+};
+
+// Reads plain, gzip and BGZF files through the same interface.
+// Plain files are mapped and handed out whole. BGZF blocks are independent, so batches of them are
+// decompressed on a pool of threads and queued in a bounded ring of slots until the reader takes them.
+class FileStream {
+public:
+	uint8_t mode;
+
+private:
+	char *filepath;
+	const uint8_t *data;
+	uint64_t data_len;
+	bool plain_returned;
+	// Where Next starts handing out a plain file
+	uint64_t plain_offset;
+
+	// Plain gzip
+	z_stream gzip_stream;
+	uint64_t gzip_input_offset;
+	char *gzip_buffer;
+	bool gzip_ended;
+
+	// BGZF
+	uint64_t *block_offsets;
+	uint64_t *block_output_offsets;
+	uint64_t blocks_len;
+	// The blocks and decompressed bytes Next hands out, the whole file unless SetRange limited them
+	uint64_t range_first_block;
+	uint64_t range_blocks_len;
+	uint64_t range_output_start;
+	uint64_t range_output_end;
+	uint64_t batches_len;
+	uint32_t thread_count;
+	struct bgzf_slot *slots;
+	uint32_t slots_len;
+	uint64_t next_claim;
+	uint64_t next_consume;
+	uint64_t released;
+	bool stopping;
+	std::mutex queue_mutex;
+	std::condition_variable queue_condition;
+	std::vector<std::thread> workers;
+
+	// Whole file for ReadAll, when it is compressed
+	char *all_data;
+	uint64_t all_data_len;
+
+public:
+	~FileStream();
+
+	// A thread_count of 0 uses all hardware threads for BGZF files
+	static FileStream *Open(char *filepath, uint32_t thread_count = 0);
+	// Returns the next piece of the decompressed file, valid until the following call, or NULL at the end
+	const char *Next(uint64_t *len);
+	// Returns the whole decompressed file, valid until the stream is deleted
+	const char *ReadAll(uint64_t *len);
+	void Rewind();
+	// Limits Next to the bytes between two BGZF virtual offsets, the compressed offset of a block shifted
+	// left by 16 plus an offset into its decompressed bytes. Returns false if the file is not BGZF or
+	// the offsets do not fall on its blocks.
+	bool SetRange(uint64_t virtual_start, uint64_t virtual_end);
+	// Makes Next continue from an offset into the decompressed file, up to its end.
+	// Returns false for gzip files, which can only be read from the start, and for offsets past the end.
+	bool Seek(uint64_t offset);
+	bool IsSeekable() {
+		return mode != FILE_STREAM_GZIP;
+	}
+	bool IsCompressed() {
+		return mode != FILE_STREAM_PLAIN;
+	}
+
+private:
+	FileStream(char *filepath, uint32_t thread_count);
+
+	bool IndexBGZFBlocks();
+	bool FindBlock(uint64_t offset, uint64_t *block);
+	void SetBlockRange(uint64_t first_block, uint64_t last_block, uint64_t output_start, uint64_t output_end);
+	const char *NextGzip(uint64_t *len);
+	const char *NextBGZF(uint64_t *len);
+	void StartWorkers();
+	void StopWorkers();
+	void RunWorker();
+	bool InflateBatch(z_stream *stream, uint64_t batch, struct bgzf_slot *slot);
+};
+
+#endif
@@ -1,210 +1,366 @@
 #include "GFA.hpp"
 #include <iostream>
+#include <thread>
+#include "threads.hpp"
 
-GFA *GFA::ReadFile(char *filepath, const char *encoding) {
-	GFA *gfa = new GFA(filepath, encoding);
-	gfa->source_file = fopen(filepath, "rb");
+// The file is mapped, or decompressed, once and S, L and P records are collected in a single scan.
+// Line and field boundaries are found with memchr, which libc vectorizes.
+GFA *GFA::ReadFile(char *filepath, const char *encoding, uint32_t thread_count) {
+	FileStream *stream = FileStream::Open(filepath, thread_count);
+	if (stream == NULL) {
+		printf("Failed to open GFA file %s\n", filepath);
+		return NULL;
+	}
 
-	gfa->ReadNodeCountAndIDRange();
+	// Sequences are referenced from the file contents, so compressed files are decompressed into memory whole
+	GFA *gfa = new GFA(filepath, encoding);
+	gfa->stream = stream;
+	gfa->data = stream->ReadAll(&gfa->data_len);
 
-	gfa->InitializeArrays();
+	if (thread_count == 0) {
+		thread_count = std::thread::hardware_concurrency();
+		if (thread_count > gfa->data_len / GFA_MIN_BYTES_PER_THREAD) thread_count = gfa->data_len / GFA_MIN_BYTES_PER_THREAD;
+		if (thread_count == 0) thread_count = 1;
+	}
+	gfa->thread_count = thread_count;
 
-	gfa->ReadSequences();
+	gfa->ScanFile();
 
-	gfa->ReadReferenceNodes();
+	gfa->ResolveIDRange();
 
-	gfa->CountEdges();
+	gfa->ResolveSequences();
 
-	gfa->InitializeEdges();
+	gfa->ReadReferenceNodes();
 
-	gfa->ReadEdges();
-	
-	fclose(gfa->source_file);
+	gfa->ResolveLinks();
 
 	return gfa;
 }
 
-void GFA::InitializeArrays() {
-	sequences          = (uint64_t *) malloc(sizeof(uint64_t) * node_count);
-	sequence_lengths   = (uint32_t *) malloc(sizeof(uint32_t) * node_count);
-	edges_out          = (uint32_t **) malloc(sizeof(uint32_t *) * node_count);
-	edges_in           = (uint32_t **) malloc(sizeof(uint32_t *) * node_count);
-	edges_out_lengths  = (uint8_t *) malloc(sizeof(uint8_t) * node_count);
-	edges_in_lengths   = (uint8_t *) malloc(sizeof(uint8_t) * node_count);
-	reference_indices  = (uint32_t *) malloc(sizeof(uint32_t) * node_count);
-	reference_nodes    = (bool *) malloc(sizeof(bool) * node_count);
-	id_map             = (uint32_t *) malloc(sizeof(uint32_t) * node_count);
+// Every thread scans a newline-aligned chunk of the file, and the chunks are joined in file order
+void GFA::ScanFile() {
+	if (thread_count == 1) {
+		ScanRecords(0, data_len, &records);
+		return;
+	}
 
-	memset(reference_indices, 0, sizeof(uint32_t) * node_count);
-	memset(reference_nodes, false, sizeof(uint8_t) * node_count);
-	memset(edges_in_lengths, 0, sizeof(uint8_t) * node_count);
-	memset(edges_out_lengths, 0, sizeof(uint8_t) * node_count);
-}
-
-void GFA::ReadNodeCountAndIDRange() {
-	bool newline = false;
-	int c;
-	node_count = 0;
-	min_node_id = -1L;
-	max_node_id = 0;
-	
-	fseek(source_file, 0, SEEK_SET);
-	while ((c = fgetc(source_file)) != EOF) {
-		if (c == 'S' && newline) {
-			fgetc(source_file);
-			fgets(line_buffer, 1024, source_file);
-			sscanf(line_buffer, "%s\t", id_buffer);
-			uint32_t id = strtoull(id_buffer, NULL, 10);
-			node_count++;
-			if (id > max_node_id) max_node_id = id;
-			if (id < min_node_id) min_node_id = id;
-		} else {
-			newline = (c == '\n');
-		}
+	uint64_t *chunk_starts = (uint64_t *) malloc(sizeof(uint64_t) * (thread_count + 1));
+	chunk_starts[0] = 0;
+	chunk_starts[thread_count] = data_len;
+	for (uint32_t t = 1; t < thread_count; t++) {
+		uint64_t start = data_len / thread_count * t;
+		if (start < chunk_starts[t - 1]) start = chunk_starts[t - 1];
+		const char *newline = (const char *) memchr(data + start, '\n', data_len - start);
+		chunk_starts[t] = (newline == NULL) ? data_len : (newline - data) + 1;
 	}
 
-	if (min_node_id + node_count - 1 == max_node_id) {
-		printf("Node ID space is continuous from ID %u to %u.\n", min_node_id, max_node_id);
-		if (min_node_id != 0) printf("Remapping IDs to start from 0.\n");
-		id_offset = min_node_id;
-		use_id_map = false;
-	} else {
-		printf("Node ID space is not continuous. Remapping IDs completely.\n");
-		use_id_map = true;
+	struct gfa_records *chunks = (struct gfa_records *) calloc(thread_count, sizeof(struct gfa_records));
+	std::vector<std::thread> threads;
+	for (uint32_t t = 0; t < thread_count; t++) {
+		threads.emplace_back([this, chunk_starts, chunks, t]() {
+			ScanRecords(chunk_starts[t], chunk_starts[t + 1], chunks + t);
+		});
 	}
+	for (std::thread &thread : threads) thread.join();
+
+	MergeRecords(chunks, thread_count);
+	for (uint32_t t = 0; t < thread_count; t++) FreeRecords(chunks + t);
+	free(chunks);
+	free(chunk_starts);
 }
 
-void GFA::ReadSequences() {
-	bool newline = false;
-	int c;
-	int32_t id_map_index = 0;
-	fseek(source_file, 0, SEEK_SET);
-	while ((c = fgetc(source_file)) != EOF) {
-		if (c == 'S' && newline) {
-			fgetc(source_file);
-			fgets(line_buffer, 1024, source_file);
-			sscanf(line_buffer, "%s\t%s\n", id_buffer, sequence_buffer);
-			uint32_t id = strtoull(id_buffer, NULL, 10);
-			if (use_id_map) {
-				id_map[id_map_index] = id;
-				id = id_map_index;
-				id_map_index++;
-			} else {
-				id -= id_offset;
-			}
-			sequence_lengths[id] = strlen(sequence_buffer);
-			sequences[id] = hash_max_kmer_by_map(sequence_buffer, sequence_lengths[id], encoding_map);
-		} else {
-			newline = (c == '\n');
+void GFA::MergeRecords(struct gfa_records *chunks, uint32_t chunks_len) {
+	for (uint32_t t = 0; t < chunks_len; t++) {
+		records.segments_cap += chunks[t].segments_len;
+		records.links_cap += chunks[t].links_len;
+		records.paths_cap += chunks[t].paths_len;
+	}
+	records.segment_names = (struct gfa_span *) malloc(sizeof(struct gfa_span) * records.segments_cap);
+	records.segment_sequences = (struct gfa_span *) malloc(sizeof(struct gfa_span) * records.segments_cap);
+	records.link_names = (struct gfa_span *) malloc(sizeof(struct gfa_span) * 2 * records.links_cap);
+	records.paths = (struct gfa_span *) malloc(sizeof(struct gfa_span) * records.paths_cap);
+
+	for (uint32_t t = 0; t < chunks_len; t++) {
+		struct gfa_records *chunk = chunks + t;
+		if (chunk->segments_len > 0) {
+			memcpy(records.segment_names + records.segments_len, chunk->segment_names, sizeof(struct gfa_span) * chunk->segments_len);
+			memcpy(records.segment_sequences + records.segments_len, chunk->segment_sequences, sizeof(struct gfa_span) * chunk->segments_len);
+		}
+		if (chunk->links_len > 0) {
+			memcpy(records.link_names + records.links_len * 2, chunk->link_names, sizeof(struct gfa_span) * 2 * chunk->links_len);
+		}
+		if (chunk->paths_len > 0) {
+			memcpy(records.paths + records.paths_len, chunk->paths, sizeof(struct gfa_span) * chunk->paths_len);
 		}
+		records.segments_len += chunk->segments_len;
+		records.links_len += chunk->links_len;
+		records.paths_len += chunk->paths_len;
 	}
 }
 
-void GFA::ReadReferenceNodes() {
-	bool newline = false;
-	int c;
-	fseek(source_file, 0, SEEK_SET);
-	while ((c = fgetc(source_file)) != EOF) {
-		if (c == 'P' && newline) {
-			fgetc(source_file);
-			while ((c = fgetc(source_file)) != '\t') {}
-			int64_t id;
-			uint32_t ref_index = 0;
-			while ((id = ReadNextID()) != -1) {
-				reference_nodes[id] = true;
-				reference_indices[id] = ref_index++;
+void GFA::FreeRecords(struct gfa_records *chunk) {
+	free(chunk->segment_names);
+	free(chunk->segment_sequences);
+	free(chunk->link_names);
+	free(chunk->paths);
+	memset(chunk, 0, sizeof(struct gfa_records));
+}
+
+void GFA::ScanRecords(uint64_t start, uint64_t end, struct gfa_records *chunk) {
+	uint64_t line_start = start;
+	while (line_start < end) {
+		const char *newline = (const char *) memchr(data + line_start, '\n', end - line_start);
+		uint64_t line_end = (newline == NULL) ? end : (newline - data);
+		uint64_t next_line = line_end + 1;
+		if (line_end > line_start && data[line_end - 1] == '\r') line_end--;
+
+		if (line_end - line_start > 2 && data[line_start + 1] == '\t') {
+			switch (data[line_start]) {
+			case 'S':
+				AddSegment(chunk, line_start, line_end);
+				break;
+			case 'L':
+				AddLink(chunk, line_start, line_end);
+				break;
+			case 'P':
+				AddPath(chunk, line_start, line_end);
+				break;
 			}
-		} else {
-			newline = (c == '\n');
 		}
+
+		line_start = next_line;
 	}
 }
 
-void GFA::CountEdges() {
-	bool newline = false;
-	int c;
-	fseek(source_file, 0, SEEK_SET);
-	while ((c = fgetc(source_file)) != EOF) {
-		if (c == 'L' && newline) {
-			fgetc(source_file);
-			fgets(line_buffer, 1024, source_file);
-			sscanf(line_buffer, "%s\t+\t%s\t+\n", id_buffer, edge_buffer);
-			uint32_t id = strtoull(id_buffer, NULL, 10);
-			uint32_t edge = strtoull(edge_buffer, NULL, 10);
-			id = (use_id_map ? GetMappedID(id) : (id - id_offset));
-			edge = (use_id_map ? GetMappedID(edge) : (edge - id_offset));
-			edges_out_lengths[id]++;
-			edges_in_lengths[edge]++;
-		} else {
-			newline = (c == '\n');
-		}
+// Returns where the given tab-separated field of a line starts, or the line end if it has fewer fields
+uint64_t GFA::FindField(uint64_t start, uint64_t end, uint8_t field) {
+	for (uint8_t i = 0; i < field; i++) {
+		const char *tab = (const char *) memchr(data + start, '\t', end - start);
+		if (tab == NULL) return end;
+		start = (tab - data) + 1;
 	}
+	return start;
 }
 
-void GFA::InitializeEdges() {
-	for (uint32_t index = 0; index < node_count; index++) {
-		if (edges_out_lengths[index] > 0) {
-			edges_out[index] = (uint32_t *) malloc(sizeof(uint32_t) * edges_out_lengths[index]);
-		} else {
-			edges_out[index] = NULL;
-		}
+uint64_t GFA::FindFieldEnd(uint64_t start, uint64_t end) {
+	const char *tab = (const char *) memchr(data + start, '\t', end - start);
+	return (tab == NULL) ? end : (tab - data);
+}
 
-		if (edges_in_lengths[index] > 0) {
-			edges_in[index] = (uint32_t *) malloc(sizeof(uint32_t) * edges_in_lengths[index]);
-		} else {
-			edges_in[index] = NULL;
-		}
+void GFA::AddSegment(struct gfa_records *chunk, uint64_t line_start, uint64_t line_end) {
+	if (chunk->segments_len == chunk->segments_cap) {
+		chunk->segments_cap = (chunk->segments_cap == 0) ? 1024 : chunk->segments_cap * 2;
+		chunk->segment_names = (struct gfa_span *) realloc(chunk->segment_names, sizeof(struct gfa_span) * chunk->segments_cap);
+		chunk->segment_sequences = (struct gfa_span *) realloc(chunk->segment_sequences, sizeof(struct gfa_span) * chunk->segments_cap);
+	}
+
+	uint64_t sequence_start = FindField(line_start, line_end, 2);
+	uint64_t sequence_end = FindFieldEnd(sequence_start, line_end);
+	// A '*' sequence is not stored in the file
+	if (sequence_end - sequence_start == 1 && data[sequence_start] == '*') sequence_end = sequence_start;
+
+	uint32_t index = chunk->segments_len++;
+	chunk->segment_names[index].start = line_start + 2;
+	chunk->segment_names[index].length = FindFieldEnd(line_start + 2, line_end) - (line_start + 2);
+	chunk->segment_sequences[index].start = sequence_start;
+	chunk->segment_sequences[index].length = sequence_end - sequence_start;
+}
+
+void GFA::AddLink(struct gfa_records *chunk, uint64_t line_start, uint64_t line_end) {
+	if (chunk->links_len == chunk->links_cap) {
+		chunk->links_cap = (chunk->links_cap == 0) ? 1024 : chunk->links_cap * 2;
+		chunk->link_names = (struct gfa_span *) realloc(chunk->link_names, sizeof(struct gfa_span) * 2 * chunk->links_cap);
 	}
+
+	// Names are resolved once all segments have been seen
+	uint64_t to_start = FindField(line_start, line_end, 3);
+	struct gfa_span *names = chunk->link_names + chunk->links_len * 2;
+	names[0].start = line_start + 2;
+	names[0].length = FindFieldEnd(line_start + 2, line_end) - (line_start + 2);
+	names[1].start = to_start;
+	names[1].length = FindFieldEnd(to_start, line_end) - to_start;
+	chunk->links_len++;
 }
 
-void GFA::ReadEdges() {
-	memset(edges_out_lengths, 0, sizeof(uint8_t) * node_count);
-	memset(edges_in_lengths, 0, sizeof(uint8_t) * node_count);
-
-	bool newline;
-	int c;
-	fseek(source_file, 0, SEEK_SET);
-	while ((c = fgetc(source_file)) != EOF) {
-		if (c == 'L' && newline) {
-			fgetc(source_file);
-			fgets(line_buffer, 1024, source_file);
-			sscanf(line_buffer, "%s\t+\t%s\t+\n", id_buffer, edge_buffer);
-			uint32_t id = strtoull(id_buffer, NULL, 10);
-			uint32_t edge = strtoull(edge_buffer, NULL, 10);
-			id = (use_id_map ? GetMappedID(id) : (id - id_offset));
-			edge = (use_id_map ? GetMappedID(edge) : (edge - id_offset));
-			edges_out[id][edges_out_lengths[id]++] = edge;
-			edges_in[edge][edges_in_lengths[edge]++] = id;
-		} else {
-			newline = (c == '\n');
+void GFA::AddPath(struct gfa_records *chunk, uint64_t line_start, uint64_t line_end) {
+	if (chunk->paths_len == chunk->paths_cap) {
+		chunk->paths_cap = (chunk->paths_cap == 0) ? 16 : chunk->paths_cap * 2;
+		chunk->paths = (struct gfa_span *) realloc(chunk->paths, sizeof(struct gfa_span) * chunk->paths_cap);
+	}
+
+	uint64_t segments_start = FindField(line_start, line_end, 2);
+	uint64_t segments_end = FindFieldEnd(segments_start, line_end);
+	chunk->paths[chunk->paths_len].start = segments_start;
+	chunk->paths[chunk->paths_len].length = segments_end - segments_start;
+	chunk->paths_len++;
+}
+
+// Parses a name made up only of digits, as used by most GFA writers
+bool GFA::ParseID(struct gfa_span *name, uint32_t *id) {
+	if (name->length == 0 || name->length > 9) return false;
+	uint32_t value = 0;
+	for (uint64_t i = name->start; i < name->start + name->length; i++) {
+		if (data[i] < '0' || data[i] > '9') return false;
+		value = value * 10 + (data[i] - '0');
+	}
+	*id = value;
+	return true;
+}
+
+// FNV-1a
+uint64_t GFA::HashName(struct gfa_span *name) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (uint64_t i = name->start; i < name->start + name->length; i++) {
+		hash ^= (uint8_t) data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool GFA::NamesEqual(struct gfa_span *a, struct gfa_span *b) {
+	return a->length == b->length && memcmp(data + a->start, data + b->start, a->length) == 0;
+}
+
+void GFA::ResolveIDRange() {
+	node_count = records.segments_len;
+	links_len = records.links_len;
+	id_offset = 0;
+	use_id_map = false;
+	if (node_count == 0) return;
+
+	// Numeric names that cover a range without gaps are turned into node IDs by subtraction
+	bool numeric = true;
+	uint32_t min_node_id = -1L;
+	uint32_t max_node_id = 0;
+	for (uint32_t index = 0; index < node_count && numeric; index++) {
+		uint32_t id;
+		numeric = ParseID(records.segment_names + index, &id);
+		if (!numeric) break;
+		if (id > max_node_id) max_node_id = id;
+		if (id < min_node_id) min_node_id = id;
+	}
+
+	// As many names as the range is wide only cover it if none of them repeats
+	if (numeric && min_node_id + node_count - 1 == max_node_id) {
+		uint64_t *seen = (uint64_t *) calloc((node_count + 63) / 64, sizeof(uint64_t));
+		for (uint32_t index = 0; index < node_count && numeric; index++) {
+			uint32_t id;
+			ParseID(records.segment_names + index, &id);
+			id -= min_node_id;
+			numeric = !(seen[id >> 6] & (1ULL << (id & 63)));
+			seen[id >> 6] |= (1ULL << (id & 63));
 		}
+		free(seen);
+	}
+
+	if (numeric && min_node_id + node_count - 1 == max_node_id) {
+		printf("Node ID space is continuous from ID %u to %u.\n", min_node_id, max_node_id);
+		if (min_node_id != 0) printf("Remapping IDs to start from 0.\n");
+		id_offset = min_node_id;
+	} else {
+		printf("Node ID space is not continuous. Remapping IDs completely.\n");
+		use_id_map = true;
+		BuildIDMap();
 	}
 }
 
-int64_t GFA::ReadNextID() {
-	int c;
-	id_buffer_length = 0;
-	while ((c = fgetc(source_file)) != '\n') {
-		if (c >= '0' && c <= '9') {
-			id_buffer[id_buffer_length++] = c;
-		} else if (id_buffer_length > 0) {
-			id_buffer[id_buffer_length] = '\0';
-			int64_t id = strtoll(id_buffer, NULL, 10);
-			id = (use_id_map ? GetMappedID(id) : (id - id_offset));
-			return id;
+// Segments are numbered in file order and looked up by name with linear probing
+void GFA::BuildIDMap() {
+	id_map_cap = 1024;
+	while (id_map_cap < (uint64_t) node_count * 2) id_map_cap *= 2;
+	id_map = (uint32_t *) malloc(sizeof(uint32_t) * id_map_cap);
+	memset(id_map, 0xFF, sizeof(uint32_t) * id_map_cap);
+
+	uint64_t mask = id_map_cap - 1;
+	for (uint32_t index = 0; index < node_count; index++) {
+		uint64_t slot = HashName(records.segment_names + index) & mask;
+		while (id_map[slot] != UINT32_MAX) {
+			if (NamesEqual(records.segment_names + id_map[slot], records.segment_names + index)) break;
+			slot = (slot + 1) & mask;
 		}
+		if (id_map[slot] == UINT32_MAX) id_map[slot] = index;
+	}
+
+	printf("Segment ID map uses %lu bytes for %u segments.\n", sizeof(uint32_t) * id_map_cap, node_count);
+}
+
+// Returns UINT32_MAX for names that are not segments of the file
+uint32_t GFA::GetNodeID(struct gfa_span *name) {
+	if (!use_id_map) {
+		uint32_t id;
+		if (!ParseID(name, &id) || id < id_offset || id - id_offset >= node_count) return UINT32_MAX;
+		return id - id_offset;
+	}
+
+	uint64_t mask = id_map_cap - 1;
+	uint64_t slot = HashName(name) & mask;
+	while (id_map[slot] != UINT32_MAX) {
+		if (NamesEqual(records.segment_names + id_map[slot], name)) return id_map[slot];
+		slot = (slot + 1) & mask;
+	}
+	return UINT32_MAX;
+}
+
+// Sequences are left in the mapped file, to be packed by the graph without copies
+void GFA::ResolveSequences() {
+	if (!use_id_map) {
+		node_sequences = (struct gfa_span *) malloc(sizeof(struct gfa_span) * node_count);
+		run_in_threads(thread_count, node_count, [this](uint32_t start, uint32_t end, uint32_t t) {
+			(void) t;
+			for (uint32_t index = start; index < end; index++) {
+				node_sequences[GetNodeID(records.segment_names + index)] = records.segment_sequences[index];
+			}
+		});
+		free(records.segment_sequences);
+	} else {
+		node_sequences = records.segment_sequences;
 	}
-	return -1;
+	records.segment_sequences = NULL;
 }
 
-uint32_t GFA::GetMappedID(uint32_t id) {
-	for (uint32_t mapped_id = 0; mapped_id < node_count; mapped_id++) {
-		if (id_map[mapped_id] == id) {
-			return mapped_id;
+void GFA::ReadReferenceNodes() {
+	reference_indices = (uint32_t *) malloc(sizeof(uint32_t) * node_count);
+	reference_nodes   = (bool *) malloc(sizeof(bool) * node_count);
+	memset(reference_indices, 0, sizeof(uint32_t) * node_count);
+	memset(reference_nodes, false, sizeof(bool) * node_count);
+
+	for (uint32_t path = 0; path < records.paths_len; path++) {
+		uint64_t position = records.paths[path].start;
+		uint64_t end = position + records.paths[path].length;
+		uint32_t ref_index = 0;
+		while (position < end) {
+			// Steps are segment names followed by + or -, separated by commas
+			const char *comma = (const char *) memchr(data + position, ',', end - position);
+			uint64_t step_end = (comma == NULL) ? end : (comma - data);
+			struct gfa_span name = { position, step_end - position };
+			if (name.length > 0 && (data[step_end - 1] == '+' || data[step_end - 1] == '-')) name.length--;
+			uint32_t id = GetNodeID(&name);
+			if (id != UINT32_MAX) {
+				reference_nodes[id] = true;
+				reference_indices[id] = ref_index++;
+			}
+			position = step_end + 1;
 		}
 	}
-	std::cout << "Fatal Error: Did not find a mapped ID." << std::endl;
-	return -1;
 }
 
+// Lookups only read the ID map, so links are resolved in parallel
+void GFA::ResolveLinks() {
+	links_from = (uint32_t *) malloc(sizeof(uint32_t) * links_len);
+	links_to   = (uint32_t *) malloc(sizeof(uint32_t) * links_len);
+	uint32_t missing = 0;
+	run_in_threads(thread_count, links_len, [this, &missing](uint32_t start, uint32_t end, uint32_t t) {
+		(void) t;
+		uint32_t thread_missing = 0;
+		for (uint32_t index = start; index < end; index++) {
+			links_from[index] = GetNodeID(records.link_names + index * 2);
+			links_to[index] = GetNodeID(records.link_names + index * 2 + 1);
+			if (links_from[index] == UINT32_MAX || links_to[index] == UINT32_MAX) thread_missing++;
+		}
+		__atomic_fetch_add(&missing, thread_missing, __ATOMIC_RELAXED);
+	});
+	if (missing > 0) printf("Skipping %u links to unknown segments.\n", missing);
 
+	free(records.link_names);
+	records.link_names = NULL;
+}
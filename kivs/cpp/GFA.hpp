@@ -5,87 +5,121 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <cstring>
-#include "hashing.hpp"
+#include "FileStream.hpp"
+
+// When the thread count is chosen automatically, every thread gets at least this many bytes
+#define GFA_MIN_BYTES_PER_THREAD (4 << 20)
+
+// A field of a line in the mapped file
+struct gfa_span {
+	uint64_t start;
+	uint64_t length;
+};
+
+// Records collected by scanning part of the file, resolved once all segments are known
+struct gfa_records {
+	struct gfa_span *segment_names;
+	struct gfa_span *segment_sequences;
+	uint32_t segments_len;
+	uint32_t segments_cap;
+	// Two names, from and to, per link
+	struct gfa_span *link_names;
+	uint32_t links_len;
+	uint32_t links_cap;
+	struct gfa_span *paths;
+	uint32_t paths_len;
+	uint32_t paths_cap;
+};
 
 class GFA {
 public:
 	char encoding[4];
 	uint32_t node_count;
-	uint64_t *sequences;
-	uint32_t *sequence_lengths;
-	uint32_t **edges_out;
-	uint32_t **edges_in;
-	uint8_t *edges_out_lengths;
-	uint8_t *edges_in_lengths;
+	// Where the bases of every node are in the mapped file
+	struct gfa_span *node_sequences;
+	// Link i goes from node links_from[i] to node links_to[i]
+	uint32_t *links_from;
+	uint32_t *links_to;
+	uint32_t links_len;
 	uint32_t *reference_indices;
 	bool *reference_nodes;
+	// The number of threads the file was read with
+	uint32_t thread_count;
 
 private:
-	uint8_t encoding_map[256];
 	char *filepath;
-	FILE *source_file;
-	uint32_t min_node_id;
-	uint32_t max_node_id;
+	FileStream *stream;
+	const char *data;
+	uint64_t data_len;
+	struct gfa_records records;
+	// Open addressing table of node IDs, hashed by segment name
 	uint32_t *id_map;
+	uint64_t id_map_cap;
 	bool use_id_map;
 	uint32_t id_offset;
-	char line_buffer[1024];
-	char id_buffer[64];
-	char edge_buffer[64];
-	char sequence_buffer[64];
-	uint8_t id_buffer_length;
 
 public:
 	~GFA() {
-		if (sequences) free(sequences);
-		if (sequence_lengths) free(sequence_lengths);
-		if (edges_out) {
-			for (uint32_t i = 0; i < node_count; i++) {
-				if (edges_out[i]) free(edges_out[i]);
-			}
-			free(edges_out);
-		}
-		if (edges_in) {
-			for (uint32_t i = 0; i < node_count; i++) {
-				if (edges_in[i]) free(edges_in[i]);
-			}
-			free(edges_in);
-		}
-		if (edges_out_lengths) free(edges_out_lengths);
-		if (edges_in_lengths) free(edges_in_lengths);
+		if (stream) delete stream;
+		if (node_sequences) free(node_sequences);
+		if (links_from) free(links_from);
+		if (links_to) free(links_to);
 		if (reference_indices) free(reference_indices);
 		if (reference_nodes) free(reference_nodes);
+		FreeRecords(&records);
 		if (id_map) free(id_map);
 		free(filepath);
 	}
 
-	static GFA *ReadFile(char *filepath, const char *encoding);
+	// A thread_count of 0 uses as many hardware threads as the file size warrants
+	static GFA *ReadFile(char *filepath, const char *encoding, uint32_t thread_count = 0);
+
+	// The unencoded bases of a node, which stay in memory until the GFA is deleted
+	const char *GetSequence(uint32_t node_id) {
+		return data + node_sequences[node_id].start;
+	}
+	uint32_t GetSequenceLength(uint32_t node_id) {
+		return node_sequences[node_id].length;
+	}
 private:
 
 	GFA(char *filepath, const char *encoding) {
 		this->filepath = strdup(filepath);
 		memcpy(this->encoding, encoding, sizeof(char) * 4);
-		fill_map_by_encoding(this->encoding_map, encoding);
-		sequences = NULL;
-		sequence_lengths = NULL;
-		edges_out = NULL;
-		edges_in = NULL;
-		edges_out_lengths = NULL;
-		edges_in_lengths = NULL;
+		node_count = 0;
+		node_sequences = NULL;
+		links_from = NULL;
+		links_to = NULL;
+		links_len = 0;
 		reference_indices = NULL;
 		reference_nodes = NULL;
+		stream = NULL;
+		data = NULL;
+		data_len = 0;
+		thread_count = 1;
+		memset(&records, 0, sizeof(struct gfa_records));
 		id_map = NULL;
+		id_map_cap = 0;
 	}
 
-	void ReadNodeCountAndIDRange();
-	void InitializeArrays();
-	void ReadSequences();
+	void ScanFile();
+	void ScanRecords(uint64_t start, uint64_t end, struct gfa_records *chunk);
+	void MergeRecords(struct gfa_records *chunks, uint32_t chunks_len);
+	static void FreeRecords(struct gfa_records *chunk);
+	void AddSegment(struct gfa_records *chunk, uint64_t line_start, uint64_t line_end);
+	void AddLink(struct gfa_records *chunk, uint64_t line_start, uint64_t line_end);
+	void AddPath(struct gfa_records *chunk, uint64_t line_start, uint64_t line_end);
+	void ResolveIDRange();
+	void BuildIDMap();
+	void ResolveSequences();
 	void ReadReferenceNodes();
-	void CountEdges();
-	void InitializeEdges();
-	void ReadEdges();
-	int64_t ReadNextID();
-	uint32_t GetMappedID(uint32_t);
+	void ResolveLinks();
+	uint64_t FindField(uint64_t start, uint64_t end, uint8_t field);
+	uint64_t FindFieldEnd(uint64_t start, uint64_t end);
+	bool ParseID(struct gfa_span *name, uint32_t *id);
+	uint64_t HashName(struct gfa_span *name);
+	bool NamesEqual(struct gfa_span *a, struct gfa_span *b);
+	uint32_t GetNodeID(struct gfa_span *name);
 };
 
 #endif
@@ -6,13 +6,27 @@
 #include <queue>
 #include <vector>
 #include <bits/stdc++.h>
-
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+
+#include "GraphBuilder.hpp"
+#include "threads.hpp"
 #include "GFA.hpp"
 #include "VCF.hpp"
 #include "FASTA.hpp"
 
 #define LINE_BUF_LEN 1024
 #define DEFAULT_ENCODING "ACGT"
+// Bases read at a time after the last variant of a contig, a multiple of 32
+#define TAIL_CHUNK_BASES (1 << 20)
+// Records parsed into a batch and bases packed into a chunk at a time by the pipelined build, and how many
+// of either may wait for the builder
+#define PIPELINE_VCF_BATCH_LEN 16384
+#define PIPELINE_REFERENCE_CHUNK_BASES (1 << 20)
+#define PIPELINE_QUEUE_LEN 4
 
 struct queue_node {
 	uint32_t id;
@@ -22,43 +36,70 @@ struct queue_node {
 		: id(id), depth(depth) {}
 };
 
+// Writes up to 32 left-aligned bases into a zeroed arena at the given base offset.
+// Sequences written by different threads may share the words at their ends, so the bits are combined atomically.
+static void write_packed_bases(uint64_t *arena, uint64_t offset, uint64_t packed, uint8_t length) {
+	if (length < 32) packed &= ~(~0ULL >> (length * 2));
+	uint64_t bit = offset * 2;
+	uint64_t *word = arena + (bit >> 6);
+	uint8_t shift = bit & 63;
+	__atomic_fetch_or(word, packed >> shift, __ATOMIC_RELAXED);
+	if (shift != 0) __atomic_fetch_or(word + 1, packed << (64 - shift), __ATOMIC_RELAXED);
+}
+
 Graph *Graph::FromGFAFile(char *filepath) {
 	return FromGFAFileEncoded(filepath, DEFAULT_ENCODING);
 }
 
-Graph *Graph::FromGFAFileEncoded(char *filepath, const char *encoding) {
-	GFA *gfa = GFA::ReadFile(filepath, encoding);
-	
+Graph *Graph::FromGFAFileEncoded(char *filepath, const char *encoding, uint32_t thread_count) {
+	GFA *gfa = GFA::ReadFile(filepath, encoding, thread_count);
+	if (gfa == NULL) return NULL;
+
 	Graph *graph = new Graph(encoding);
-	
-	graph->nodes_len = gfa->node_count;
-	graph->nodes = (struct node *) malloc(sizeof(struct node) * gfa->node_count);
-	memset(graph->nodes, 0, sizeof(struct node) * gfa->node_count);
-
-	for (uint32_t index = 0; index < graph->nodes_len; index++) {
-		struct node *node = (graph->nodes + index);
-		node->length = gfa->sequence_lengths[index];
-		if (node->length > 0) {
-			node->sequences = (uint64_t *) malloc(sizeof(uint64_t));
-			node->sequences[0] = gfa->sequences[index];
-			node->sequences_len = 1;
-		} else {
-			node->sequences = 0;
-			node->sequences_len = 0;
-		}
-		node->edges_len = gfa->edges_out_lengths[index];
-		node->edges = (uint32_t *) malloc(sizeof(uint32_t) * node->edges_len);
-		for (uint8_t i = 0; i < node->edges_len; i++) {
-			node->edges[i] = gfa->edges_out[index][i];
-		}
-		node->edges_in_len = gfa->edges_in_lengths[index];
-		node->edges_in = (uint32_t *) malloc(sizeof(uint32_t) * node->edges_in_len);
-		for (uint8_t i = 0; i < node->edges_in_len; i++) {
-			node->edges_in[i] = gfa->edges_in[index][i];
+	graph->AppendEmptyNodes(gfa->node_count);
+
+	// Bases are packed straight from the mapped file, into the arena for nodes that do not fit inline
+	uint64_t *arena_offsets = (uint64_t *) malloc(sizeof(uint64_t) * (gfa->node_count + 1));
+	arena_offsets[0] = 0;
+	for (uint32_t index = 0; index < gfa->node_count; index++) {
+		uint32_t length = gfa->GetSequenceLength(index);
+		arena_offsets[index + 1] = arena_offsets[index] + ((length > NODE_INLINE_BASES) ? length : 0);
+	}
+	graph->ReserveSequences(arena_offsets[gfa->node_count]);
+	graph->sequences_len = arena_offsets[gfa->node_count];
+
+	run_in_threads(gfa->thread_count, gfa->node_count, [graph, gfa, arena_offsets](uint32_t start, uint32_t end, uint32_t t) {
+		(void) t;
+		for (uint32_t index = start; index < end; index++) {
+			struct node *node = (graph->nodes + index);
+			const char *sequence = gfa->GetSequence(index);
+			node->length = gfa->GetSequenceLength(index);
+			node->reference = gfa->reference_nodes[index];
+			graph->reference_indices[index] = gfa->reference_indices[index];
+			if (node->length <= NODE_INLINE_BASES) {
+				node->sequence = hash_max_kmer_by_map(sequence, node->length, graph->encoding_map);
+				continue;
+			}
+			node->sequence_offset = arena_offsets[index];
+			uint64_t hashes[ENCODE_CHUNK_WORDS];
+			for (uint32_t start = 0; start < node->length; start += ENCODE_CHUNK_WORDS * 32) {
+				uint32_t chunk_len = (node->length - start > ENCODE_CHUNK_WORDS * 32) ? ENCODE_CHUNK_WORDS * 32 : (node->length - start);
+				hash_bases_by_map(sequence + start, chunk_len, graph->encoding_map, hashes);
+				for (uint32_t i = 0; i < chunk_len; i += 32) {
+					uint8_t length = (chunk_len - i > 32) ? 32 : (chunk_len - i);
+					write_packed_bases(graph->sequences, arena_offsets[index] + start + i, hashes[i / 32], length);
+				}
+			}
 		}
-		node->reference_index = gfa->reference_indices[index];
-		node->reference = gfa->reference_nodes[index];
+	});
+	free(arena_offsets);
+
+	graph->ReserveEdges(gfa->links_len);
+	for (uint32_t index = 0; index < gfa->links_len; index++) {
+		if (gfa->links_from[index] >= graph->nodes_len || gfa->links_to[index] >= graph->nodes_len) continue;
+		graph->AddEdge(gfa->links_from[index], gfa->links_to[index]);
 	}
+	graph->Finalize();
 
 	delete gfa;
 	
@@ -69,69 +110,233 @@ Graph *Graph::FromFastaVCF(char *fasta_filepath, char *vcf_filepath, int16_t chr
 	return FromFastaVCFEncoded(fasta_filepath, vcf_filepath, chromosome, DEFAULT_ENCODING);
 }
 
-Graph *Graph::FromFastaVCFEncoded(char *fasta_filepath, char *vcf_filepath, int16_t chromosome, const char *encoding) {
-	VCF *vcf = VCF::ReadFile(vcf_filepath, chromosome);
-	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
-	if (chromosome != -1) {
-		fasta->GoToChromosome(chromosome);
-	} else {
-		fasta->GoToStart();
+// ORs len packed bases, starting at base in_pos of in, into out from base out_pos on. Both arrays must
+// hold a word past their last base.
+static void copy_packed_bases(uint64_t *out, uint64_t out_pos, const uint64_t *in, uint64_t in_pos, uint64_t len) {
+	for (uint64_t i = 0; i < len; i += 32) {
+		uint64_t word_len = (len - i > 32) ? 32 : (len - i);
+		uint64_t from = in_pos + i;
+		uint8_t in_shift = (from & 31) * 2;
+		uint64_t word = in[from / 32] << in_shift;
+		if (in_shift != 0) word |= in[from / 32 + 1] >> (64 - in_shift);
+		if (word_len < 32) word &= ~(UINT64_MAX >> (word_len * 2));
+		uint64_t to = out_pos + i;
+		uint8_t out_shift = (to & 31) * 2;
+		out[to / 32] |= word >> out_shift;
+		if (out_shift != 0) out[to / 32 + 1] |= word << (64 - out_shift);
 	}
+}
 
-	Graph *graph = new Graph(encoding);
+// Reference bases read from a FASTA positioned at the start of the contig
+struct fasta_references {
+	FASTA *fasta;
+	uint8_t encoding_map[256];
+	uint64_t *packed;
+
+	fasta_references(FASTA *fasta, const char *encoding) {
+		this->fasta = fasta;
+		memset(encoding_map, 0, sizeof(encoding_map));
+		fill_map_by_encoding(encoding_map, encoding);
+		packed = NULL;
+	}
 
-	uint64_t *sorted_variant_indices = (uint64_t *) malloc(sizeof(uint64_t) * vcf->length);
-	for (uint64_t i = 0; i < vcf->length; i++) {
-		sorted_variant_indices[i] = i;
+	// Packs the next count bases of the contig into packed, returning how many there were
+	uint32_t ReadPacked(uint32_t count) {
+		uint32_t len = fasta->ReadNextPacked(count, encoding_map);
+		packed = fasta->packed;
+		return len;
 	}
-	std::sort(sorted_variant_indices, sorted_variant_indices + vcf->length,
-			[&vcf](const uint64_t a, const uint64_t b) -> bool {
-				return vcf->positions[a] < vcf->positions[b];
-			});
+};
+
+// A run of packed reference bases handed from the reference thread to the builder
+struct packed_bases {
+	uint64_t *packed;
+	uint32_t len;
+};
+
+// Reference bases packed on another thread and taken from a queue, in the order of the contig
+struct queued_references {
+	BoundedQueue<struct packed_bases> *queue;
+	struct packed_bases current;
+	uint32_t current_pos;
+	uint64_t *packed;
+	uint32_t packed_cap;
+
+	queued_references(BoundedQueue<struct packed_bases> *queue) {
+		this->queue = queue;
+		current = {NULL, 0};
+		current_pos = 0;
+		packed = NULL;
+		packed_cap = 0;
+	}
+
+	~queued_references() {
+		free(current.packed);
+		free(packed);
+	}
+
+	uint32_t ReadPacked(uint32_t count) {
+		uint32_t words = (count + 31) / 32 + 1;
+		if (words > packed_cap) {
+			packed_cap = words;
+			packed = (uint64_t *) realloc(packed, sizeof(uint64_t) * packed_cap);
+		}
+		memset(packed, 0, sizeof(uint64_t) * words);
+
+		uint32_t len = 0;
+		while (len < count) {
+			if (current_pos == current.len) {
+				free(current.packed);
+				current = {NULL, 0};
+				current_pos = 0;
+				if (!queue->Pop(&current)) break;
+				continue;
+			}
+			uint32_t take = (count - len < current.len - current_pos) ? (count - len) : (current.len - current_pos);
+			copy_packed_bases(packed, len, current.packed, current_pos, take);
+			len += take;
+			current_pos += take;
+		}
+		return len;
+	}
+};
+
+// Variants of a VCF read whole, in the order of their indices sorted by position
+struct sorted_variants {
+	VCF *vcf;
+	uint64_t *indices;
+	uint64_t len;
+	uint64_t next;
+	bool report_progress;
+
+	bool Next(VCF **variant_vcf, uint64_t *index) {
+		if (next == len) return false;
+		*variant_vcf = vcf;
+		*index = indices[next++];
+		if (report_progress && (next % 100000 == 0 || next + 1 == len)) printf("%lu / %lu variants processed\n", next, len);
+		return true;
+	}
+};
+
+// Variants parsed on another thread and taken from a queue in batches. Trimming the alleles moves records
+// a few bases, sometimes past later ones, so every batch is sorted by position and merged with the next.
+struct queued_variants {
+	BoundedQueue<VCF *> *queue;
+	// The older and the newer batch, and their records sorted by position
+	VCF *batches[2];
+	uint64_t *order[2];
+	uint64_t next[2];
+	bool started;
+	uint64_t read;
+
+	queued_variants(BoundedQueue<VCF *> *queue) {
+		this->queue = queue;
+		for (uint8_t i = 0; i < 2; i++) {
+			batches[i] = NULL;
+			order[i] = NULL;
+			next[i] = 0;
+		}
+		started = false;
+		read = 0;
+	}
+
+	~queued_variants() {
+		for (uint8_t i = 0; i < 2; i++) {
+			delete batches[i];
+			free(order[i]);
+		}
+	}
+
+	void Load(uint8_t slot) {
+		VCF *batch;
+		batches[slot] = queue->Pop(&batch) ? batch : NULL;
+		next[slot] = 0;
+		if (batches[slot] == NULL) return;
+		order[slot] = (uint64_t *) realloc(order[slot], sizeof(uint64_t) * batch->length);
+		for (uint64_t i = 0; i < batch->length; i++) order[slot][i] = i;
+		std::stable_sort(order[slot], order[slot] + batch->length,
+				[batch](const uint64_t a, const uint64_t b) -> bool {
+					return batch->positions[a] < batch->positions[b];
+				});
+	}
+
+	uint64_t Position(uint8_t slot) {
+		return batches[slot]->positions[order[slot][next[slot]]];
+	}
+
+	// The variant stays valid until the following call
+	bool Next(VCF **variant_vcf, uint64_t *index) {
+		if (!started) {
+			started = true;
+			Load(0);
+			Load(1);
+		}
+		while (batches[0] != NULL && next[0] == batches[0]->length) {
+			delete batches[0];
+			uint64_t *older_order = order[0];
+			batches[0] = batches[1];
+			order[0] = order[1];
+			next[0] = next[1];
+			order[1] = older_order;
+			Load(1);
+		}
+		if (batches[0] == NULL) return false;
+
+		// Ties keep file order
+		uint8_t slot = (batches[1] != NULL && next[1] < batches[1]->length && Position(1) < Position(0)) ? 1 : 0;
+		*variant_vcf = batches[slot];
+		*index = order[slot][next[slot]++];
+		read++;
+		if (read % 100000 == 0) printf("%lu variants processed\n", read);
+		return true;
+	}
+};
+
+// Builds the graph of a single contig from its variants, which come sorted by position, and its reference.
+// Variants that start before the end of the previous one are skipped.
+template <typename References, typename Variants>
+static Graph *build_contig_graph(References *references, Variants *variants, uint64_t variants_len_hint, const char *encoding,
+                                 uint32_t *variants_added, uint32_t *variants_skipped_overlap) {
+	// Every variant adds a reference node, its variant nodes and one node leading up to it,
+	// each with an edge from the previous reference node and the previous variant nodes
+	GraphBuilder builder(encoding);
+	builder.Reserve(variants_len_hint * 4 + 1, variants_len_hint * 8, 0);
+	// REF alleles are packed to be checked against the reference
+	uint8_t encoding_map[256];
+	memset(encoding_map, 0, sizeof(encoding_map));
+	fill_map_by_encoding(encoding_map, encoding);
 
 	uint64_t reference_pos = 0;
 	uint32_t graph_previous_reference_id = 0;
-	uint64_t variant_idx = 0;
-	uint64_t reference_index = 0;
-
-	uint32_t *variant_to_reference_node_id = (uint32_t *) malloc(sizeof(uint32_t) * vcf->length);
-	uint32_t *variant_to_variant_node_id = (uint32_t *) malloc(sizeof(uint32_t) * vcf->length);
-	memset(variant_to_reference_node_id, 0, sizeof(uint32_t) * vcf->length);
-	memset(variant_to_variant_node_id, 0, sizeof(uint32_t) * vcf->length);
 
 	uint32_t previous_variant_ids[128];
 	uint8_t previous_variant_ids_len = 0;
 	uint32_t next_variant_ids[128];
 	uint8_t next_variant_ids_len = 0;
 
-	uint32_t variants_added = 0;
-	uint32_t variants_skipped_overlap = 0;
-	while (variant_idx < vcf->length) {
-		uint32_t real_variant_idx = sorted_variant_indices[variant_idx];
+	VCF *vcf;
+	uint64_t real_variant_idx;
+	while (variants->Next(&vcf, &real_variant_idx)) {
 		uint64_t variant_pos = vcf->positions[real_variant_idx];
-		variant_idx++;
-		if (variant_idx % 100000 == 0 || variant_idx + 1 == vcf->length) printf("%lu / %lu variants processed\n", variant_idx, vcf->length);
 		if (variant_pos < reference_pos) {
 			//printf("Variant overlap\n");
-			variants_skipped_overlap++;
+			(*variants_skipped_overlap)++;
 		} else {
-			variants_added++;
+			(*variants_added)++;
 			// Read bases and add a reference node leading up to the variant
 			uint64_t to_read = variant_pos - reference_pos;
 			if (to_read > 0) {
-				char *sequence = fasta->ReadNext(to_read);
-				if (sequence == NULL) {
+				uint32_t sequence_len = references->ReadPacked(to_read);
+				if (sequence_len == 0) {
 					printf("No more bases in FASTA (1)\n");
 					break;
 				}
-				uint32_t new_reference_id = graph->AddNode(sequence);
-				(graph->nodes + new_reference_id)->reference = true;
-				(graph->nodes + new_reference_id)->reference_index = reference_index++;
-				if (graph->nodes_len > 1) {
-					graph->AddEdge(graph_previous_reference_id, new_reference_id);
+				uint32_t new_reference_id = builder.AddPackedReferenceNode(references->packed, sequence_len);
+				if (builder.GetNodesLen() > 1) {
+					builder.AddEdge(graph_previous_reference_id, new_reference_id);
 				}
 				for (uint8_t i = 0; i < previous_variant_ids_len; i++) {
-					graph->AddEdge(previous_variant_ids[i], new_reference_id);
+					builder.AddEdge(previous_variant_ids[i], new_reference_id);
 				}
 				previous_variant_ids_len = 0;
 				graph_previous_reference_id = new_reference_id;
@@ -139,50 +344,45 @@ Graph *Graph::FromFastaVCFEncoded(char *fasta_filepath, char *vcf_filepath, int1
 			}
 			
 			// Read the reference bases of the variant and add the reference node
-			to_read = strlen(vcf->references[real_variant_idx]);
+			const char *reference = vcf->GetReference(real_variant_idx);
+			to_read = vcf->reference_lengths[real_variant_idx];
 			uint32_t variant_reference_id;
 			if (to_read > 0) {
-				char *sequence = fasta->ReadNext(to_read);
-				if (sequence == NULL) {
+				uint32_t sequence_len = references->ReadPacked(to_read);
+				if (sequence_len == 0) {
 					printf("No more bases in FASTA (2)\n");
 					break;
 				}
-				for (uint64_t i = 0; i < to_read; i++) {
-					if ((vcf->references[real_variant_idx][i] | 0x20) != (sequence[i] | 0x20)) {
-						printf("Reference sequence mismatch! %s != %s\n", vcf->references[real_variant_idx], sequence);
-						break;
-					}
+				bool mismatch = (sequence_len != to_read);
+				for (uint32_t i = 0; i < sequence_len && !mismatch; i += 32) {
+					uint8_t word_len = (sequence_len - i > 32) ? 32 : (sequence_len - i);
+					mismatch = (hash_max_kmer_by_map(reference + i, word_len, encoding_map) != references->packed[i / 32]);
+				}
+				if (mismatch) {
+					printf("Reference sequence mismatch! %.*s != ", (int) to_read, reference);
+					for (uint32_t i = 0; i < sequence_len; i++) putchar(encoding_map[(references->packed[i / 32] >> (62 - (i & 31) * 2)) & 3]);
+					putchar('\n');
 				}
-				variant_reference_id = graph->AddNode(sequence);
+				variant_reference_id = builder.AddPackedReferenceNode(references->packed, sequence_len);
 			} else { // Empty node
-				variant_reference_id = graph->AppendEmptyNode();
+				variant_reference_id = builder.AddReferenceNode("", 0);
 			}
-			(graph->nodes + variant_reference_id)->reference = true;
-			(graph->nodes + variant_reference_id)->reference_index = reference_index++;
-			graph->AddEdge(graph_previous_reference_id, variant_reference_id);
+			builder.AddEdge(graph_previous_reference_id, variant_reference_id);
 			for (uint8_t i = 0; i < previous_variant_ids_len; i++) {
-				graph->AddEdge(previous_variant_ids[i], variant_reference_id);
+				builder.AddEdge(previous_variant_ids[i], variant_reference_id);
 			}
 
-			// Create variant nodes
-			char *variant_string = strdup(vcf->variants[real_variant_idx]);
-			char *tok = strtok(variant_string, ",");
-			while (tok != NULL) {
-				uint32_t tok_len = strlen(tok);
-				uint32_t variant_node_id;
-				if (tok_len > 0) {
-					variant_node_id = graph->AddNode(tok);
-				} else {
-					variant_node_id = graph->AppendEmptyNode();
-				}
-				graph->AddEdge(graph_previous_reference_id, variant_node_id);
+			// Create variant nodes, alleles left empty by trimming get none
+			for (uint32_t allele = 0; allele < vcf->variant_counts[real_variant_idx]; allele++) {
+				uint32_t allele_len = vcf->GetVariantLength(real_variant_idx, allele);
+				if (allele_len == 0) continue;
+				uint32_t variant_node_id = builder.AddNode(vcf->GetVariant(real_variant_idx, allele), allele_len);
+				builder.AddEdge(graph_previous_reference_id, variant_node_id);
 				for (uint8_t i = 0; i < previous_variant_ids_len; i++) {
-					graph->AddEdge(previous_variant_ids[i], variant_node_id);
+					builder.AddEdge(previous_variant_ids[i], variant_node_id);
 				}
 				next_variant_ids[next_variant_ids_len++] = variant_node_id;
-				tok = strtok(NULL, ",");
 			}
-			free(variant_string);
 
 			memcpy(previous_variant_ids, next_variant_ids, sizeof(uint32_t) * next_variant_ids_len);
 			previous_variant_ids_len = next_variant_ids_len;
@@ -193,42 +393,60 @@ Graph *Graph::FromFastaVCFEncoded(char *fasta_filepath, char *vcf_filepath, int1
 		}
 	}
 
-	uint64_t remaining = 0;
+	// The rest of the contig is packed as it is read, in chunks of whole words so they can be appended as they are
+	uint64_t *tail = NULL;
+	uint64_t tail_words_cap = 0;
+	uint64_t tail_len = 0;
 	while (true) {
-		char *a = fasta->ReadNext(128);
-		if (a == NULL) break;
-		remaining += strlen(a);
-	}
-	
-	if (remaining > 0) {
-		if (chromosome != -1) {
-			fasta->GoToChromosome(chromosome);
-		} else {
-			fasta->GoToStart();
-		}
-		uint64_t to_read = reference_pos;
-		while (to_read > 128) {
-			fasta->ReadNext(128);
-			to_read -= 128;
+		uint32_t sequence_len = references->ReadPacked(TAIL_CHUNK_BASES);
+		if (sequence_len == 0) break;
+		uint64_t tail_words = (tail_len + sequence_len + 31) / 32;
+		if (tail_words > tail_words_cap) {
+			while (tail_words > tail_words_cap) tail_words_cap = (tail_words_cap == 0) ? TAIL_CHUNK_BASES / 32 : tail_words_cap * 2;
+			tail = (uint64_t *) realloc(tail, sizeof(uint64_t) * tail_words_cap);
 		}
-		fasta->ReadNext(to_read);
-		char *sequence = fasta->ReadNext(remaining);
-		uint32_t final_reference_id = graph->AddNode(sequence);
-		if (graph->nodes_len > 1) {
-			graph->AddEdge(graph_previous_reference_id, final_reference_id);
+		memcpy(tail + tail_len / 32, references->packed, sizeof(uint64_t) * ((sequence_len + 31) / 32));
+		tail_len += sequence_len;
+		if (sequence_len < TAIL_CHUNK_BASES) break;
+	}
+
+	if (tail_len > 0) {
+		uint32_t final_reference_id = builder.AddPackedNode(tail, tail_len);
+		if (builder.GetNodesLen() > 1) {
+			builder.AddEdge(graph_previous_reference_id, final_reference_id);
 		}
 		for (uint8_t i = 0; i < previous_variant_ids_len; i++) {
-			graph->AddEdge(previous_variant_ids[i], final_reference_id);
+			builder.AddEdge(previous_variant_ids[i], final_reference_id);
 		}
 	}
+	free(tail);
+
+	return builder.Build();
+}
+
+// Builds the graph of the contig the FASTA is at from all variants of the VCF, and frees both
+static Graph *build_from_variants(FASTA *fasta, VCF *vcf, const char *encoding) {
+	uint64_t *sorted_variant_indices = (uint64_t *) malloc(sizeof(uint64_t) * vcf->length);
+	for (uint64_t i = 0; i < vcf->length; i++) {
+		sorted_variant_indices[i] = i;
+	}
+	// Ties keep file order, like in the pipelined build
+	std::stable_sort(sorted_variant_indices, sorted_variant_indices + vcf->length,
+			[&vcf](const uint64_t a, const uint64_t b) -> bool {
+				return vcf->positions[a] < vcf->positions[b];
+			});
+
+	uint32_t variants_added = 0;
+	uint32_t variants_skipped_overlap = 0;
+	struct fasta_references references(fasta, encoding);
+	struct sorted_variants variants = {vcf, sorted_variant_indices, vcf->length, 0, true};
+	Graph *graph = build_contig_graph(&references, &variants, vcf->length, encoding, &variants_added, &variants_skipped_overlap);
 
 	printf("Graph has %u nodes\n", graph->nodes_len);
 	printf("Variants in graph: %u\n", variants_added);
 	printf("Variants skipped due to overlap: %u\n", variants_skipped_overlap);
 
 	free(sorted_variant_indices);
-	free(variant_to_reference_node_id);
-	free(variant_to_variant_node_id);
 
 	delete vcf;
 	delete fasta;
@@ -236,215 +454,657 @@ Graph *Graph::FromFastaVCFEncoded(char *fasta_filepath, char *vcf_filepath, int1
 	return graph;
 }
 
-uint32_t *Graph::CreateCompressedIDMap(uint32_t *return_compressed_node_count) {
-	bool visited[nodes_len];
-	memset(visited, false, sizeof(bool) * nodes_len);
+Graph *Graph::FromFastaVCFEncoded(char *fasta_filepath, char *vcf_filepath, int16_t chromosome, const char *encoding, uint32_t thread_count) {
+	if (chromosome == -1) return FromFastaVCFGenome(fasta_filepath, vcf_filepath, encoding, thread_count);
 
-	uint32_t *id_map = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
-	memset(id_map, 0, sizeof(uint32_t) * nodes_len);
+	VCF *vcf = VCF::ReadFile(vcf_filepath, chromosome);
+	if (vcf == NULL) return NULL;
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	if (fasta == NULL) {
+		delete vcf;
+		return NULL;
+	}
+	if (!fasta->GoToChromosome(chromosome)) {
+		delete vcf;
+		delete fasta;
+		return NULL;
+	}
+	return build_from_variants(fasta, vcf, encoding);
+}
 
-	uint32_t compressed_node_count = 0;
-	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
-		if (visited[node_id]) continue;
-		visited[node_id] = true;
-		id_map[node_id] = compressed_node_count;
-		uint32_t edge_id = node_id;
-		struct node *edge = (nodes + edge_id);
-		while (edge->edges_len == 1) {
-			edge_id = edge->edges[0];
-			edge = (nodes + edge_id);
-			if (visited[edge_id]) break;
-			if (edge->edges_in_len > 1) break;
-			id_map[edge_id] = compressed_node_count;
-			visited[edge_id] = true;
-		}
-		compressed_node_count++;
+Graph *Graph::FromFastaVCFContig(char *fasta_filepath, char *vcf_filepath, const char *contig, const char *encoding) {
+	VCF *vcf = VCF::ReadContig(vcf_filepath, contig);
+	if (vcf == NULL) return NULL;
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	if (fasta == NULL) {
+		delete vcf;
+		return NULL;
 	}
-	
-	std::cout << "Compressed Node Count: " << compressed_node_count << std::endl;
-	(*return_compressed_node_count) = compressed_node_count;
-	return id_map;
+	if (!fasta->GoToContig(contig)) {
+		delete vcf;
+		delete fasta;
+		return NULL;
+	}
+	return build_from_variants(fasta, vcf, encoding);
 }
 
-void Graph::Compress() {
-	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
-		if ((nodes + node_id)->sequences_len > 1) {
-			std::cout << "This graph is already compressed." << std::endl;
-			return;
+// The VCF is parsed and the reference packed on threads of their own, while this thread builds the graph
+// from both as they arrive. Records must be sorted by position, as they are in indexed files, though trimming
+// their alleles may move them past records of the next batch. Both readers are freed.
+static Graph *build_pipelined(FASTA *fasta, VCF *vcf, const char *encoding) {
+	BoundedQueue<VCF *> batches(PIPELINE_QUEUE_LEN);
+	BoundedQueue<struct packed_bases> bases(PIPELINE_QUEUE_LEN);
+	std::thread vcf_thread([&]() {
+		VCF *batch;
+		while ((batch = vcf->NextBatch(PIPELINE_VCF_BATCH_LEN)) != NULL) {
+			if (!batches.Push(batch)) {
+				delete batch;
+				break;
+			}
+		}
+		batches.Close();
+	});
+	std::thread reference_thread([&]() {
+		uint8_t encoding_map[256];
+		memset(encoding_map, 0, sizeof(encoding_map));
+		fill_map_by_encoding(encoding_map, encoding);
+		while (true) {
+			uint32_t len = fasta->ReadNextPacked(PIPELINE_REFERENCE_CHUNK_BASES, encoding_map);
+			if (len == 0) break;
+			// The word past the last base is kept for copy_packed_bases
+			uint64_t words = (len + 31) / 32 + 1;
+			struct packed_bases chunk = {(uint64_t *) malloc(sizeof(uint64_t) * words), len};
+			memcpy(chunk.packed, fasta->packed, sizeof(uint64_t) * words);
+			if (!bases.Push(chunk)) {
+				free(chunk.packed);
+				break;
+			}
+			if (len < PIPELINE_REFERENCE_CHUNK_BASES) break;
 		}
+		bases.Close();
+	});
+
+	uint32_t variants_added = 0;
+	uint32_t variants_skipped_overlap = 0;
+	Graph *graph;
+	{
+		struct queued_references references(&bases);
+		struct queued_variants variants(&batches);
+		graph = build_contig_graph(&references, &variants, 0, encoding, &variants_added, &variants_skipped_overlap);
 	}
 
-	uint32_t compressed_node_count;
-	uint32_t *id_map = CreateCompressedIDMap(&compressed_node_count);
+	// The builder may stop before the other threads are done, so they are stopped and what they left is freed
+	batches.Close();
+	bases.Close();
+	vcf_thread.join();
+	reference_thread.join();
+	VCF *batch;
+	while (batches.Pop(&batch)) delete batch;
+	struct packed_bases chunk;
+	while (bases.Pop(&chunk)) free(chunk.packed);
 
-	if (compressed_node_count == nodes_len) {
-		std::cout << "This graph has no nodes that can be compressed." << std::endl;
-		free(id_map);
-		return;
-	}
+	printf("Graph has %u nodes\n", graph->nodes_len);
+	printf("Variants in graph: %u\n", variants_added);
+	printf("Variants skipped due to overlap: %u\n", variants_skipped_overlap);
 
-	printf("Optimizing from %u nodes to %u nodes\n", nodes_len, compressed_node_count);
+	delete vcf;
+	delete fasta;
 
-	struct node *compressed_nodes = (struct node *) malloc(sizeof(struct node) * compressed_node_count);
-	memset(compressed_nodes, 0, sizeof(struct node) * compressed_node_count);
+	return graph;
+}
 
-	bool visited[nodes_len];
-	memset(visited, false, sizeof(bool) * nodes_len);
+Graph *Graph::FromFastaVCFPipelined(char *fasta_filepath, char *vcf_filepath, int16_t chromosome, const char *encoding) {
+	if (chromosome == -1) return FromFastaVCFGenome(fasta_filepath, vcf_filepath, encoding);
 
-	compressed_node_count = 0;
-	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
-		if (visited[node_id]) continue;
-		visited[node_id] = true;
-		struct node *node = (nodes + node_id);
-		struct node *compressed_node = (compressed_nodes + compressed_node_count);
-		uint32_t node_length = node->length;
-		uint32_t edge_id = node_id;
-		struct node *edge = node;
-		while (edge->edges_len == 1) {
-			edge_id = edge->edges[0];
-			edge = (nodes + edge_id);
-			if (visited[edge_id] /*|| !(edge->reference)*/) break;
-			if (edge->edges_in_len > 1) break;
-			node_length += edge->length;
-		}
-		if (node_length == 0) {
-			compressed_node->length = 0;
-			compressed_node->sequences = NULL;
-			compressed_node->sequences_len = 0;
+	VCF *vcf = VCF::Open(vcf_filepath, chromosome);
+	if (vcf == NULL) return NULL;
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	if (fasta == NULL) {
+		delete vcf;
+		return NULL;
+	}
+	if (!fasta->GoToChromosome(chromosome)) {
+		delete vcf;
+		delete fasta;
+		return NULL;
+	}
+	return build_pipelined(fasta, vcf, encoding);
+}
+
+Graph *Graph::FromFastaVCFContigPipelined(char *fasta_filepath, char *vcf_filepath, const char *contig, const char *encoding) {
+	VCF *vcf = VCF::OpenContig(vcf_filepath, contig);
+	if (vcf == NULL) return NULL;
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	if (fasta == NULL) {
+		delete vcf;
+		return NULL;
+	}
+	if (!fasta->GoToContig(contig)) {
+		delete vcf;
+		delete fasta;
+		return NULL;
+	}
+	return build_pipelined(fasta, vcf, encoding);
+}
+
+// The VCF is read once and its variants are split by contig. Every contig of the FASTA is then built
+// into a graph of its own, on as many threads as there are contigs, and the graphs are appended in FASTA order.
+Graph *Graph::FromFastaVCFGenome(char *fasta_filepath, char *vcf_filepath, const char *encoding, uint32_t thread_count) {
+	VCF *vcf = VCF::ReadFile(vcf_filepath, -1);
+	if (vcf == NULL) return NULL;
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	if (fasta == NULL) {
+		delete vcf;
+		return NULL;
+	}
+	ContigDictionary *contigs = fasta->ReadContigs();
+	// The index is loaded or built once, here, and shared read-only by the readers of every thread.
+	// A file without one, such as a gzip file, is read by this reader alone, going through the contigs in file order.
+	FASTAIndex *index = fasta->GetIndex();
+
+	// Variants are grouped by the FASTA contig they are on, keeping file order within each contig
+	uint32_t *vcf_to_fasta = (uint32_t *) malloc(sizeof(uint32_t) * (vcf->contigs->contigs_len + 1));
+	for (uint32_t i = 0; i < vcf->contigs->contigs_len; i++) {
+		vcf_to_fasta[i] = contigs->Find(vcf->contigs->GetName(i), vcf->contigs->GetNameLength(i));
+	}
+	uint64_t *contig_starts = (uint64_t *) calloc(contigs->contigs_len + 1, sizeof(uint64_t));
+	uint64_t missing = 0;
+	for (uint64_t i = 0; i < vcf->length; i++) {
+		uint32_t contig = vcf_to_fasta[vcf->contig_ids[i]];
+		if (contig == UINT32_MAX) {
+			missing++;
 		} else {
-			compressed_node->length = node_length;
-			compressed_node->sequences_len = (31 + node_length) / 32;
-			compressed_node->sequences = (uint64_t *) malloc(sizeof(uint64_t) * compressed_node->sequences_len);
-			memset(compressed_node->sequences, 0, sizeof(uint64_t) * compressed_node->sequences_len);
-			compressed_node->sequences[0] = node->sequences[0];
-			node_length = node->length;
-			edge_id = node_id;
-			edge = node;
-			while (edge->edges_len == 1) {
-				uint32_t temp_edge_id = edge->edges[0];
-				struct node *temp_edge = (nodes + temp_edge_id);
-				if (visited[temp_edge_id] /*|| !(temp_edge->reference)*/) break;
-				if (temp_edge->edges_in_len > 1) break;
-				edge_id = temp_edge_id;
-				edge = temp_edge;
-				if (node_length % 32 == 0) {
-					compressed_node->sequences[node_length / 32] = edge->sequences[0];
-					node_length += edge->length;
-				} else {
-					compressed_node->sequences[node_length / 32] |= (edge->sequences[0] >> ((node_length % 32) * 2));
-					uint32_t new_length = node_length + edge->length;
-					if (node_length / 32 < new_length / 32 && new_length % 32 != 0)
-						compressed_node->sequences[node_length / 32 + 1] = (edge->sequences[0] << ((31 - (node_length % 32)) * 2));
-					node_length = new_length;
-				}
-				visited[edge_id] = true;
-			}
+			contig_starts[contig + 1]++;
 		}
-		compressed_node->edges_len = edge->edges_len;
-		if (compressed_node->edges_len == 0) {
-			compressed_node->edges = NULL;
-		} else {
-			compressed_node->edges = (uint32_t *) malloc(sizeof(uint32_t) * edge->edges_len);
-			for (uint8_t i = 0; i < compressed_node->edges_len; i++) {
-				compressed_node->edges[i] = id_map[edge->edges[i]];
-			}
+	}
+	for (uint32_t i = 0; i < contigs->contigs_len; i++) contig_starts[i + 1] += contig_starts[i];
+	uint64_t *variant_indices = (uint64_t *) malloc(sizeof(uint64_t) * (contig_starts[contigs->contigs_len] + 1));
+	uint64_t *contig_fill = (uint64_t *) malloc(sizeof(uint64_t) * (contigs->contigs_len + 1));
+	memcpy(contig_fill, contig_starts, sizeof(uint64_t) * (contigs->contigs_len + 1));
+	for (uint64_t i = 0; i < vcf->length; i++) {
+		uint32_t contig = vcf_to_fasta[vcf->contig_ids[i]];
+		if (contig != UINT32_MAX) variant_indices[contig_fill[contig]++] = i;
+	}
+	free(contig_fill);
+	free(vcf_to_fasta);
+	if (missing > 0) printf("Variants on contigs missing from the FASTA: %lu\n", missing);
+
+	if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+	if (thread_count == 0) thread_count = 1;
+	if (thread_count > contigs->contigs_len) thread_count = contigs->contigs_len;
+	if (index == NULL) thread_count = 1;
+
+	// Contigs are handed out one at a time, since their sizes differ widely
+	Graph **contig_graphs = (Graph **) calloc(contigs->contigs_len + 1, sizeof(Graph *));
+	std::atomic<uint32_t> next_contig(0);
+	std::atomic<uint32_t> variants_added(0);
+	std::atomic<uint32_t> variants_skipped_overlap(0);
+	auto build_contigs = [&]() {
+		FASTA *contig_fasta = (index != NULL) ? FASTA::ReadFile(fasta_filepath, index, 1) : fasta;
+		if (contig_fasta == NULL) return;
+		uint32_t contig;
+		while ((contig = next_contig++) < contigs->contigs_len) {
+			uint64_t *contig_variants = variant_indices + contig_starts[contig];
+			uint64_t contig_variants_len = contig_starts[contig + 1] - contig_starts[contig];
+			std::stable_sort(contig_variants, contig_variants + contig_variants_len,
+					[&vcf](const uint64_t a, const uint64_t b) -> bool {
+						return vcf->positions[a] < vcf->positions[b];
+					});
+			const char *name = contigs->GetName(contig);
+			if (!contig_fasta->GoToContig(name)) continue;
+			uint32_t added = 0;
+			uint32_t skipped = 0;
+			struct fasta_references references(contig_fasta, encoding);
+			struct sorted_variants variants = {vcf, contig_variants, contig_variants_len, 0, false};
+			contig_graphs[contig] = build_contig_graph(&references, &variants, contig_variants_len, encoding, &added, &skipped);
+			variants_added += added;
+			variants_skipped_overlap += skipped;
 		}
-		compressed_node->edges_in_len = node->edges_in_len;
-		if (compressed_node->edges_in_len == 0) {
-			compressed_node->edges_in = NULL;
-		} else {
-			compressed_node->edges_in = (uint32_t *) malloc(sizeof(uint32_t) * node->edges_in_len);
-			for (uint8_t i = 0; i < node->edges_in_len; i++) {
-				compressed_node->edges_in[i] = id_map[node->edges_in[i]];
+		if (contig_fasta != fasta) delete contig_fasta;
+	};
+	std::vector<std::thread> threads;
+	for (uint32_t t = 1; t < thread_count; t++) threads.emplace_back(build_contigs);
+	build_contigs();
+	for (std::thread &thread : threads) thread.join();
+
+	Graph *graph = new Graph(encoding);
+	for (uint32_t contig = 0; contig < contigs->contigs_len; contig++) {
+		Graph *contig_graph = contig_graphs[contig];
+		if (contig_graph == NULL) continue;
+		if (contig_graph->nodes_len > 0) {
+			uint32_t root_node_id = contig_graph->GetRootNodeID();
+			uint32_t node_id_offset = graph->AppendGraph(contig_graph);
+			graph->AddContig(contigs->GetName(contig), node_id_offset + root_node_id);
+		}
+		delete contig_graph;
+	}
+	graph->Finalize();
+
+	printf("Graph has %u nodes in %u contigs\n", graph->nodes_len, graph->contigs_len);
+	printf("Variants in graph: %u\n", variants_added.load());
+	printf("Variants skipped due to overlap: %u\n", variants_skipped_overlap.load());
+
+	free(contig_graphs);
+	free(variant_indices);
+	free(contig_starts);
+	delete contigs;
+	delete fasta;
+	delete vcf;
+
+	return graph;
+}
+
+// Marks the first node of every unitig chain in the chain_heads bitset and returns the number of chains.
+// A node continues a chain if its only in-edge comes from another node whose only out-edge it is.
+uint32_t Graph::FindChainHeads(uint64_t *chain_heads, uint32_t *thread_heads, uint32_t thread_count) {
+	run_in_threads(thread_count, nodes_len, [&](uint32_t start, uint32_t end, uint32_t t) {
+		uint32_t count = 0;
+		for (uint32_t node_id = start; node_id < end; node_id++) {
+			bool head = true;
+			if (GetEdgesInLen(node_id) == 1) {
+				uint32_t parent_id = GetEdgesIn(node_id)[0];
+				head = (parent_id == node_id || GetEdgesLen(parent_id) != 1);
+			}
+			if (head) {
+				chain_heads[node_id >> 6] |= (1ULL << (node_id & 63));
+				count++;
 			}
 		}
-		compressed_node->reference_index = node->reference_index;
-		compressed_node->reference = node->reference;
+		thread_heads[t + 1] = count;
+	});
+	for (uint32_t t = 0; t < thread_count; t++) thread_heads[t + 1] += thread_heads[t];
+	return thread_heads[thread_count];
+}
 
-		compressed_node_count++;
-	}
+// Compacts every chain of nodes with single edges between them into one node.
+// Returns a map from old to new node IDs, owned by the caller, or NULL if the graph was left unchanged.
+// A thread_count of 0 uses every available core.
+uint32_t *Graph::Compress(uint32_t thread_count) {
+	FinalizeEdges();
+	EnsureOwned();
 
 	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
-		struct node *node = (nodes + node_id);
-		if (node->edges) free(node->edges);
-		if (node->edges_in) free(node->edges_in);
-		if (node->sequences) free(node->sequences);
+		if ((nodes + node_id)->length > 32) {
+			std::cout << "This graph is already compressed." << std::endl;
+			return NULL;
+		}
 	}
-	free(nodes);
-	nodes = compressed_nodes;
-	nodes_len = compressed_node_count;
 
-	uint32_t new_reference_index = 1;
-	uint32_t first_ref_node_id = GetReferenceNodeID(0);
-	struct node *ref_node = (nodes + first_ref_node_id);
+	if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+	if (thread_count == 0 || nodes_len < COMPRESS_MIN_NODES_PER_THREAD * 2) thread_count = 1;
+	if (thread_count > nodes_len / COMPRESS_MIN_NODES_PER_THREAD) thread_count = nodes_len / COMPRESS_MIN_NODES_PER_THREAD;
+	if (thread_count == 0) thread_count = 1;
 
-	while (true) {
-		uint32_t next_id = 0;
-		int64_t next_reference_index = -1;
-		for (uint8_t i = 0; i < ref_node->edges_len; i++) {
-			struct node *edge = (nodes + (ref_node->edges[i]));
-			if (edge->reference && (next_reference_index == -1 || edge->reference_index < next_reference_index)) {
-				next_id = ref_node->edges[i];
-				next_reference_index = edge->reference_index;
+	uint64_t *chain_heads = (uint64_t *) calloc((nodes_len + 63) / 64, sizeof(uint64_t));
+	uint32_t *thread_heads = (uint32_t *) calloc(thread_count + 1, sizeof(uint32_t));
+	uint32_t heads_len = FindChainHeads(chain_heads, thread_heads, thread_count);
+	auto is_head = [chain_heads](uint32_t node_id) -> bool {
+		return (chain_heads[node_id >> 6] >> (node_id & 63)) & 1;
+	};
+
+	uint32_t *id_map = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	memset(id_map, 0xFF, sizeof(uint32_t) * nodes_len);
+	// First and last old node of every chain, indexed by new node ID
+	uint32_t *chain_firsts = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	uint32_t *chain_lasts = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	uint64_t *chain_offsets = (uint64_t *) malloc(sizeof(uint64_t) * (nodes_len + 1));
+	uint32_t *chain_lengths = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+
+	// Walk the chains in parallel, numbering them in the order of their first nodes
+	run_in_threads(thread_count, nodes_len, [&](uint32_t start, uint32_t end, uint32_t t) {
+		uint32_t chain_id = thread_heads[t];
+		for (uint32_t node_id = start; node_id < end; node_id++) {
+			if (!is_head(node_id)) continue;
+			uint32_t member_id = node_id;
+			uint64_t length = (nodes + member_id)->length;
+			id_map[member_id] = chain_id;
+			while (GetEdgesLen(member_id) == 1 && !is_head(GetEdges(member_id)[0])) {
+				member_id = GetEdges(member_id)[0];
+				id_map[member_id] = chain_id;
+				length += (nodes + member_id)->length;
 			}
+			chain_firsts[chain_id] = node_id;
+			chain_lasts[chain_id] = member_id;
+			chain_offsets[chain_id + 1] = length;
+			chain_id++;
 		}
-		if (next_reference_index == -1) break;
-		ref_node = (nodes + next_id);
-		ref_node->reference_index = new_reference_index++;
+	});
+
+	// Cycles without any head are left over, and are cut open at their lowest node ID
+	uint32_t chains_len = heads_len;
+	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
+		if (id_map[node_id] != UINT32_MAX) continue;
+		uint32_t member_id = node_id;
+		uint64_t length = (nodes + member_id)->length;
+		id_map[member_id] = chains_len;
+		while (GetEdges(member_id)[0] != node_id) {
+			member_id = GetEdges(member_id)[0];
+			id_map[member_id] = chains_len;
+			length += (nodes + member_id)->length;
+		}
+		chain_firsts[chains_len] = node_id;
+		chain_lasts[chains_len] = member_id;
+		chain_offsets[chains_len + 1] = length;
+		chains_len++;
+	}
+
+	free(chain_heads);
+	free(thread_heads);
+
+	if (chains_len == nodes_len) {
+		std::cout << "This graph has no nodes that can be compressed." << std::endl;
+		free(id_map);
+		free(chain_firsts);
+		free(chain_lasts);
+		free(chain_offsets);
+		free(chain_lengths);
+		return NULL;
 	}
 
-	free(id_map);
+	printf("Optimizing from %u nodes to %u nodes\n", nodes_len, chains_len);
+
+	// Only chains too long to be stored inline take up space in the arena
+	chain_offsets[0] = 0;
+	for (uint32_t i = 0; i < chains_len; i++) {
+		chain_lengths[i] = chain_offsets[i + 1];
+		if (chain_lengths[i] <= NODE_INLINE_BASES) chain_offsets[i + 1] = 0;
+		chain_offsets[i + 1] += chain_offsets[i];
+	}
+	uint64_t compressed_sequences_len = chain_offsets[chains_len];
+	// One word more than required is kept so GetSequence can always read the following word
+	uint64_t compressed_sequences_cap = (compressed_sequences_len + 31) / 32 + 1;
+	uint64_t *compressed_sequences = (uint64_t *) calloc(compressed_sequences_cap, sizeof(uint64_t));
+
+	struct node *compressed_nodes = (struct node *) malloc(sizeof(struct node) * chains_len);
+	uint32_t *compressed_reference_indices = (uint32_t *) malloc(sizeof(uint32_t) * chains_len);
+	uint32_t *compressed_edges_offsets = (uint32_t *) malloc(sizeof(uint32_t) * (chains_len + 1));
+	compressed_edges_offsets[0] = 0;
+	for (uint32_t i = 0; i < chains_len; i++) {
+		compressed_edges_offsets[i + 1] = compressed_edges_offsets[i] + GetEdgesLen(chain_lasts[i]);
+	}
+	uint32_t compressed_edges_len = compressed_edges_offsets[chains_len];
+	uint32_t *compressed_edges = (uint32_t *) malloc(sizeof(uint32_t) * compressed_edges_len);
+
+	// Concatenate the sequences of every chain, and give it the out-edges of its last node
+	run_in_threads(thread_count, chains_len, [&](uint32_t start, uint32_t end, uint32_t t) {
+		(void) t;
+		for (uint32_t chain_id = start; chain_id < end; chain_id++) {
+			struct node *first = (nodes + chain_firsts[chain_id]);
+			struct node *compressed_node = (compressed_nodes + chain_id);
+			compressed_node->length = chain_lengths[chain_id];
+			compressed_node->reference = first->reference;
+			compressed_reference_indices[chain_id] = reference_indices[chain_firsts[chain_id]];
+
+			bool inline_sequence = (compressed_node->length <= NODE_INLINE_BASES);
+			uint64_t offset = inline_sequence ? 0 : chain_offsets[chain_id];
+			uint64_t packed = 0;
+			uint32_t member_id = chain_firsts[chain_id];
+			while (true) {
+				struct node *member = (nodes + member_id);
+				if (inline_sequence) {
+					if (member->length > 0) packed |= GetSequence(member, 0) >> (offset * 2);
+				} else {
+					for (uint32_t i = 0; i < member->length; i += 32) {
+						uint8_t length = (member->length - i > 32) ? 32 : (member->length - i);
+						write_packed_bases(compressed_sequences, offset + i, GetSequence(member, i / 32), length);
+					}
+				}
+				offset += member->length;
+				if (member_id == chain_lasts[chain_id]) break;
+				member_id = GetEdges(member_id)[0];
+			}
+			if (inline_sequence) {
+				compressed_node->sequence = packed;
+			} else {
+				compressed_node->sequence_offset = chain_offsets[chain_id];
+			}
+
+			uint32_t *chain_edges = GetEdges(chain_lasts[chain_id]);
+			uint32_t chain_edges_len = GetEdgesLen(chain_lasts[chain_id]);
+			uint32_t *out = compressed_edges + compressed_edges_offsets[chain_id];
+			for (uint32_t i = 0; i < chain_edges_len; i++) out[i] = id_map[chain_edges[i]];
+		}
+	});
+
+	free(chain_firsts);
+	free(chain_lasts);
+	free(chain_offsets);
+	free(chain_lengths);
+
+	free(nodes);
+	free(reference_indices);
+	free(edges_offsets);
+	free(edges);
+	free(sequences);
+	nodes = compressed_nodes;
+	reference_indices = compressed_reference_indices;
+	nodes_len = chains_len;
+	nodes_cap = chains_len;
+	edges_offsets = compressed_edges_offsets;
+	edges = compressed_edges;
+	edges_len = compressed_edges_len;
+	csr_nodes_len = nodes_len;
+	sequences = compressed_sequences;
+	sequences_len = compressed_sequences_len;
+	sequences_cap = compressed_sequences_cap;
+	BuildInEdges();
+	RemapContigRoots(id_map);
+
+	BuildReferencePath();
+
+	return id_map;
 }
 
 uint32_t Graph::AddNode(const char *sequence) {
+	return AddNode(sequence, strlen(sequence));
+}
+
+uint32_t Graph::AddNode(const char *sequence, uint32_t length) {
+	ReserveNodes(1);
+	ClearReferencePath();
 	nodes_len++;
-	nodes = (struct node *) realloc(nodes, sizeof(struct node) * nodes_len);
 	struct node *new_node = (nodes + nodes_len - 1);
-	new_node->length = strlen(sequence);
-	new_node->sequences_len = (new_node->length + 31) / 32;
-	if (new_node->sequences_len > 0) {
-		new_node->sequences = (uint64_t *) malloc(sizeof(uint64_t) * new_node->sequences_len);
-		for (uint32_t i = 0; i < new_node->sequences_len; i++) {
-			uint8_t hash_len = new_node->length - i * 32;
-			if (hash_len > 32) hash_len = 32;
-			const char *offset = sequence + (i * 32);
-			uint64_t hash = hash_max_kmer_by_map(offset, hash_len, encoding_map);
-			new_node->sequences[i] = hash;
+	new_node->reference = false;
+	SetNodeSequence(nodes_len - 1, sequence, length);
+	reference_indices[nodes_len - 1] = 0;
+
+	return nodes_len - 1;
+}
+
+uint32_t Graph::AddPackedNode(const uint64_t *packed, uint32_t length) {
+	ReserveNodes(1);
+	ClearReferencePath();
+	nodes_len++;
+	uint32_t node_id = nodes_len - 1;
+	(nodes + node_id)->reference = false;
+	reference_indices[node_id] = 0;
+	if (length <= NODE_INLINE_BASES) {
+		SetNodePackedSequence(node_id, (length > 0) ? packed[0] : 0, length);
+	} else {
+		ReserveSequences(length);
+		uint64_t offset = sequences_len;
+		for (uint32_t i = 0; i < length; i += 32) {
+			AppendPackedSequence(packed[i / 32], (length - i > 32) ? 32 : (length - i));
 		}
+		SetNodeSequenceOffset(node_id, offset, length);
+	}
+	return node_id;
+}
+
+// Makes room for count more nodes, growing the node arrays geometrically.
+void Graph::ReserveNodes(uint32_t count) {
+	EnsureOwned();
+	uint64_t required = (uint64_t) nodes_len + count;
+	if (required <= nodes_cap) return;
+	uint64_t new_cap = (nodes_cap == 0) ? 64 : nodes_cap;
+	while (new_cap < required) new_cap *= 2;
+	if (new_cap > UINT32_MAX) new_cap = UINT32_MAX;
+	nodes = (struct node *) realloc(nodes, sizeof(struct node) * new_cap);
+	reference_indices = (uint32_t *) realloc(reference_indices, sizeof(uint32_t) * new_cap);
+	nodes_cap = new_cap;
+}
+
+// Makes room for count more edges before the next Finalize().
+void Graph::ReserveEdges(uint32_t count) {
+	uint64_t required = (uint64_t) pending_edges_len + count;
+	if (required <= pending_edges_cap) return;
+	uint64_t new_cap = (pending_edges_cap == 0) ? 64 : pending_edges_cap;
+	while (new_cap < required) new_cap *= 2;
+	if (new_cap > UINT32_MAX) new_cap = UINT32_MAX;
+	pending_edges = (uint32_t *) realloc(pending_edges, sizeof(uint32_t) * 2 * new_cap);
+	pending_edges_cap = new_cap;
+}
+
+void Graph::ReserveSequences(uint64_t bases) {
+	// One word more than required is kept so GetSequence can always read the following word
+	uint64_t required = (sequences_len + bases + 31) / 32 + 1;
+	if (required <= sequences_cap) return;
+	EnsureOwned();
+	uint64_t new_cap = (sequences_cap == 0) ? 64 : sequences_cap;
+	while (new_cap < required) new_cap *= 2;
+	sequences = (uint64_t *) realloc(sequences, sizeof(uint64_t) * new_cap);
+	memset(sequences + sequences_cap, 0, sizeof(uint64_t) * (new_cap - sequences_cap));
+	sequences_cap = new_cap;
+}
+
+// Appends up to 32 left-aligned bases to the sequence arena and returns their base offset.
+uint64_t Graph::AppendPackedSequence(uint64_t packed, uint8_t length) {
+	uint64_t offset = sequences_len;
+	if (length == 0) return offset;
+	ReserveSequences(length);
+	if (length < 32) packed &= ~(~0ULL >> (length * 2));
+	uint64_t bit = offset * 2;
+	uint64_t *word = sequences + (bit >> 6);
+	uint8_t shift = bit & 63;
+	word[0] |= packed >> shift;
+	if (shift != 0) word[1] |= packed << (64 - shift);
+	sequences_len += length;
+	return offset;
+}
+
+// Stores the bases of a node inline if they fit, or appends them to the arena otherwise.
+void Graph::SetNodeSequence(uint32_t node_id, const char *sequence, uint32_t length) {
+	EnsureOwned();
+	struct node *node = (nodes + node_id);
+	node->length = length;
+	if (length <= NODE_INLINE_BASES) {
+		node->sequence = (length > 0) ? hash_max_kmer_by_map(sequence, length, encoding_map) : 0;
+		if (length > 0 && length < 32) node->sequence &= ~(~0ULL >> (length * 2));
 	} else {
-		new_node->sequences = NULL;
+		node->sequence_offset = AppendSequence(sequence, length);
 	}
-	new_node->edges = NULL;
-	new_node->edges_in = NULL;
-	new_node->edges_len = 0;
-	new_node->edges_in_len = 0;
-	new_node->reference_index = 0;
-	new_node->reference = false;
+}
 
-	return nodes_len - 1;
+uint64_t Graph::AppendSequence(const char *sequence, uint32_t length) {
+	uint64_t offset = sequences_len;
+	ReserveSequences(length);
+	uint64_t hashes[ENCODE_CHUNK_WORDS];
+	for (uint32_t start = 0; start < length; start += ENCODE_CHUNK_WORDS * 32) {
+		uint32_t chunk_len = (length - start > ENCODE_CHUNK_WORDS * 32) ? ENCODE_CHUNK_WORDS * 32 : (length - start);
+		hash_bases_by_map(sequence + start, chunk_len, encoding_map, hashes);
+		for (uint32_t i = 0; i < chunk_len; i += 32) {
+			uint8_t hash_len = (chunk_len - i > 32) ? 32 : (chunk_len - i);
+			AppendPackedSequence(hashes[i / 32], hash_len);
+		}
+	}
+	return offset;
 }
 
 void Graph::AddEdge(uint32_t from_node_id, uint32_t to_node_id) {
-	struct node *from_node = (nodes + from_node_id);
-	struct node *to_node = (nodes + to_node_id);
+	if (pending_edges_len == pending_edges_cap) ReserveEdges(1);
+	pending_edges[pending_edges_len * 2] = from_node_id;
+	pending_edges[pending_edges_len * 2 + 1] = to_node_id;
+	pending_edges_len++;
+}
 
-	from_node->edges_len++;
-	from_node->edges = (uint32_t *) realloc(from_node->edges, sizeof(uint32_t) * from_node->edges_len);
-	from_node->edges[from_node->edges_len - 1] = to_node_id;
+void Graph::Finalize() {
+	FinalizeEdges();
+	// The path is built here rather than by the lookups, so they never modify a graph shared between threads
+	if (!reference_path_built) BuildReferencePath();
+}
+
+void Graph::FinalizeEdges() {
+	if (pending_edges_len == 0 && csr_nodes_len == nodes_len && edges_offsets != NULL) return;
+	EnsureOwned();
+
+	// Count the out-edges of every node, keeping existing edges before pending ones
+	uint32_t *new_offsets = (uint32_t *) malloc(sizeof(uint32_t) * (nodes_len + 1));
+	memset(new_offsets, 0, sizeof(uint32_t) * (nodes_len + 1));
+	for (uint32_t i = 0; i < csr_nodes_len; i++) {
+		new_offsets[i + 1] = GetEdgesLen(i);
+	}
+	for (uint32_t i = 0; i < pending_edges_len; i++) {
+		new_offsets[pending_edges[i * 2] + 1]++;
+	}
+	for (uint32_t i = 0; i < nodes_len; i++) {
+		new_offsets[i + 1] += new_offsets[i];
+	}
 
-	to_node->edges_in_len++;
-	to_node->edges_in = (uint32_t *) realloc(to_node->edges_in, sizeof(uint32_t) * to_node->edges_in_len);
-	to_node->edges_in[to_node->edges_in_len - 1] = from_node_id;
+	uint32_t new_edges_len = new_offsets[nodes_len];
+	uint32_t *new_edges = (uint32_t *) malloc(sizeof(uint32_t) * new_edges_len);
+	uint32_t *cursors = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	for (uint32_t i = 0; i < nodes_len; i++) {
+		cursors[i] = new_offsets[i];
+		if (i < csr_nodes_len) {
+			uint32_t len = GetEdgesLen(i);
+			memcpy(new_edges + cursors[i], GetEdges(i), sizeof(uint32_t) * len);
+			cursors[i] += len;
+		}
+	}
+	for (uint32_t i = 0; i < pending_edges_len; i++) {
+		new_edges[cursors[pending_edges[i * 2]]++] = pending_edges[i * 2 + 1];
+	}
+	free(cursors);
+
+	free(edges_offsets);
+	free(edges);
+	edges_offsets = new_offsets;
+	edges = new_edges;
+	edges_len = new_edges_len;
+	csr_nodes_len = nodes_len;
+
+	free(pending_edges);
+	pending_edges = NULL;
+	pending_edges_len = 0;
+	pending_edges_cap = 0;
+
+	BuildInEdges();
+}
+
+void Graph::BuildInEdges() {
+	ClearReferencePath();
+	free(edges_in_offsets);
+	free(edges_in);
+
+	edges_in_offsets = (uint32_t *) malloc(sizeof(uint32_t) * (nodes_len + 1));
+	memset(edges_in_offsets, 0, sizeof(uint32_t) * (nodes_len + 1));
+	for (uint32_t i = 0; i < edges_len; i++) {
+		edges_in_offsets[edges[i] + 1]++;
+	}
+	for (uint32_t i = 0; i < nodes_len; i++) {
+		edges_in_offsets[i + 1] += edges_in_offsets[i];
+	}
+
+	// Sources are visited in ascending order, so in-edges end up sorted by node ID
+	edges_in = (uint32_t *) malloc(sizeof(uint32_t) * edges_len);
+	uint32_t *cursors = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	memcpy(cursors, edges_in_offsets, sizeof(uint32_t) * nodes_len);
+	for (uint32_t i = 0; i < nodes_len; i++) {
+		for (uint32_t j = edges_offsets[i]; j < edges_offsets[i + 1]; j++) {
+			edges_in[cursors[edges[j]]++] = i;
+		}
+	}
+	free(cursors);
 }
 
 uint32_t Graph::GetRequiredEmptyNodesFromNode(uint32_t from_node_id) {
-	struct node *from_node = (nodes + from_node_id);
+	uint32_t *from_edges = GetEdges(from_node_id);
+	uint32_t from_edges_len = GetEdgesLen(from_node_id);
 	
 	uint16_t nodes_required = 0;
 
-	for (uint8_t i = 0; i < from_node->edges_len; i++) {
-		struct node *edge = (nodes + from_node->edges[i]);
-		if (edge->edges_in_len > 1) {
+	for (uint32_t i = 0; i < from_edges_len; i++) {
+		if (GetEdgesInLen(from_edges[i]) > 1) {
 			//uint16_t nodes_required = GetRequiredEmptyNodesBetween(from_node_id, from_node->edges[i]);
 			nodes_required++;
 		}
@@ -454,8 +1114,9 @@ uint32_t Graph::GetRequiredEmptyNodesFromNode(uint32_t from_node_id) {
 }
 
 uint32_t Graph::GetRootNodeID() {
+	if (reference_path_len > 0 && GetEdgesInLen(reference_path[0]) == 0) return reference_path[0];
 	for (uint32_t i = 0; i < nodes_len; i++) {
-		if ((nodes + i)->edges_in_len == 0)
+		if (GetEdgesInLen(i) == 0)
 			return i;
 	}
 	std::cout << "FATAL: Did not find a root node for the graph." << std::endl;
@@ -463,17 +1124,17 @@ uint32_t Graph::GetRootNodeID() {
 }
 
 uint32_t Graph::GetReferenceNodeID(uint32_t reference_index) {
-	for (uint32_t i = 0; i < nodes_len; i++) {
-		if ((nodes + i)->reference_index == 0)
-			return i;
-	}
+	if (reference_index < reference_path_len) return reference_path[reference_index];
 	std::cout << "FATAL: Did not find a reference node with index " << reference_index << " for the graph." << std::endl;
 	return 0;
 }
 
 uint32_t Graph::GetLastNodeID() {
+	if (reference_path_len > 0 && GetEdgesLen(reference_path[reference_path_len - 1]) == 0) {
+		return reference_path[reference_path_len - 1];
+	}
 	for (uint32_t i = 0; i < nodes_len; i++) {
-		if ((nodes + i)->edges_len == 0)
+		if (GetEdgesLen(i) == 0)
 			return i;
 	}
 	std::cout << "FATAL: Did not find an end node for the graph." << std::endl;
@@ -486,17 +1147,180 @@ uint32_t Graph::GetNextReferenceNodeID(uint32_t previous_id) {
 		std::cout << "FATAL: Can't get next reference node of non-reference node." << std::endl;
 		return 0;
 	}
-	uint32_t next_reference_index = node->reference_index + 1;
-	for (uint8_t i = 0; i < node->edges_len; i++) {
-		struct node *edge = (nodes + node->edges[i]);
-		if (edge->reference && edge->reference_index == next_reference_index) {
-			return node->edges[i];
-		}
+	uint32_t reference_index = reference_indices[previous_id];
+	if (reference_index < reference_path_len && reference_index + 1 < reference_range_starts[GetReferenceRange(reference_index) + 1]) {
+		return reference_path[reference_index + 1];
 	}
 	std::cout << "FATAL: Did not find a next reference node." << std::endl;
 	return 0;
 }
 
+uint32_t Graph::GetPreviousReferenceNodeID(uint32_t next_id) {
+	struct node *node = (nodes + next_id);
+	if (!(node->reference)) {
+		std::cout << "FATAL: Can't get previous reference node of non-reference node." << std::endl;
+		return 0;
+	}
+	uint32_t reference_index = reference_indices[next_id];
+	if (reference_index < reference_path_len && reference_index > reference_range_starts[GetReferenceRange(reference_index)]) {
+		return reference_path[reference_index - 1];
+	}
+	std::cout << "FATAL: Did not find a previous reference node." << std::endl;
+	return 0;
+}
+
+// Returns the reference coordinate the bases of a reference node start at, counted from the start of its contig.
+uint64_t Graph::GetReferenceOffset(uint32_t node_id) {
+	struct node *node = (nodes + node_id);
+	uint32_t reference_index = reference_indices[node_id];
+	if (!(node->reference) || reference_index >= reference_path_len) {
+		std::cout << "FATAL: Can't get the reference offset of non-reference node." << std::endl;
+		return 0;
+	}
+	return reference_offsets[reference_index] - reference_offsets[reference_range_starts[GetReferenceRange(reference_index)]];
+}
+
+bool Graph::FindReferencePosition(uint64_t position, uint32_t *node_id, uint32_t *offset, uint32_t contig) {
+	if (contig >= reference_ranges_len) return false;
+	uint32_t start = reference_range_starts[contig];
+	uint32_t end = reference_range_starts[contig + 1];
+	position += reference_offsets[start];
+	if (position >= reference_offsets[end]) return false;
+	// The last node starting at or before the position. Empty nodes share the offset of the
+	// node after them, so they are skipped.
+	uint64_t *found = std::upper_bound(reference_offsets + start, reference_offsets + end, position) - 1;
+	uint32_t path_index = found - reference_offsets;
+	(*node_id) = reference_path[path_index];
+	(*offset) = position - *found;
+	return true;
+}
+
+// Returns the range of the path, one per contig, that a reference index falls in
+uint32_t Graph::GetReferenceRange(uint32_t reference_index) {
+	return std::upper_bound(reference_range_starts, reference_range_starts + reference_ranges_len + 1, reference_index) - reference_range_starts - 1;
+}
+
+// Labels every node with the contig whose root reaches it, or UINT32_MAX if no root does
+uint32_t *Graph::FindNodeContigs() {
+	uint32_t *node_contigs = (uint32_t *) malloc(sizeof(uint32_t) * (nodes_len + 1));
+	memset(node_contigs, 0xFF, sizeof(uint32_t) * (nodes_len + 1));
+	uint32_t *stack = (uint32_t *) malloc(sizeof(uint32_t) * (nodes_len + 1));
+	for (uint32_t contig = 0; contig < contigs_len; contig++) {
+		uint32_t root_id = contig_roots[contig];
+		if (root_id >= nodes_len || node_contigs[root_id] != UINT32_MAX) continue;
+		node_contigs[root_id] = contig;
+		uint32_t stack_len = 0;
+		stack[stack_len++] = root_id;
+		while (stack_len > 0) {
+			uint32_t node_id = stack[--stack_len];
+			uint32_t *node_edges = GetEdges(node_id);
+			uint32_t node_edges_len = GetEdgesLen(node_id);
+			for (uint32_t i = 0; i < node_edges_len; i++) {
+				if (node_contigs[node_edges[i]] != UINT32_MAX) continue;
+				node_contigs[node_edges[i]] = contig;
+				stack[stack_len++] = node_edges[i];
+			}
+		}
+	}
+	free(stack);
+	return node_contigs;
+}
+
+void Graph::BuildReferencePath() {
+	ClearReferencePath();
+
+	uint32_t *order = GetTopologicalOrder();
+	reference_path = (uint32_t *) malloc(sizeof(uint32_t) * (nodes_len + 1));
+	reference_path_len = 0;
+	if (order != NULL) {
+		// The reference path visits its nodes in a topological order
+		for (uint32_t i = 0; i < nodes_len; i++) {
+			if ((nodes + order[i])->reference) reference_path[reference_path_len++] = order[i];
+		}
+		free(order);
+	} else {
+		// A cyclic graph has no topological order, so the existing reference indices are trusted
+		for (uint32_t i = 0; i < nodes_len; i++) {
+			if ((nodes + i)->reference) reference_path[reference_path_len++] = i;
+		}
+		std::stable_sort(reference_path, reference_path + reference_path_len,
+				[this](const uint32_t a, const uint32_t b) -> bool {
+					return reference_indices[a] < reference_indices[b];
+				});
+	}
+
+	// Every contig gets a range of the path of its own, in contig order, so the path never runs from one
+	// contig into the next. Reference nodes no contig root reaches are left out of the path.
+	reference_ranges_len = (contigs_len > 0) ? contigs_len : 1;
+	reference_range_starts = (uint32_t *) calloc(reference_ranges_len + 1, sizeof(uint32_t));
+	uint32_t *node_contigs = NULL;
+	if (contigs_len > 0) {
+		node_contigs = FindNodeContigs();
+		for (uint32_t i = 0; i < reference_path_len; i++) {
+			uint32_t contig = node_contigs[reference_path[i]];
+			if (contig != UINT32_MAX) reference_range_starts[contig + 1]++;
+		}
+		for (uint32_t contig = 0; contig < contigs_len; contig++) {
+			reference_range_starts[contig + 1] += reference_range_starts[contig];
+		}
+		uint32_t *contig_path = (uint32_t *) malloc(sizeof(uint32_t) * (nodes_len + 1));
+		uint32_t *cursors = (uint32_t *) malloc(sizeof(uint32_t) * contigs_len);
+		memcpy(cursors, reference_range_starts, sizeof(uint32_t) * contigs_len);
+		for (uint32_t i = 0; i < reference_path_len; i++) {
+			uint32_t contig = node_contigs[reference_path[i]];
+			if (contig != UINT32_MAX) contig_path[cursors[contig]++] = reference_path[i];
+		}
+		free(cursors);
+		free(reference_path);
+		reference_path = contig_path;
+		reference_path_len = reference_range_starts[contigs_len];
+	} else {
+		reference_range_starts[1] = reference_path_len;
+	}
+
+	reference_offsets = (uint64_t *) malloc(sizeof(uint64_t) * (reference_path_len + 1));
+	reference_offsets[0] = 0;
+	bool renumber = false;
+	for (uint32_t i = 0; i < reference_path_len; i++) {
+		struct node *node = (nodes + reference_path[i]);
+		reference_offsets[i + 1] = reference_offsets[i] + node->length;
+		if (reference_indices[reference_path[i]] != i) renumber = true;
+	}
+	uint32_t left_out = 0;
+	if (node_contigs != NULL) {
+		for (uint32_t i = 0; i < nodes_len; i++) {
+			if ((nodes + i)->reference && node_contigs[i] == UINT32_MAX && reference_indices[i] != UINT32_MAX) left_out++;
+		}
+	}
+	// Mapped graphs written after their path was built are already numbered, and stay mapped
+	if (renumber || left_out > 0) {
+		EnsureOwned();
+		for (uint32_t i = 0; i < reference_path_len; i++) {
+			reference_indices[reference_path[i]] = i;
+		}
+		for (uint32_t i = 0; i < nodes_len && left_out > 0; i++) {
+			if ((nodes + i)->reference && node_contigs[i] == UINT32_MAX) reference_indices[i] = UINT32_MAX;
+		}
+	}
+	free(node_contigs);
+	reference_path_built = true;
+}
+
+void Graph::ClearReferencePath() {
+	if (!reference_path_mapped) {
+		free(reference_path);
+		free(reference_offsets);
+	}
+	reference_path_mapped = false;
+	free(reference_range_starts);
+	reference_path = NULL;
+	reference_offsets = NULL;
+	reference_range_starts = NULL;
+	reference_path_len = 0;
+	reference_ranges_len = 0;
+	reference_path_built = false;
+}
+
 uint32_t Graph::GetRequiredEmptyNodeCount() {
 	uint32_t min_node_depth[nodes_len];
 	uint32_t max_node_depth[nodes_len];
@@ -515,15 +1339,16 @@ uint32_t Graph::GetRequiredEmptyNodeCount() {
 	
 	while (stack_len > 0) {
 		uint32_t node_id = stack[--stack_len];
-		struct node *node = (nodes + node_id);
+		uint32_t *node_edges = GetEdges(node_id);
+		uint32_t node_edges_len = GetEdgesLen(node_id);
 		uint32_t min_depth = min_node_depth[node_id] + 1;
 		uint32_t max_depth = max_node_depth[node_id] + 1;
 		if (max_depth > nodes_len) {
 			std::cout << "ERROR: This graph has a cycle. Cannot add empty nodes." << std::endl;
 			return 0;
 		}
-		for (uint8_t i = 0; i < node->edges_len; i++) {
-			uint32_t edge_id = node->edges[i];
+		for (uint32_t i = 0; i < node_edges_len; i++) {
+			uint32_t edge_id = node_edges[i];
 			bool updated = false;
 			if (min_depth < min_node_depth[edge_id]) {
 				min_node_depth[edge_id] = min_depth;
@@ -542,10 +1367,11 @@ uint32_t Graph::GetRequiredEmptyNodeCount() {
 }
 
 bool Graph::NodeHasEdge(uint32_t node_id, uint32_t edge_id) {
-	struct node *node = (nodes + node_id);
+	uint32_t *node_edges = GetEdges(node_id);
+	uint32_t node_edges_len = GetEdgesLen(node_id);
 
-	for (uint8_t edge_idx = 0; edge_idx < node->edges_len; edge_idx++) {
-		if (node->edges[edge_idx] == edge_id)
+	for (uint32_t edge_idx = 0; edge_idx < node_edges_len; edge_idx++) {
+		if (node_edges[edge_idx] == edge_id)
 			return true;
 	}
 	return false;
@@ -554,14 +1380,9 @@ bool Graph::NodeHasEdge(uint32_t node_id, uint32_t edge_id) {
 void Graph::InitializeEmptyNode(uint32_t node_id) {
 	struct node *node = (nodes + node_id);
 	node->length = 0;
-	node->sequences_len = 0;
-	node->sequences = NULL;
-	node->edges = NULL;
-	node->edges_len = 0;
-	node->edges_in = NULL;
-	node->edges_in_len = 0;
-	node->reference_index = 0;
+	node->sequence = 0;
 	node->reference = false;
+	reference_indices[node_id] = 0;
 }
 
 uint32_t Graph::CreateEmptyNodes() {
@@ -590,13 +1411,14 @@ uint32_t Graph::CreateEmptyNodes() {
 		in_queue[node_id] = false;
 		uint32_t depth = node_depth[node_id];
 		//std::cout << "Node: " << node_id << ", Depth: " << depth << std::endl;
-		struct node *node = (nodes + node_id);
+		uint32_t *node_edges = GetEdges(node_id);
+		uint32_t node_edges_len = GetEdgesLen(node_id);
 		if (depth > nodes_len) {
 			std::cout << "ERROR: This graph has a cycle. Cannot add empty nodes." << std::endl;
 			return 0;
 		}
-		for (uint8_t i = 0; i < node->edges_len; i++) {
-			uint32_t edge_id = node->edges[i];
+		for (uint32_t i = 0; i < node_edges_len; i++) {
+			uint32_t edge_id = node_edges[i];
 			bool updated = false;
 			uint32_t edge_depth = depth + 1;
 			if (node_depth[edge_id] == 0) {
@@ -607,10 +1429,11 @@ uint32_t Graph::CreateEmptyNodes() {
 				if (diff > 1 || diff < -1) more_than_1++;
 				if (node_depth[edge_id] < edge_depth) {
 					// Depth mismatch, need empty node between
-					struct node *edge = (nodes + edge_id);
+					uint32_t *edge_edges_in = GetEdgesIn(edge_id);
+					uint32_t edge_edges_in_len = GetEdgesInLen(edge_id);
 					bool found_empty_node = false;
-					for (uint8_t j = 0; j < edge->edges_in_len; j++) {
-						uint32_t in_edge_id = edge->edges_in[j];
+					for (uint32_t j = 0; j < edge_edges_in_len; j++) {
+						uint32_t in_edge_id = edge_edges_in[j];
 						struct node *in_edge = (nodes + in_edge_id);
 						if (in_edge->length == 0 && node_depth[in_edge_id] == depth + 1) {
 							found_empty_node = true;
@@ -737,12 +1560,71 @@ uint32_t Graph::AddEmptyNodesForNode(uint32_t node_id) {
 */
 
 uint32_t Graph::AppendEmptyNode() {
+	ReserveNodes(1);
+	ClearReferencePath();
 	uint32_t new_node_id = nodes_len++;
-	nodes = (struct node *) realloc(nodes, sizeof(struct node) * nodes_len);
 	InitializeEmptyNode(new_node_id);
 	return new_node_id;
 }
 
+uint32_t Graph::AppendEmptyNodes(uint32_t count) {
+	ReserveNodes(count);
+	ClearReferencePath();
+	uint32_t first_node_id = nodes_len;
+	nodes_len += count;
+	for (uint32_t node_id = first_node_id; node_id < nodes_len; node_id++) {
+		InitializeEmptyNode(node_id);
+	}
+	return first_node_id;
+}
+
+uint32_t Graph::AppendGraph(Graph *other) {
+	other->Finalize();
+	ReserveNodes(other->nodes_len);
+	ReserveEdges(other->edges_len);
+	ReserveSequences(other->sequences_len);
+	ClearReferencePath();
+
+	// The arena of the other graph is copied 32 bases at a time, shifted to start where this one ends
+	uint64_t sequence_offset = sequences_len;
+	for (uint64_t base = 0; base < other->sequences_len; base += 32) {
+		uint8_t length = (other->sequences_len - base > 32) ? 32 : (other->sequences_len - base);
+		AppendPackedSequence(other->sequences[base / 32], length);
+	}
+
+	uint32_t node_id_offset = nodes_len;
+	memcpy(nodes + nodes_len, other->nodes, sizeof(struct node) * other->nodes_len);
+	memcpy(reference_indices + nodes_len, other->reference_indices, sizeof(uint32_t) * other->nodes_len);
+	nodes_len += other->nodes_len;
+	for (uint32_t node_id = node_id_offset; node_id < nodes_len; node_id++) {
+		if ((nodes + node_id)->length > NODE_INLINE_BASES) (nodes + node_id)->sequence_offset += sequence_offset;
+	}
+
+	for (uint32_t node_id = 0; node_id < other->nodes_len; node_id++) {
+		uint32_t *node_edges = other->GetEdges(node_id);
+		uint32_t node_edges_len = other->GetEdgesLen(node_id);
+		for (uint32_t i = 0; i < node_edges_len; i++) {
+			AddEdge(node_id_offset + node_id, node_id_offset + node_edges[i]);
+		}
+	}
+	return node_id_offset;
+}
+
+void Graph::AddContig(const char *name, uint32_t root_node_id) {
+	ClearReferencePath();
+	contig_roots = (uint32_t *) realloc(contig_roots, sizeof(uint32_t) * (contigs_len + 1));
+	contig_names = (char **) realloc(contig_names, sizeof(char *) * (contigs_len + 1));
+	contig_roots[contigs_len] = root_node_id;
+	contig_names[contigs_len] = strdup(name);
+	contigs_len++;
+}
+
+void Graph::RemapContigRoots(uint32_t *id_map) {
+	for (uint32_t i = 0; i < contigs_len; i++) {
+		contig_roots[i] = id_map[contig_roots[i]];
+	}
+}
+
 uint32_t Graph::AddEmptyNodes() {
 	/*
 	uint32_t empty_node_count = GetRequiredEmptyNodeCount();
@@ -761,15 +1643,21 @@ uint32_t Graph::AddEmptyNodes() {
 	printf("Actually added %u nodes\n", real_added);
 	*/
 
+	Finalize();
+	EnsureOwned();
+
 	uint32_t empty_node_count = 0;
+	uint32_t original_nodes_len = nodes_len;
 
-	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
+	for (uint32_t node_id = 0; node_id < original_nodes_len; node_id++) {
 		struct node *node = (nodes + node_id);
 		if (!(node->reference)) continue;
-		for (uint8_t i = 0; i < node->edges_len; i++) {
-			uint32_t edge_id = node->edges[i];
+		uint32_t *node_edges = GetEdges(node_id);
+		uint32_t node_edges_len = GetEdgesLen(node_id);
+		for (uint32_t i = 0; i < node_edges_len; i++) {
+			uint32_t edge_id = node_edges[i];
 			struct node *edge = (nodes + edge_id);
-			if (edge->reference && edge->reference_index == node->reference_index + 2) {
+			if (edge->reference && reference_indices[edge_id] == reference_indices[node_id] + 2) {
 				uint32_t empty_node_id = AppendEmptyNode();
 				node = (nodes + node_id);
 				empty_node_count++;
@@ -778,19 +1666,21 @@ uint32_t Graph::AddEmptyNodes() {
 		}
 	}
 
+	Finalize();
+
 	return empty_node_count;
 }
 
+// Redirects the edge from_node -> to_node through mid_node.
+// The out-edge is rewritten in place, while the new edge from mid_node is pending until Finalize().
 void Graph::MoveEdgesToIntermediateNode(uint32_t from_node_id, uint32_t to_node_id, uint32_t mid_node_id) {
-	struct node *from_node = (nodes + from_node_id);
-	struct node *to_node = (nodes + to_node_id);
-	struct node *mid_node = (nodes + mid_node_id);
+	uint32_t *from_edges = GetEdges(from_node_id);
+	uint32_t from_edges_len = GetEdgesLen(from_node_id);
 	
-	int16_t from_node_edge_index = -1;
-	int16_t to_node_edge_index = -1;
+	int64_t from_node_edge_index = -1;
 
-	for (uint8_t i = 0; i < from_node->edges_len; i++) {
-		if (from_node->edges[i] == to_node_id) {
+	for (uint32_t i = 0; i < from_edges_len; i++) {
+		if (from_edges[i] == to_node_id) {
 			from_node_edge_index = i;
 			break;
 		}
@@ -801,115 +1691,721 @@ void Graph::MoveEdgesToIntermediateNode(uint32_t from_node_id, uint32_t to_node_
 		return;
 	}
 
-	for (uint8_t i = 0; i < to_node->edges_in_len; i++) {
-		if (to_node->edges_in[i] == from_node_id) {
-			to_node_edge_index = i;
-			break;
+	from_edges[from_node_edge_index] = mid_node_id;
+	AddEdge(mid_node_id, to_node_id);
+}
+
+// Returns the node IDs in a topological order, or NULL if the graph has a cycle.
+// Ready nodes are taken last in, first out, so the branches of a bubble follow the node
+// they leave from, and the node they join at follows them.
+uint32_t *Graph::GetTopologicalOrder() {
+	FinalizeEdges();
+
+	uint32_t *order = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	uint32_t *remaining_in = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	uint32_t *ready = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	uint32_t order_len = 0;
+	uint32_t ready_len = 0;
+
+	for (uint32_t i = nodes_len; i > 0; i--) {
+		remaining_in[i - 1] = GetEdgesInLen(i - 1);
+		if (remaining_in[i - 1] == 0) ready[ready_len++] = i - 1;
+	}
+	while (ready_len > 0) {
+		uint32_t node_id = ready[--ready_len];
+		order[order_len++] = node_id;
+		uint32_t *node_edges = GetEdges(node_id);
+		uint32_t node_edges_len = GetEdgesLen(node_id);
+		for (uint32_t j = node_edges_len; j > 0; j--) {
+			if (--remaining_in[node_edges[j - 1]] == 0) ready[ready_len++] = node_edges[j - 1];
 		}
 	}
 
-	if (to_node_edge_index == -1) {
-		std::cout << "FATAL: Failed to find edge from the specified node." << std::endl;
-		return;
+	free(remaining_in);
+	free(ready);
+
+	if (order_len != nodes_len) {
+		free(order);
+		return NULL;
 	}
+	return order;
+}
 
-	from_node->edges[from_node_edge_index] = mid_node_id;
-	to_node->edges_in[to_node_edge_index] = mid_node_id;
+// Reorders the nodes, their sequences and their edges so node IDs follow a topological order,
+// keeping the nodes of a bubble next to each other in memory.
+// Returns a map from old to new node IDs, owned by the caller, or NULL if the graph has a cycle.
+uint32_t *Graph::RenumberNodes() {
+	uint32_t *order = GetTopologicalOrder();
+	if (order == NULL) {
+		std::cout << "ERROR: This graph has a cycle. Cannot renumber its nodes." << std::endl;
+		return NULL;
+	}
+	EnsureOwned();
 
-	mid_node->edges_len++;
-	mid_node->edges_in_len++;
+	uint32_t *id_map = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	for (uint32_t i = 0; i < nodes_len; i++) id_map[order[i]] = i;
 
-	if (mid_node->edges == NULL) {
-		mid_node->edges = (uint32_t *) malloc(sizeof(uint32_t) * mid_node->edges_len);
-	} else {
-		mid_node->edges = (uint32_t *) realloc(mid_node->edges, sizeof(uint32_t) * mid_node->edges_len);
-	}
-	mid_node->edges[mid_node->edges_len - 1] = to_node_id;
+	struct node *renumbered_nodes = (struct node *) malloc(sizeof(struct node) * nodes_len);
+	uint32_t *renumbered_reference_indices = (uint32_t *) malloc(sizeof(uint32_t) * nodes_len);
+	uint64_t *renumbered_sequences = (uint64_t *) calloc(sequences_cap, sizeof(uint64_t));
+	uint32_t *renumbered_edges_offsets = (uint32_t *) malloc(sizeof(uint32_t) * (nodes_len + 1));
+	uint32_t *renumbered_edges = (uint32_t *) malloc(sizeof(uint32_t) * edges_len);
+	uint64_t sequence_offset = 0;
+	renumbered_edges_offsets[0] = 0;
 
-	if (mid_node->edges_in == NULL) {
-		mid_node->edges_in = (uint32_t *) malloc(sizeof(uint32_t) * mid_node->edges_in_len);
-	} else {
-		mid_node->edges_in = (uint32_t *) realloc(mid_node->edges_in, sizeof(uint32_t) * mid_node->edges_in_len);
+	for (uint32_t i = 0; i < nodes_len; i++) {
+		struct node *node = (nodes + order[i]);
+		struct node *renumbered_node = (renumbered_nodes + i);
+		(*renumbered_node) = (*node);
+		renumbered_reference_indices[i] = reference_indices[order[i]];
+		if (node->length > NODE_INLINE_BASES) {
+			renumbered_node->sequence_offset = sequence_offset;
+			for (uint32_t j = 0; j < node->length; j += 32) {
+				uint8_t length = (node->length - j > 32) ? 32 : (node->length - j);
+				write_packed_bases(renumbered_sequences, sequence_offset + j, GetSequence(node, j / 32), length);
+			}
+			sequence_offset += node->length;
+		}
+
+		uint32_t *node_edges = GetEdges(order[i]);
+		uint32_t node_edges_len = GetEdgesLen(order[i]);
+		uint32_t *out = renumbered_edges + renumbered_edges_offsets[i];
+		for (uint32_t j = 0; j < node_edges_len; j++) out[j] = id_map[node_edges[j]];
+		renumbered_edges_offsets[i + 1] = renumbered_edges_offsets[i] + node_edges_len;
 	}
-	mid_node->edges_in[mid_node->edges_in_len - 1] = from_node_id;
+
+	free(order);
+	free(nodes);
+	free(reference_indices);
+	free(sequences);
+	free(edges_offsets);
+	free(edges);
+	nodes = renumbered_nodes;
+	reference_indices = renumbered_reference_indices;
+	nodes_cap = nodes_len;
+	sequences = renumbered_sequences;
+	sequences_len = sequence_offset;
+	edges_offsets = renumbered_edges_offsets;
+	edges = renumbered_edges;
+	BuildInEdges();
+	RemapContigRoots(id_map);
+
+	BuildReferencePath();
+
+	return id_map;
 }
 
 Graph *Graph::FromFile(char *filepath) {
+	return FromFileWithMode(filepath, true);
+}
+
+Graph *Graph::FromFileUnmapped(char *filepath) {
+	return FromFileWithMode(filepath, false);
+}
+
+Graph *Graph::FromFileWithMode(char *filepath, bool map) {
 	FILE *f = fopen(filepath, "rb");
+	if (f == NULL) {
+		printf("Failed to open graph file %s\n", filepath);
+		return NULL;
+	}
 	int format_code_len = strlen(BCG_FORMAT_CODE);
 
 	for (int i = 0; i < format_code_len; i++) {
 		if (fgetc(f) != BCG_FORMAT_CODE[i]) {
+			fclose(f);
 			return NULL;
 		}
 	}
 
 	uint8_t version_number = fgetc(f);
 
+	if (version_number == BCG_FORMAT_VERSION) {
+		fclose(f);
+		return map ? MapFileSections(filepath) : ReadFileSections(filepath);
+	}
+
+	if (version_number != 1) {
+		printf("Unsupported graph file version %u\n", version_number);
+		fclose(f);
+		return NULL;
+	}
+
 	char encoding[5];
 	encoding[4] = '\0';
 
 	for (uint8_t i = 0; i < 4; i++) {
 		encoding[i] = fgetc(f);
 	}
-	
+
+	Graph *graph = FromFileVersion1(f, encoding);
+
+	fclose(f);
+
+	return graph;
+}
+
+bool Graph::ReadFileHeader(char *filepath, struct bcg_header *header) {
+	FILE *f = fopen(filepath, "rb");
+	if (f == NULL) return false;
+
+	struct stat file_stat;
+	bool valid = (fstat(fileno(f), &file_stat) == 0 &&
+	              fread(header, sizeof(struct bcg_header), 1, f) == 1 &&
+	              IsValidFileHeader(header, file_stat.st_size, filepath));
+
+	fclose(f);
+
+	return valid;
+}
+
+bool Graph::IsValidFileHeader(struct bcg_header *header, uint64_t file_len, char *filepath) {
+	if (strncmp(header->format_code, BCG_FORMAT_CODE, strlen(BCG_FORMAT_CODE)) != 0 ||
+	    header->version != BCG_FORMAT_VERSION) {
+		return false;
+	}
+	if (header->node_size != sizeof(struct node)) {
+		printf("Graph file %s was written with an incompatible node layout\n", filepath);
+		return false;
+	}
+	for (uint8_t i = 0; i < BCG_SECTION_COUNT; i++) {
+		if (header->section_sizes[i] > file_len || header->section_offsets[i] > file_len - header->section_sizes[i]) {
+			printf("Graph file %s is truncated\n", filepath);
+			return false;
+		}
+	}
+
+	// Every array is read up to the lengths in the header, so its section must hold exactly that much
+	uint64_t nodes_len = header->nodes_len;
+	uint64_t section_sizes[BCG_SECTION_COUNT];
+	section_sizes[BCG_SECTION_NODES] = sizeof(struct node) * nodes_len;
+	section_sizes[BCG_SECTION_REFERENCE_INDICES] = sizeof(uint32_t) * nodes_len;
+	section_sizes[BCG_SECTION_EDGES_OFFSETS] = sizeof(uint32_t) * (nodes_len + 1);
+	section_sizes[BCG_SECTION_EDGES] = sizeof(uint32_t) * header->edges_len;
+	section_sizes[BCG_SECTION_EDGES_IN_OFFSETS] = sizeof(uint32_t) * (nodes_len + 1);
+	section_sizes[BCG_SECTION_EDGES_IN] = sizeof(uint32_t) * header->edges_len;
+	section_sizes[BCG_SECTION_SEQUENCES] = sizeof(uint64_t) * ((header->sequences_len + 31) / 32 + 1);
+	uint64_t reference_ranges_len = (header->contigs_len > 0) ? header->contigs_len : 1;
+	section_sizes[BCG_SECTION_REFERENCE_PATH] = sizeof(uint32_t) * (uint64_t) header->reference_path_len;
+	section_sizes[BCG_SECTION_REFERENCE_OFFSETS] = sizeof(uint64_t) * ((uint64_t) header->reference_path_len + 1);
+	section_sizes[BCG_SECTION_REFERENCE_RANGE_STARTS] = sizeof(uint32_t) * (reference_ranges_len + 1);
+	section_sizes[BCG_SECTION_CONTIG_ROOTS] = sizeof(uint32_t) * (uint64_t) header->contigs_len;
+	// Names differ in length, so they are only checked as they are read
+	section_sizes[BCG_SECTION_CONTIG_NAMES] = header->section_sizes[BCG_SECTION_CONTIG_NAMES];
+	for (uint8_t i = 0; i < BCG_SECTION_COUNT; i++) {
+		if (header->section_sizes[i] != section_sizes[i]) {
+			printf("Graph file %s has a section that does not match its header\n", filepath);
+			return false;
+		}
+	}
+	if (header->reference_path_len > header->nodes_len) {
+		printf("Graph file %s has a section that does not match its header\n", filepath);
+		return false;
+	}
+	return true;
+}
+
+// Reads the rest of a version 1 file, which stores every node as a variable-length record.
+Graph *Graph::FromFileVersion1(FILE *f, const char *encoding) {
 	Graph *graph = new Graph(encoding);
 
 	fread(&(graph->nodes_len), sizeof(uint32_t), 1, f);
+	graph->nodes_cap = graph->nodes_len;
 	graph->nodes = (struct node *) malloc(sizeof(struct node) * graph->nodes_len);
 	memset(graph->nodes, 0, sizeof(struct node) * graph->nodes_len);
+	graph->reference_indices = (uint32_t *) malloc(sizeof(uint32_t) * graph->nodes_len);
+	memset(graph->reference_indices, 0, sizeof(uint32_t) * graph->nodes_len);
+	graph->edges_offsets = (uint32_t *) malloc(sizeof(uint32_t) * (graph->nodes_len + 1));
+	graph->edges_offsets[0] = 0;
+	uint32_t edges_cap = graph->nodes_len + 1;
+	graph->edges = (uint32_t *) malloc(sizeof(uint32_t) * edges_cap);
 
 	for (uint32_t i = 0; i < graph->nodes_len; i++) {
 		struct node *n = (graph->nodes + i);
 		fread(&(n->length), sizeof(uint32_t), 1, f);
-		fread(&(n->sequences_len), sizeof(uint32_t), 1, f);
-		n->sequences = (uint64_t *) malloc(sizeof(uint64_t) * n->sequences_len);
-		memset(n->sequences, 0, sizeof(uint64_t) * n->sequences_len);
-		fread(n->sequences, sizeof(uint64_t), n->sequences_len, f);
+		uint32_t sequences_len = 0;
+		fread(&sequences_len, sizeof(uint32_t), 1, f);
+		if (n->length <= NODE_INLINE_BASES) {
+			n->sequence = 0;
+			if (sequences_len > 0) fread(&(n->sequence), sizeof(uint64_t), 1, f);
+			if (n->length < 32) n->sequence &= ~(~0ULL >> (n->length * 2));
+		} else {
+			n->sequence_offset = graph->sequences_len;
+			graph->ReserveSequences(n->length);
+		}
+		for (uint32_t j = (n->length <= NODE_INLINE_BASES && sequences_len > 0) ? 1 : 0; j < sequences_len; j++) {
+			uint64_t packed = 0;
+			fread(&packed, sizeof(uint64_t), 1, f);
+			if (n->length > NODE_INLINE_BASES) {
+				graph->AppendPackedSequence(packed, (n->length - j * 32 > 32) ? 32 : (n->length - j * 32));
+			}
+		}
 		uint8_t edges_len = 0;
 		fread(&edges_len, sizeof(uint8_t), 1, f);
-		n->edges_len = edges_len;
-		n->edges = (uint32_t *) malloc(sizeof(uint32_t) * edges_len);
-		memset(n->edges, 0, sizeof(uint32_t) * edges_len);
-		fread(n->edges, sizeof(uint32_t), edges_len, f);
+		uint32_t edges_offset = graph->edges_offsets[i];
+		while (edges_offset + edges_len > edges_cap) {
+			edges_cap *= 2;
+			graph->edges = (uint32_t *) realloc(graph->edges, sizeof(uint32_t) * edges_cap);
+		}
+		fread(graph->edges + edges_offset, sizeof(uint32_t), edges_len, f);
+		graph->edges_offsets[i + 1] = edges_offset + edges_len;
 		uint8_t reference = 0;
 		fread(&reference, sizeof(uint8_t), 1, f);
 		n->reference = reference;
 	}
 
+	graph->edges_len = graph->edges_offsets[graph->nodes_len];
+	graph->csr_nodes_len = graph->nodes_len;
+	graph->BuildInEdges();
+
+	// Version 1 does not store reference indices, so they are recovered from the graph's structure
+	graph->BuildReferencePath();
+
+	return graph;
+}
+
+// Adds the contigs of a graph file. Returns false if there are fewer names than roots.
+static bool add_file_contigs(Graph *graph, const uint32_t *roots, const char *names, uint64_t names_len, uint32_t contigs_len) {
+	uint64_t pos = 0;
+	for (uint32_t i = 0; i < contigs_len; i++) {
+		const char *name_end = (const char *) memchr(names + pos, '\0', names_len - pos);
+		if (name_end == NULL) return false;
+		graph->AddContig(names + pos, roots[i]);
+		pos = name_end - names + 1;
+	}
+	return true;
+}
+
+// Returns whether the len + 1 offsets start at 0, never decrease and end at last
+static bool are_valid_file_offsets(const uint32_t *offsets, uint64_t len, uint64_t last) {
+	if (offsets[0] != 0) return false;
+	for (uint64_t i = 0; i < len; i++) {
+		if (offsets[i + 1] < offsets[i]) return false;
+	}
+	return offsets[len] == last;
+}
+
+static bool are_valid_file_node_ids(const uint32_t *ids, uint64_t len, uint32_t nodes_len) {
+	for (uint64_t i = 0; i < len; i++) {
+		if (ids[i] >= nodes_len) return false;
+	}
+	return true;
+}
+
+// Checks the sections of a file whose header is valid, so that nothing read through them leaves the arrays:
+// offsets never decrease and end at the lengths in the header, and every node ID is below nodes_len.
+// This reads every section but the contig names once, which is still far less than parsing the file.
+static bool has_valid_file_sections(const struct bcg_header *header, char **sections) {
+	uint32_t nodes_len = header->nodes_len;
+	const struct node *nodes = (const struct node *) sections[BCG_SECTION_NODES];
+	for (uint32_t i = 0; i < nodes_len; i++) {
+		if (nodes[i].length > NODE_INLINE_BASES && (nodes[i].sequence_offset > header->sequences_len ||
+		    nodes[i].length > header->sequences_len - nodes[i].sequence_offset)) {
+			return false;
+		}
+	}
+	if (!are_valid_file_offsets((const uint32_t *) sections[BCG_SECTION_EDGES_OFFSETS], nodes_len, header->edges_len) ||
+	    !are_valid_file_offsets((const uint32_t *) sections[BCG_SECTION_EDGES_IN_OFFSETS], nodes_len, header->edges_len) ||
+	    !are_valid_file_node_ids((const uint32_t *) sections[BCG_SECTION_EDGES], header->edges_len, nodes_len) ||
+	    !are_valid_file_node_ids((const uint32_t *) sections[BCG_SECTION_EDGES_IN], header->edges_len, nodes_len) ||
+	    !are_valid_file_node_ids((const uint32_t *) sections[BCG_SECTION_REFERENCE_PATH], header->reference_path_len, nodes_len) ||
+	    !are_valid_file_node_ids((const uint32_t *) sections[BCG_SECTION_CONTIG_ROOTS], header->contigs_len, nodes_len)) {
+		return false;
+	}
+	uint64_t reference_ranges_len = (header->contigs_len > 0) ? header->contigs_len : 1;
+	if (!are_valid_file_offsets((const uint32_t *) sections[BCG_SECTION_REFERENCE_RANGE_STARTS], reference_ranges_len, header->reference_path_len)) {
+		return false;
+	}
+	const uint64_t *reference_offsets = (const uint64_t *) sections[BCG_SECTION_REFERENCE_OFFSETS];
+	for (uint32_t i = 0; i < header->reference_path_len; i++) {
+		if (reference_offsets[i + 1] < reference_offsets[i]) return false;
+	}
+	return true;
+}
+
+// Reads a sectioned file into heap arrays sized exactly from its header, with one read per section.
+Graph *Graph::ReadFileSections(char *filepath) {
+	struct bcg_header header;
+	if (!ReadFileHeader(filepath, &header)) return NULL;
+
+	FILE *f = fopen(filepath, "rb");
+	if (f == NULL) return NULL;
+
+	char encoding[5];
+	memcpy(encoding, header.encoding, sizeof(char) * 4);
+	encoding[4] = '\0';
+
+	Graph *graph = new Graph(encoding);
+
+	graph->nodes_len = header.nodes_len;
+	graph->nodes_cap = header.nodes_len;
+	graph->edges_len = header.edges_len;
+	graph->sequences_len = header.sequences_len;
+	graph->sequences_cap = header.section_sizes[BCG_SECTION_SEQUENCES] / sizeof(uint64_t);
+	graph->csr_nodes_len = header.nodes_len;
+
+	// The path is set once the contigs are added, since adding them clears it
+	uint32_t *reference_path = NULL;
+	uint64_t *reference_offsets = NULL;
+	uint32_t *reference_range_starts = NULL;
+	uint32_t *contig_roots = NULL;
+	char *contig_names = NULL;
+	void **sections[BCG_SECTION_COUNT];
+	sections[BCG_SECTION_NODES] = (void **) &(graph->nodes);
+	sections[BCG_SECTION_REFERENCE_INDICES] = (void **) &(graph->reference_indices);
+	sections[BCG_SECTION_EDGES_OFFSETS] = (void **) &(graph->edges_offsets);
+	sections[BCG_SECTION_EDGES] = (void **) &(graph->edges);
+	sections[BCG_SECTION_EDGES_IN_OFFSETS] = (void **) &(graph->edges_in_offsets);
+	sections[BCG_SECTION_EDGES_IN] = (void **) &(graph->edges_in);
+	sections[BCG_SECTION_SEQUENCES] = (void **) &(graph->sequences);
+	sections[BCG_SECTION_REFERENCE_PATH] = (void **) &reference_path;
+	sections[BCG_SECTION_REFERENCE_OFFSETS] = (void **) &reference_offsets;
+	sections[BCG_SECTION_REFERENCE_RANGE_STARTS] = (void **) &reference_range_starts;
+	sections[BCG_SECTION_CONTIG_ROOTS] = (void **) &contig_roots;
+	sections[BCG_SECTION_CONTIG_NAMES] = (void **) &contig_names;
+
+	bool valid = true;
+	for (uint8_t i = 0; i < BCG_SECTION_COUNT && valid; i++) {
+		uint64_t size = header.section_sizes[i];
+		*(sections[i]) = malloc(size);
+		fseek(f, header.section_offsets[i], SEEK_SET);
+		valid = (size == 0 || fread(*(sections[i]), 1, size, f) == size);
+	}
 	fclose(f);
 
+	if (valid) {
+		char *read_sections[BCG_SECTION_COUNT];
+		for (uint8_t i = 0; i < BCG_SECTION_COUNT; i++) read_sections[i] = (char *) *(sections[i]);
+		valid = has_valid_file_sections(&header, read_sections);
+	}
+	valid = valid && add_file_contigs(graph, contig_roots, contig_names, header.section_sizes[BCG_SECTION_CONTIG_NAMES], header.contigs_len);
+	free(contig_roots);
+	free(contig_names);
+	if (!valid) {
+		printf("Failed to read graph file %s\n", filepath);
+		free(reference_path);
+		free(reference_offsets);
+		free(reference_range_starts);
+		delete graph;
+		return NULL;
+	}
+
+	// The path was written by ToFile, so it does not have to be built again
+	graph->reference_path = reference_path;
+	graph->reference_offsets = reference_offsets;
+	graph->reference_range_starts = reference_range_starts;
+	graph->reference_path_len = header.reference_path_len;
+	graph->reference_ranges_len = (header.contigs_len > 0) ? header.contigs_len : 1;
+	graph->reference_path_built = true;
+
 	return graph;
 }
 
+// Maps a sectioned file into memory and points the graph's arrays directly at its sections.
+// The mapping is private, so pages are shared between processes until a graph modifies them.
+Graph *Graph::MapFileSections(char *filepath) {
+	int fd = open(filepath, O_RDONLY);
+	if (fd == -1) return NULL;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) == -1 || (uint64_t) file_stat.st_size < sizeof(struct bcg_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	uint64_t mapped_len = file_stat.st_size;
+	void *mapped_data = mmap(NULL, mapped_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped_data == MAP_FAILED) {
+		printf("Failed to map graph file %s\n", filepath);
+		return NULL;
+	}
+
+	struct bcg_header *header = (struct bcg_header *) mapped_data;
+	if (!IsValidFileHeader(header, mapped_len, filepath)) {
+		munmap(mapped_data, mapped_len);
+		return NULL;
+	}
+	char *mapped_sections[BCG_SECTION_COUNT];
+	for (uint8_t i = 0; i < BCG_SECTION_COUNT; i++) mapped_sections[i] = (char *) mapped_data + header->section_offsets[i];
+	if (!has_valid_file_sections(header, mapped_sections)) {
+		printf("Failed to read graph file %s\n", filepath);
+		munmap(mapped_data, mapped_len);
+		return NULL;
+	}
+
+	char encoding[5];
+	memcpy(encoding, header->encoding, sizeof(char) * 4);
+	encoding[4] = '\0';
+
+	Graph *graph = new Graph(encoding);
+	char *base = (char *) mapped_data;
+
+	graph->mapped_data = mapped_data;
+	graph->mapped_len = mapped_len;
+	graph->nodes_len = header->nodes_len;
+	graph->nodes_cap = header->nodes_len;
+	graph->edges_len = header->edges_len;
+	graph->sequences_len = header->sequences_len;
+	graph->sequences_cap = header->section_sizes[BCG_SECTION_SEQUENCES] / sizeof(uint64_t);
+	graph->csr_nodes_len = header->nodes_len;
+	graph->nodes = (struct node *) (base + header->section_offsets[BCG_SECTION_NODES]);
+	graph->reference_indices = (uint32_t *) (base + header->section_offsets[BCG_SECTION_REFERENCE_INDICES]);
+	graph->edges_offsets = (uint32_t *) (base + header->section_offsets[BCG_SECTION_EDGES_OFFSETS]);
+	graph->edges = (uint32_t *) (base + header->section_offsets[BCG_SECTION_EDGES]);
+	graph->edges_in_offsets = (uint32_t *) (base + header->section_offsets[BCG_SECTION_EDGES_IN_OFFSETS]);
+	graph->edges_in = (uint32_t *) (base + header->section_offsets[BCG_SECTION_EDGES_IN]);
+	graph->sequences = (uint64_t *) (base + header->section_offsets[BCG_SECTION_SEQUENCES]);
+
+	if (!add_file_contigs(graph, (uint32_t *) (base + header->section_offsets[BCG_SECTION_CONTIG_ROOTS]),
+	                      base + header->section_offsets[BCG_SECTION_CONTIG_NAMES],
+	                      header->section_sizes[BCG_SECTION_CONTIG_NAMES], header->contigs_len)) {
+		printf("Failed to read graph file %s\n", filepath);
+		delete graph;
+		return NULL;
+	}
+
+	// The path is mapped as written by ToFile, so neither a topological sort nor a copy is needed.
+	// Its contig ranges are copied, as they are only a few words.
+	graph->reference_path = (uint32_t *) (base + header->section_offsets[BCG_SECTION_REFERENCE_PATH]);
+	graph->reference_offsets = (uint64_t *) (base + header->section_offsets[BCG_SECTION_REFERENCE_OFFSETS]);
+	graph->reference_path_len = header->reference_path_len;
+	graph->reference_ranges_len = (header->contigs_len > 0) ? header->contigs_len : 1;
+	graph->reference_range_starts = (uint32_t *) malloc(header->section_sizes[BCG_SECTION_REFERENCE_RANGE_STARTS]);
+	memcpy(graph->reference_range_starts, base + header->section_offsets[BCG_SECTION_REFERENCE_RANGE_STARTS],
+	       header->section_sizes[BCG_SECTION_REFERENCE_RANGE_STARTS]);
+	graph->reference_path_mapped = true;
+	graph->reference_path_built = true;
+
+	return graph;
+}
+
+// Copies every array of a mapped graph to the heap, so it can be resized and freed.
+void Graph::EnsureOwned() {
+	if (mapped_data == NULL) return;
+
+	struct node *owned_nodes = (struct node *) malloc(sizeof(struct node) * nodes_cap);
+	memcpy(owned_nodes, nodes, sizeof(struct node) * nodes_len);
+	uint32_t *owned_reference_indices = (uint32_t *) malloc(sizeof(uint32_t) * nodes_cap);
+	memcpy(owned_reference_indices, reference_indices, sizeof(uint32_t) * nodes_len);
+	uint32_t *owned_edges_offsets = (uint32_t *) malloc(sizeof(uint32_t) * (csr_nodes_len + 1));
+	memcpy(owned_edges_offsets, edges_offsets, sizeof(uint32_t) * (csr_nodes_len + 1));
+	uint32_t *owned_edges = (uint32_t *) malloc(sizeof(uint32_t) * edges_len);
+	memcpy(owned_edges, edges, sizeof(uint32_t) * edges_len);
+	uint32_t *owned_edges_in_offsets = (uint32_t *) malloc(sizeof(uint32_t) * (csr_nodes_len + 1));
+	memcpy(owned_edges_in_offsets, edges_in_offsets, sizeof(uint32_t) * (csr_nodes_len + 1));
+	uint32_t *owned_edges_in = (uint32_t *) malloc(sizeof(uint32_t) * edges_len);
+	memcpy(owned_edges_in, edges_in, sizeof(uint32_t) * edges_len);
+	uint64_t *owned_sequences = (uint64_t *) malloc(sizeof(uint64_t) * sequences_cap);
+	memcpy(owned_sequences, sequences, sizeof(uint64_t) * sequences_cap);
+	if (reference_path_mapped) {
+		uint32_t *owned_reference_path = (uint32_t *) malloc(sizeof(uint32_t) * (reference_path_len + 1));
+		memcpy(owned_reference_path, reference_path, sizeof(uint32_t) * reference_path_len);
+		uint64_t *owned_reference_offsets = (uint64_t *) malloc(sizeof(uint64_t) * (reference_path_len + 1));
+		memcpy(owned_reference_offsets, reference_offsets, sizeof(uint64_t) * (reference_path_len + 1));
+		reference_path = owned_reference_path;
+		reference_offsets = owned_reference_offsets;
+		reference_path_mapped = false;
+	}
+
+	ReleaseMapping();
+
+	nodes = owned_nodes;
+	reference_indices = owned_reference_indices;
+	edges_offsets = owned_edges_offsets;
+	edges = owned_edges;
+	edges_in_offsets = owned_edges_in_offsets;
+	edges_in = owned_edges_in;
+	sequences = owned_sequences;
+}
+
+void Graph::ReleaseMapping() {
+	munmap(mapped_data, mapped_len);
+	mapped_data = NULL;
+	mapped_len = 0;
+}
+
+// Writes a section padded to the next page boundary and records its location in the header.
+static void write_section(FILE *f, struct bcg_header *header, uint8_t section, const void *data, uint64_t size) {
+	static const char padding[BCG_PAGE_SIZE] = {0};
+	uint64_t offset = ftell(f);
+	header->section_offsets[section] = offset;
+	header->section_sizes[section] = size;
+	if (size > 0) fwrite(data, 1, size, f);
+	uint64_t padding_len = (BCG_PAGE_SIZE - (offset + size) % BCG_PAGE_SIZE) % BCG_PAGE_SIZE;
+	fwrite(padding, 1, padding_len, f);
+}
+
 void Graph::ToFile(char *filepath) {
+	Finalize();
+
 	FILE *f = fopen(filepath, "wb");
+	if (f == NULL) {
+		printf("Failed to open graph file %s for writing\n", filepath);
+		return;
+	}
 
-	// Indicator for file format
-	fwrite(BCG_FORMAT_CODE, sizeof(char), strlen(BCG_FORMAT_CODE), f);
+	struct bcg_header header;
+	memset(&header, 0, sizeof(struct bcg_header));
+	memcpy(header.format_code, BCG_FORMAT_CODE, strlen(BCG_FORMAT_CODE));
+	header.version = BCG_FORMAT_VERSION;
+	memcpy(header.encoding, encoding, sizeof(char) * 4);
+	header.node_size = sizeof(struct node);
+	header.nodes_len = nodes_len;
+	header.edges_len = edges_len;
+	header.sequences_len = sequences_len;
+	header.reference_path_len = reference_path_len;
+	header.contigs_len = contigs_len;
+
+	// The header is rewritten once all section locations are known
+	char header_page[BCG_PAGE_SIZE] = {0};
+	fwrite(header_page, 1, BCG_PAGE_SIZE, f);
+
+	// Sequences are followed by the padding word GetSequence relies on
+	uint64_t sequence_words = (sequences_len + 31) / 32 + 1;
+	uint64_t padding_word = 0;
+
+	write_section(f, &header, BCG_SECTION_NODES, nodes, sizeof(struct node) * nodes_len);
+	write_section(f, &header, BCG_SECTION_REFERENCE_INDICES, reference_indices, sizeof(uint32_t) * nodes_len);
+	write_section(f, &header, BCG_SECTION_EDGES_OFFSETS, edges_offsets, sizeof(uint32_t) * (nodes_len + 1));
+	write_section(f, &header, BCG_SECTION_EDGES, edges, sizeof(uint32_t) * edges_len);
+	write_section(f, &header, BCG_SECTION_EDGES_IN_OFFSETS, edges_in_offsets, sizeof(uint32_t) * (nodes_len + 1));
+	write_section(f, &header, BCG_SECTION_EDGES_IN, edges_in, sizeof(uint32_t) * edges_len);
+	write_section(f, &header, BCG_SECTION_SEQUENCES,
+	              (sequences != NULL) ? (void *) sequences : (void *) &padding_word,
+	              sizeof(uint64_t) * ((sequences != NULL) ? sequence_words : 1));
+	write_section(f, &header, BCG_SECTION_REFERENCE_PATH, reference_path, sizeof(uint32_t) * reference_path_len);
+	write_section(f, &header, BCG_SECTION_REFERENCE_OFFSETS, reference_offsets, sizeof(uint64_t) * (reference_path_len + 1));
+	write_section(f, &header, BCG_SECTION_REFERENCE_RANGE_STARTS, reference_range_starts, sizeof(uint32_t) * (reference_ranges_len + 1));
+	write_section(f, &header, BCG_SECTION_CONTIG_ROOTS, contig_roots, sizeof(uint32_t) * contigs_len);
+	uint64_t names_len = 0;
+	for (uint32_t i = 0; i < contigs_len; i++) names_len += strlen(contig_names[i]) + 1;
+	char *names = (char *) malloc(names_len + 1);
+	uint64_t names_pos = 0;
+	for (uint32_t i = 0; i < contigs_len; i++) {
+		uint64_t name_len = strlen(contig_names[i]) + 1;
+		memcpy(names + names_pos, contig_names[i], name_len);
+		names_pos += name_len;
+	}
+	write_section(f, &header, BCG_SECTION_CONTIG_NAMES, names, names_len);
+	free(names);
 
-	// Format version number
-	fputc(1, f);
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, sizeof(struct bcg_header), 1, f);
 
-	// Encoding
-	fwrite(encoding, sizeof(char), 4, f);
+	fclose(f);
+}
 
-	// Write graph info (currently only number of nodes)
-	fwrite(&(nodes_len), sizeof(uint32_t), 1, f);
+// Output of ToGFAFile is collected in a buffer of this size and written in large blocks
+#define GFA_WRITE_BUFFER_SIZE (4 << 20)
 
-	// Write all nodes
-	for (uint32_t i = 0; i < nodes_len; i++) {
-		struct node *n = (nodes + i);
-		fwrite(&(n->length), sizeof(uint32_t), 1, f);
-		fwrite(&(n->sequences_len), sizeof(uint32_t), 1, f);
-		fwrite(n->sequences, sizeof(uint64_t), n->sequences_len, f);
-		uint8_t edges_len = n->edges_len;
-		fwrite(&edges_len, sizeof(uint8_t), 1, f);
-		fwrite(n->edges, sizeof(uint32_t), n->edges_len, f);
-		uint8_t reference = n->reference;
-		fwrite(&reference, sizeof(uint8_t), 1, f);
+struct gfa_writer {
+	FILE *f;
+	char *buffer;
+	uint64_t len;
+};
+
+static void gfa_flush(struct gfa_writer *writer) {
+	fwrite(writer->buffer, 1, writer->len, writer->f);
+	writer->len = 0;
+}
+
+// Returns where the next count bytes go, flushing first if they do not fit
+static char *gfa_reserve(struct gfa_writer *writer, uint64_t count) {
+	if (writer->len + count > GFA_WRITE_BUFFER_SIZE) gfa_flush(writer);
+	return writer->buffer + writer->len;
+}
+
+static void gfa_write(struct gfa_writer *writer, const char *str, uint64_t len) {
+	memcpy(gfa_reserve(writer, len), str, len);
+	writer->len += len;
+}
+
+// Node IDs are written 1-based, as most GFA tools expect
+static void gfa_write_node_name(struct gfa_writer *writer, uint32_t node_id) {
+	char digits[10];
+	uint8_t digits_len = 0;
+	uint64_t name = (uint64_t) node_id + 1;
+	do {
+		digits[digits_len++] = '0' + (name % 10);
+		name /= 10;
+	} while (name > 0);
+	char *out = gfa_reserve(writer, digits_len);
+	for (uint8_t i = 0; i < digits_len; i++) out[i] = digits[digits_len - 1 - i];
+	writer->len += digits_len;
+}
+
+void Graph::ToGFAFile(char *filepath) {
+	Finalize();
+
+	FILE *f = fopen(filepath, "wb");
+	if (f == NULL) {
+		printf("Failed to open GFA file %s for writing\n", filepath);
+		return;
+	}
+
+	// Every byte of a packed word decodes to four bases
+	char decode_table[256][4];
+	for (uint32_t byte = 0; byte < 256; byte++) {
+		for (uint8_t i = 0; i < 4; i++) {
+			decode_table[byte][i] = encoding[(byte >> (6 - i * 2)) & 3];
+		}
+	}
+
+	struct gfa_writer writer;
+	writer.f = f;
+	writer.buffer = (char *) malloc(GFA_WRITE_BUFFER_SIZE);
+	writer.len = 0;
+
+	gfa_write(&writer, "H\tVN:Z:1.0\n", 11);
+
+	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
+		struct node *node = (nodes + node_id);
+		gfa_write(&writer, "S\t", 2);
+		gfa_write_node_name(&writer, node_id);
+		gfa_write(&writer, "\t", 1);
+		if (node->length == 0) gfa_write(&writer, "*", 1);
+		for (uint32_t word = 0; word < GetSequenceWordCount(node); word++) {
+			uint64_t packed = GetSequence(node, word);
+			uint32_t remaining = node->length - word * 32;
+			char *out = gfa_reserve(&writer, 32);
+			for (uint8_t i = 0; i < 8; i++) {
+				memcpy(out + i * 4, decode_table[(packed >> (56 - i * 8)) & 0xFF], 4);
+			}
+			writer.len += (remaining < 32) ? remaining : 32;
+		}
+		gfa_write(&writer, "\n", 1);
+	}
+
+	for (uint32_t node_id = 0; node_id < nodes_len; node_id++) {
+		for (uint32_t i = 0; i < GetEdgesLen(node_id); i++) {
+			gfa_write(&writer, "L\t", 2);
+			gfa_write_node_name(&writer, node_id);
+			gfa_write(&writer, "\t+\t", 3);
+			gfa_write_node_name(&writer, GetEdges(node_id)[i]);
+			gfa_write(&writer, "\t+\t0M\n", 6);
+		}
+	}
+
+	// One path per contig, named after it, or a single reference path for graphs without contigs
+	for (uint32_t range = 0; range < reference_ranges_len; range++) {
+		uint32_t start = reference_range_starts[range];
+		uint32_t end = reference_range_starts[range + 1];
+		if (start == end) continue;
+		const char *name = (contigs_len > 0) ? GetContigName(range) : "reference";
+		gfa_write(&writer, "P\t", 2);
+		gfa_write(&writer, name, strlen(name));
+		gfa_write(&writer, "\t", 1);
+		for (uint32_t i = start; i < end; i++) {
+			if (i > start) gfa_write(&writer, ",", 1);
+			gfa_write_node_name(&writer, reference_path[i]);
+			gfa_write(&writer, "+", 1);
+		}
+		gfa_write(&writer, "\t*\n", 3);
 	}
 
+	gfa_flush(&writer);
+	free(writer.buffer);
 	fclose(f);
 }
 
@@ -12,71 +12,224 @@
 #include "hashing.hpp"
 
 #define BCG_FORMAT_CODE "BIOCYGRAPH"
+#define BCG_FORMAT_VERSION 2
+#define BCG_PAGE_SIZE 4096
+
+// Compress() only starts another thread for every this many nodes
+#define COMPRESS_MIN_NODES_PER_THREAD 65536
+
+// Sections of a graph file, each starting on a page boundary
+enum bcg_section {
+	BCG_SECTION_NODES,
+	BCG_SECTION_REFERENCE_INDICES,
+	BCG_SECTION_EDGES_OFFSETS,
+	BCG_SECTION_EDGES,
+	BCG_SECTION_EDGES_IN_OFFSETS,
+	BCG_SECTION_EDGES_IN,
+	BCG_SECTION_SEQUENCES,
+	BCG_SECTION_REFERENCE_PATH,
+	BCG_SECTION_REFERENCE_OFFSETS,
+	BCG_SECTION_REFERENCE_RANGE_STARTS,
+	BCG_SECTION_CONTIG_ROOTS,
+	// Contig names, each followed by a null character
+	BCG_SECTION_CONTIG_NAMES,
+	BCG_SECTION_COUNT
+};
+
+// Header in the first page of a graph file.
+// Sections are stored exactly as they are laid out in memory, so the file can be mapped without parsing.
+struct bcg_header {
+	char format_code[10];
+	uint8_t version;
+	char encoding[4];
+	uint8_t node_size;
+	uint32_t nodes_len;
+	uint32_t edges_len;
+	uint64_t sequences_len;
+	uint32_t reference_path_len;
+	uint32_t contigs_len;
+	uint64_t section_offsets[BCG_SECTION_COUNT];
+	uint64_t section_sizes[BCG_SECTION_COUNT];
+};
 
 class Graph {
 public:
+	// The node table is split by access pattern. Traversals read nodes, while colder
+	// per-node data lives in parallel arrays indexed by node ID.
 	struct node *nodes;
+	uint32_t *reference_indices;
 	uint32_t nodes_len;
 	char encoding[4];
 	uint8_t encoding_map[256];	
-	
+
+	// Compressed sparse row adjacency, built by Finalize().
+	// The out-edges of node i are edges[edges_offsets[i]] up to edges[edges_offsets[i + 1]],
+	// and the in-edges are laid out the same way in edges_in and edges_in_offsets.
+	uint32_t *edges_offsets;
+	uint32_t *edges;
+	uint32_t *edges_in_offsets;
+	uint32_t *edges_in;
+	uint32_t edges_len;
+
+	// Sequence arena holding the 2-bit encoded bases of every node longer than NODE_INLINE_BASES
+	// back to back, starting from the most significant bits of each word.
+	// The bases of such a node start at base number node->sequence_offset.
+	uint64_t *sequences;
+	uint64_t sequences_len;
+
+	// Contigs of a graph built from a whole genome, each a component of its own starting at its root node.
+	uint32_t contigs_len;
+	uint32_t *contig_roots;
+	char **contig_names;
+
+private:
+	// Number of nodes allocated in the node array
+	uint32_t nodes_cap;
+	// Edges added since the last Finalize(), stored as (from, to) pairs
+	uint32_t *pending_edges;
+	uint32_t pending_edges_len;
+	uint32_t pending_edges_cap;
+	// Number of nodes covered by the CSR arrays
+	uint32_t csr_nodes_len;
+	// Number of words allocated for the sequence arena
+	uint64_t sequences_cap;
+	// Reference nodes in path order, and the linear reference coordinate each of them starts at,
+	// built by Finalize() and dropped whenever nodes or edges change.
+	// The path of every contig is a range of its own, starting at reference_range_starts[contig].
+	uint32_t *reference_path;
+	uint64_t *reference_offsets;
+	uint32_t reference_path_len;
+	uint32_t *reference_range_starts;
+	uint32_t reference_ranges_len;
+	bool reference_path_built;
+	// The path and its offsets point into the file mapping, as written by ToFile
+	bool reference_path_mapped;
+	// File mapping backing the arrays of a graph loaded with FromFile, or NULL if they are heap allocated
+	void *mapped_data;
+	uint64_t mapped_len;
+
+public:
 	Graph(const char *encoding) {
 		nodes = NULL;
+		reference_indices = NULL;
 		nodes_len = 0;
+		nodes_cap = 0;
+		edges_offsets = NULL;
+		edges = NULL;
+		edges_in_offsets = NULL;
+		edges_in = NULL;
+		edges_len = 0;
+		pending_edges = NULL;
+		pending_edges_len = 0;
+		pending_edges_cap = 0;
+		csr_nodes_len = 0;
+		sequences = NULL;
+		sequences_len = 0;
+		sequences_cap = 0;
+		reference_path = NULL;
+		reference_offsets = NULL;
+		reference_path_len = 0;
+		reference_range_starts = NULL;
+		reference_ranges_len = 0;
+		reference_path_built = false;
+		reference_path_mapped = false;
+		mapped_data = NULL;
+		mapped_len = 0;
+		contigs_len = 0;
+		contig_roots = NULL;
+		contig_names = NULL;
 		this->SetEncoding(encoding);
 	}
 
 	~Graph() {
-		if (nodes != nullptr) {
-			for (uint32_t i = 0; i < nodes_len; i++) {
-				free((nodes + i)->sequences);
-				free((nodes + i)->edges);
-				free((nodes + i)->edges_in);
-			}
+		free(pending_edges);
+		ClearReferencePath();
+		for (uint32_t i = 0; i < contigs_len; i++) free(contig_names[i]);
+		free(contig_names);
+		free(contig_roots);
+		if (mapped_data != NULL) {
+			ReleaseMapping();
+			return;
 		}
 		free(nodes);
+		free(reference_indices);
+		free(sequences);
+		free(edges_offsets);
+		free(edges);
+		free(edges_in_offsets);
+		free(edges_in);
 	}
 	
+	// Maps graph files into memory, copying them to the heap on the first modification
 	static Graph *FromFile(char *filepath);
+	// Reads the file into heap memory, for graphs that will be modified after loading
+	static Graph *FromFileUnmapped(char *filepath);
+	static bool ReadFileHeader(char *filepath, struct bcg_header *header);
 	static Graph *FromGFAFile(char *filepath);
-	static Graph *FromGFAFileEncoded(char *filepath, const char *encoding);
+	// Parses the file on thread_count threads, or picks a count from the file size if it is 0
+	static Graph *FromGFAFileEncoded(char *filepath, const char *encoding, uint32_t thread_count = 0);
 	static Graph *FromFastaVCF(char *fasta_filepath, char *vcf_filepath, int16_t chromosome);
-	static Graph *FromFastaVCFEncoded(char *fasta_filepath, char *vcf_filepath, int16_t chromosome, const char *encoding);
+	// A chromosome of -1 builds every contig of the FASTA, on thread_count threads or all hardware threads if it is 0.
+	// Other chromosomes are matched by the leading digits of contig names, so chrX or MT are all chromosome 0.
+	static Graph *FromFastaVCFEncoded(char *fasta_filepath, char *vcf_filepath, int16_t chromosome, const char *encoding, uint32_t thread_count = 0);
+	// Builds the contig with exactly this name in the FASTA and the VCF
+	static Graph *FromFastaVCFContig(char *fasta_filepath, char *vcf_filepath, const char *contig, const char *encoding);
+	// Parses the VCF and reads the reference on threads of their own while the graph is built, so the VCF is
+	// never held in memory whole. Records must be sorted by position, unsorted ones are skipped as overlapping.
+	static Graph *FromFastaVCFPipelined(char *fasta_filepath, char *vcf_filepath, int16_t chromosome, const char *encoding);
+	static Graph *FromFastaVCFContigPipelined(char *fasta_filepath, char *vcf_filepath, const char *contig, const char *encoding);
+	static Graph *FromFastaVCFGenome(char *fasta_filepath, char *vcf_filepath, const char *encoding, uint32_t thread_count = 0);
 
 	struct node *Get(uint32_t node_id) {
 		return nodes + node_id;
 	}
 
-	void Compress();
+	uint32_t *Compress(uint32_t thread_count = 0);
 	uint32_t AddEmptyNodes();
 
-	void AddInEdges() {
-		struct node *nodes_end = nodes + nodes_len;
-		struct node *n;
-		uint8_t edge_index;
-		for (n = nodes; n < nodes_end; n++) {
-			if (n->edges_in) free(n->edges_in);
-			n->edges_in_len = 0;
-		}
-		for (n = nodes; n < nodes_end; n++) {
-			for (edge_index = 0; edge_index < n->edges_len; edge_index++) {
-				(nodes + n->edges[edge_index])->edges_in_len++;
-			}
-		}
-		for (n = nodes; n < nodes_end; n++) {
-			n->edges_in = (uint32_t *) malloc(sizeof(uint32_t) * n->edges_in_len);
-			n->edges_in_len = 0;
-		}
-		for (uint32_t i = 0; i < nodes_len; i++) {
-			n = nodes + i;
-			for (edge_index = 0; edge_index < n->edges_len; edge_index++) {
-				struct node *in_node = nodes + n->edges[edge_index];
-				in_node->edges_in[in_node->edges_in_len++] = i;
-			}
-		}
+	// Merges edges added with AddEdge into the CSR arrays, rebuilds the in-edges and builds the reference path.
+	// Must be called before traversing a graph that has been modified.
+	void Finalize();
+
+	uint32_t *GetEdges(uint32_t node_id) {
+		return edges + edges_offsets[node_id];
+	}
+	uint32_t GetEdgesLen(uint32_t node_id) {
+		return edges_offsets[node_id + 1] - edges_offsets[node_id];
 	}
+	uint32_t *GetEdgesIn(uint32_t node_id) {
+		return edges_in + edges_in_offsets[node_id];
+	}
+	uint32_t GetEdgesInLen(uint32_t node_id) {
+		return edges_in_offsets[node_id + 1] - edges_in_offsets[node_id];
+	}
+
+	// Returns bases index * 32 to index * 32 + 31 of the node, left-aligned.
+	// Bits past the end of the node are zero.
+	uint64_t GetSequence(struct node *node, uint32_t index) {
+		if (node->length <= NODE_INLINE_BASES) return node->sequence;
+		uint64_t bit = (node->sequence_offset + (uint64_t) index * 32) * 2;
+		uint64_t *word = sequences + (bit >> 6);
+		uint8_t shift = bit & 63;
+		uint64_t sequence = word[0] << shift;
+		if (shift != 0) sequence |= word[1] >> (64 - shift);
+		uint32_t remaining = node->length - index * 32;
+		if (remaining < 32) sequence &= ~(~0ULL >> (remaining * 2));
+		return sequence;
+	}
+	uint32_t GetSequenceWordCount(struct node *node) {
+		return (node->length + 31) / 32;
+	}
+
+	uint64_t AppendSequence(const char *sequence, uint32_t length);
+	uint64_t AppendPackedSequence(uint64_t packed, uint8_t length);
 
 	void ToFile(char *filepath);
+	// Writes S and L lines for all nodes and edges, and a P line for the reference path of every contig
+	void ToGFAFile(char *filepath);
+	bool IsMapped() {
+		return mapped_data != NULL;
+	}
 
 	uint64_t HashMinKmer(const char *str, uint8_t k) {
 		return hash_min_kmer_by_map(str, k, encoding_map);
@@ -92,18 +245,102 @@ public:
 
 	uint32_t GetRootNodeID();
 	uint32_t GetLastNodeID();
+	uint32_t GetNodeLength(uint32_t node_id) {
+		return (nodes + node_id)->length;
+	}
+	bool IsReference(uint32_t node_id) {
+		return (nodes + node_id)->reference;
+	}
+	void SetReference(uint32_t node_id, bool reference) {
+		EnsureOwned();
+		ClearReferencePath();
+		(nodes + node_id)->reference = reference;
+	}
+	uint32_t GetReferenceIndex(uint32_t node_id) {
+		return reference_indices[node_id];
+	}
+	void SetReferenceIndex(uint32_t node_id, uint32_t reference_index) {
+		EnsureOwned();
+		reference_indices[node_id] = reference_index;
+	}
+	void SetNodeSequence(uint32_t node_id, const char *sequence, uint32_t length);
+	// Sets up to NODE_INLINE_BASES bases, packed and left-aligned
+	void SetNodePackedSequence(uint32_t node_id, uint64_t packed, uint32_t length) {
+		EnsureOwned();
+		if (length < 32) packed &= ~(~0ULL >> (length * 2));
+		(nodes + node_id)->sequence = (length > 0) ? packed : 0;
+		(nodes + node_id)->length = length;
+	}
+	// Points a node longer than NODE_INLINE_BASES at bases already appended to the arena
+	void SetNodeSequenceOffset(uint32_t node_id, uint64_t sequence_offset, uint32_t length) {
+		EnsureOwned();
+		(nodes + node_id)->sequence_offset = sequence_offset;
+		(nodes + node_id)->length = length;
+	}
+
+	uint32_t *GetTopologicalOrder();
+	uint32_t *RenumberNodes();
+
+	// Orders the reference nodes along the reference path and renumbers their reference_index to match.
+	// Contigs each get a path of their own, numbered after the paths of the contigs before them.
+	// Called by Finalize(), but nodes flagged as reference directly through the node array after that
+	// require an explicit call. The lookups below only read the path, so they are safe to call from many threads.
+	void BuildReferencePath();
+	uint32_t GetReferencePathLen() {
+		return reference_path_len;
+	}
+	uint64_t GetReferenceLength() {
+		return reference_path_built ? reference_offsets[reference_path_len] : 0;
+	}
 	uint32_t GetReferenceNodeID(uint32_t reference_index);
+	// Neighbours on the path of the same contig
 	uint32_t GetNextReferenceNodeID(uint32_t previous_id);
+	uint32_t GetPreviousReferenceNodeID(uint32_t next_id);
+	uint64_t GetReferenceOffset(uint32_t node_id);
+	// Finds the reference node covering a linear reference coordinate of a contig, and the offset into it
+	bool FindReferencePosition(uint64_t position, uint32_t *node_id, uint32_t *offset, uint32_t contig = 0);
+
+	// Capacity hints for graphs built node by node; every array still grows geometrically past them
+	void ReserveNodes(uint32_t count);
+	void ReserveEdges(uint32_t count);
+	void ReserveSequences(uint64_t bases);
 
 	uint32_t AddNode(const char *sequence);
+	uint32_t AddNode(const char *sequence, uint32_t length);
+	// Adds a node from bases already packed like the sequence arena, 32 to a word
+	uint32_t AddPackedNode(const uint64_t *packed, uint32_t length);
 	void AddEdge(uint32_t from_node_id, uint32_t to_node_id);
 	uint32_t AppendEmptyNode();
+	// Appends count empty nodes and returns the ID of the first
+	uint32_t AppendEmptyNodes(uint32_t count);
+	// Appends the nodes, bases and edges of a graph with the same encoding, and returns the ID its first node got
+	uint32_t AppendGraph(Graph *other);
+	void AddContig(const char *name, uint32_t root_node_id);
+	uint32_t GetContigRootNodeID(uint32_t contig) {
+		return contig_roots[contig];
+	}
+	const char *GetContigName(uint32_t contig) {
+		return contig_names[contig];
+	}
 
 private:
 	void SetEncoding(const char *encoding);
+	void BuildInEdges();
 	static std::tuple<uint32_t, uint32_t> GFAGetNodeIDRange(FILE *f);
+	static Graph *FromFileWithMode(char *filepath, bool map);
+	static Graph *FromFileVersion1(FILE *f, const char *encoding);
+	static Graph *ReadFileSections(char *filepath);
+	static Graph *MapFileSections(char *filepath);
+	static bool IsValidFileHeader(struct bcg_header *header, uint64_t file_len, char *filepath);
+	void FinalizeEdges();
+	void EnsureOwned();
+	void ReleaseMapping();
+	void ClearReferencePath();
+	uint32_t GetReferenceRange(uint32_t reference_index);
+	uint32_t *FindNodeContigs();
+	void RemapContigRoots(uint32_t *id_map);
 
-	uint32_t *CreateCompressedIDMap(uint32_t *return_compressed_node_count);
+	uint32_t FindChainHeads(uint64_t *chain_heads, uint32_t *thread_heads, uint32_t thread_count);
 	uint32_t GetRequiredEmptyNodeCount();
 	uint32_t GetRequiredEmptyNodesFromNode(uint32_t from_node_id);
 	bool NodeHasEdge(uint32_t node_id, uint32_t edge_id);
@@ -0,0 +1,41 @@
+#include "GraphBuilder.hpp"
+
+void GraphBuilder::Reserve(uint32_t nodes, uint32_t edges, uint64_t bases) {
+	graph->ReserveNodes(nodes);
+	graph->ReserveEdges(edges);
+	graph->ReserveSequences(bases);
+}
+
+uint32_t GraphBuilder::AddNode(const char *sequence, uint32_t length) {
+	return graph->AddNode(sequence, length);
+}
+
+uint32_t GraphBuilder::AddReferenceNode(const char *sequence, uint32_t length) {
+	uint32_t node_id = graph->AddNode(sequence, length);
+	graph->SetReference(node_id, true);
+	graph->SetReferenceIndex(node_id, reference_index++);
+	return node_id;
+}
+
+uint32_t GraphBuilder::AddPackedNode(const uint64_t *packed, uint32_t length) {
+	return graph->AddPackedNode(packed, length);
+}
+
+uint32_t GraphBuilder::AddPackedReferenceNode(const uint64_t *packed, uint32_t length) {
+	uint32_t node_id = graph->AddPackedNode(packed, length);
+	graph->SetReference(node_id, true);
+	graph->SetReferenceIndex(node_id, reference_index++);
+	return node_id;
+}
+
+void GraphBuilder::AddEdge(uint32_t from_node_id, uint32_t to_node_id) {
+	graph->AddEdge(from_node_id, to_node_id);
+}
+
+Graph *GraphBuilder::Build() {
+	Graph *built = graph;
+	built->Finalize();
+	graph = new Graph(built->encoding);
+	reference_index = 0;
+	return built;
+}
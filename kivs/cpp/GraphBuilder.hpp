@@ -0,0 +1,43 @@
+#ifndef KIVS_GRAPH_BUILDER_H
+#define KIVS_GRAPH_BUILDER_H
+
+#include <stdint.h>
+
+#include "Graph.hpp"
+
+// Builds a Graph node by node. Nodes, bases and edges are appended to geometrically growing
+// buffers, and the edge list is turned into the graph's CSR arrays in a single pass by Build().
+class GraphBuilder {
+private:
+	Graph *graph;
+	uint32_t reference_index;
+
+public:
+	GraphBuilder(const char *encoding) {
+		graph = new Graph(encoding);
+		reference_index = 0;
+	}
+
+	~GraphBuilder() {
+		delete graph;
+	}
+
+	void Reserve(uint32_t nodes, uint32_t edges, uint64_t bases);
+
+	uint32_t AddNode(const char *sequence, uint32_t length);
+	// Adds a node on the reference path, numbered after the previous reference node
+	uint32_t AddReferenceNode(const char *sequence, uint32_t length);
+	uint32_t AddPackedNode(const uint64_t *packed, uint32_t length);
+	uint32_t AddPackedReferenceNode(const uint64_t *packed, uint32_t length);
+	void AddEdge(uint32_t from_node_id, uint32_t to_node_id);
+
+	uint32_t GetNodesLen() {
+		return graph->nodes_len;
+	}
+
+	// Finalizes the edges and hands the graph over to the caller. The builder starts an empty graph
+	// with the same encoding, so it can be used again.
+	Graph *Build();
+};
+
+#endif
@@ -10,6 +10,7 @@ uint64_t full_mask = -1L;
 
 KmerFinder::KmerFinder(Graph *graph, uint8_t k, uint8_t max_variant_nodes) : k(k), max_variant_nodes(max_variant_nodes) {
 	this->graph = graph;
+	graph->Finalize();
 	kmer_mask = (1L << (k * 2)) - 1;
 	kmer_buffer_shift = (33 - k) * 2;
 	
@@ -322,8 +323,10 @@ void KmerFinder::FindKmersSpanningNode(uint32_t center_node_id) {
 			break;
 		}
 
-		for (uint8_t i = 0; i < node->edges_in_len; i++) {
-			uint32_t edge_id = node->edges_in[i];
+		uint32_t *edges_in = graph->GetEdgesIn(node_id);
+		uint32_t edges_in_len = graph->GetEdgesInLen(node_id);
+		for (uint32_t i = 0; i < edges_in_len; i++) {
+			uint32_t edge_id = edges_in[i];
 			if (std::find(visited.begin(), visited.end(), edge_id) == visited.end()) {
 				stack.push(edge_id);
 			}
@@ -443,7 +446,8 @@ uint64_t KmerFinder::FindKmersFromNode(uint32_t node_id) {
 	kmer_position_buffer[0] = 0;
 
 	// Store the node's sequence in the buffer
-	kmer_buffer = node->sequences[0];
+	kmer_buffer = graph->GetSequence(node, 0);
+	uint32_t sequences_len = graph->GetSequenceWordCount(node);
 	uint32_t node_len = node->length;
 	uint8_t kmer_len = (k < node_len) ? k : node_len;
 	uint32_t sequence_idx = 1;
@@ -463,16 +467,16 @@ uint64_t KmerFinder::FindKmersFromNode(uint32_t node_id) {
 			start_position++;
 			
 			// If the buffer is full, shift values as much as possible and fill with new values
-			if (kmer_len == 32 && sequence_idx < node->sequences_len) {
+			if (kmer_len == 32 && sequence_idx < sequences_len) {
 				kmer_buffer <<= kmer_buffer_shift;
-				kmer_buffer |= ((node->sequences[sequence_idx] << sequence_pos) >> (64 - kmer_buffer_shift));
+				kmer_buffer |= ((graph->GetSequence(node, sequence_idx) << sequence_pos) >> (64 - kmer_buffer_shift));
 				sequence_pos += kmer_buffer_shift;
 				
 				if (sequence_pos > 64) {
 					sequence_idx++;
-					if (sequence_idx < node->sequences_len) {
+					if (sequence_idx < sequences_len) {
 						sequence_pos -= 64;
-						kmer_buffer |= (node->sequences[sequence_idx] >> (64 - sequence_pos));
+						kmer_buffer |= (graph->GetSequence(node, sequence_idx) >> (64 - sequence_pos));
 					}
 				} else if (sequence_pos == 64) {
 					sequence_idx++;
@@ -492,8 +496,10 @@ uint64_t KmerFinder::FindKmersFromNode(uint32_t node_id) {
 	kmer_len = (kmer_len < k - 1) ? kmer_len : (k - 1);
 
 	// Visit all edges, remembering the current kmer buffer length
-	for (uint8_t i = 0; i < node->edges_len; i++) {
-		local_found_count += FindKmersExtendedByEdge(node->edges[i], kmer_len, 0);
+	uint32_t *edge = graph->edges + graph->edges_offsets[node_id];
+	uint32_t *edges_end = graph->edges + graph->edges_offsets[node_id + 1];
+	for (; edge < edges_end; edge++) {
+		local_found_count += FindKmersExtendedByEdge(*edge, kmer_len, 0);
 	}
 
 	// Count down variant nodes when done with this node
@@ -518,14 +524,15 @@ uint64_t KmerFinder::FindKmersExtendedByEdge(uint32_t node_id, uint8_t kmer_len,
 	kmer_position_buffer[path_buffer_len] = kmer_len + kmer_ext_len;
 	path_buffer_len++;
 
-	if (node->sequences_len != 0) {
+	if (node->length != 0) {
+		uint64_t sequence = graph->GetSequence(node, 0);
 		if (kmer_ext_len == 0) {
 			// First recursion, replace entire buffer
-			kmer_buffer_ext = node->sequences[0];
+			kmer_buffer_ext = sequence;
 		} else {
 			// Update the buffer with the node currently being visited
 			kmer_buffer_ext &= (full_mask << (64 - kmer_ext_len * 2));
-			kmer_buffer_ext |= (node->sequences[0] >> (kmer_ext_len * 2));
+			kmer_buffer_ext |= (sequence >> (kmer_ext_len * 2));
 		}
 		uint64_t kmer_hash;
 		uint32_t node_len = kmer_ext_len + node->length;
@@ -566,8 +573,10 @@ uint64_t KmerFinder::FindKmersExtendedByEdge(uint32_t node_id, uint8_t kmer_len,
 	}
 
 	if (kmer_ext_len < k - 1) {
-		for (uint8_t i = 0; i < node->edges_len; i++) {
-			local_found_count += FindKmersExtendedByEdge(node->edges[i], kmer_len, kmer_ext_len);
+		uint32_t *edge = graph->edges + graph->edges_offsets[node_id];
+		uint32_t *edges_end = graph->edges + graph->edges_offsets[node_id + 1];
+		for (; edge < edges_end; edge++) {
+			local_found_count += FindKmersExtendedByEdge(*edge, kmer_len, kmer_ext_len);
 		}
 	}
 
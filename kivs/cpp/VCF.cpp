@@ -1,35 +1,249 @@
 #include "VCF.hpp"
 #include <iostream>
 
+// The file is read in one pass, decompressing it on the way if it is gzip or BGZF. Only the first five
+// fields of a line are parsed, the rest of it, which holds the samples of multi-sample files, is skipped with memchr.
 VCF *VCF::ReadFile(char *filepath, int16_t chromosome) {
+	return Read(filepath, chromosome, NULL, NULL);
+}
+
+VCF *VCF::ReadRegion(char *filepath, const char *region) {
+	return Read(filepath, -1, region, NULL);
+}
+
+VCF *VCF::ReadContig(char *filepath, const char *contig) {
+	return Read(filepath, -1, NULL, contig);
+}
+
+VCF *VCF::Read(char *filepath, int16_t chromosome, const char *region, const char *contig) {
+	FileStream *stream = FileStream::Open(filepath);
+	if (stream == NULL) {
+		printf("Failed to open VCF file %s\n", filepath);
+		return NULL;
+	}
+
 	VCF *vcf = new VCF(filepath);
-	vcf->source_file = fopen(filepath, "rb");
+	if (region != NULL && !vcf->SetRegion(region)) {
+		printf("Invalid region %s\n", region);
+		delete stream;
+		delete vcf;
+		return NULL;
+	}
+	if (contig != NULL) vcf->region_name = strdup(contig);
 
-	vcf->length = vcf->ReadChromosomeRowCount(chromosome);
+	VCFIndex *index = NULL;
+	if ((chromosome != -1 || vcf->region_name != NULL) && stream->mode == FILE_STREAM_BGZF) {
+		index = VCFIndex::ReadFile(filepath);
+	}
+	if (index != NULL && vcf->FindRanges(stream, index, chromosome)) {
+		for (uint64_t i = 0; i < vcf->ranges_len; i++) {
+			stream->SetRange(vcf->ranges[i].start, vcf->ranges[i].end);
+			vcf->ReadLines(stream, chromosome, UINT64_MAX);
+		}
+	} else {
+		vcf->ReadLines(stream, chromosome, UINT64_MAX);
+	}
 
-	vcf->InitializeArrays();
+	printf("Structural Variants ignored: %lu\n", vcf->ignored);
+	printf("Count: %lu\n", vcf->length);
 
-	vcf->ReadChromosome(chromosome);
-	
-	fclose(vcf->source_file);
+	if (index) delete index;
+	delete stream;
 
 	return vcf;
 }
 
-void VCF::InitializeArrays() {
-	chromosomes = (int16_t *) malloc(sizeof(int16_t) * length);
-	positions   = (uint64_t *) malloc(sizeof(uint64_t) * length);
-	references  = (char **) malloc(sizeof(char *) * length);
-	variants    = (char **) malloc(sizeof(char *) * length);
+VCF *VCF::Open(char *filepath, int16_t chromosome) {
+	return Open(filepath, chromosome, NULL);
+}
+
+VCF *VCF::OpenContig(char *filepath, const char *contig) {
+	return Open(filepath, -1, contig);
+}
 
-	memset(chromosomes, 0, sizeof(int16_t) * length);
-	memset(positions, 0, sizeof(uint64_t) * length);
-	memset(references, 0, sizeof(char *) * length);
-	memset(variants, 0, sizeof(char *) * length);
+VCF *VCF::Open(char *filepath, int16_t chromosome, const char *contig) {
+	FileStream *stream = FileStream::Open(filepath);
+	if (stream == NULL) {
+		printf("Failed to open VCF file %s\n", filepath);
+		return NULL;
+	}
+
+	VCF *vcf = new VCF(filepath);
+	vcf->stream = stream;
+	vcf->batch_chromosome = chromosome;
+	if (contig != NULL) vcf->region_name = strdup(contig);
+	VCFIndex *index = NULL;
+	if ((chromosome != -1 || contig != NULL) && stream->mode == FILE_STREAM_BGZF) {
+		index = VCFIndex::ReadFile(filepath);
+	}
+	if (index != NULL && vcf->FindRanges(stream, index, chromosome)) {
+		// An index without records of the chromosome leaves an empty range to read
+		if (vcf->ranges_len == 0) {
+			stream->SetRange(0, 0);
+		} else {
+			stream->SetRange(vcf->ranges[0].start, vcf->ranges[0].end);
+			vcf->next_range = 1;
+		}
+	}
+	if (index) delete index;
+	return vcf;
 }
 
-bool is_structural_variant(char *ref, uint16_t ref_len, char *var, uint16_t var_len) {
-	for (uint16_t i = 0; i < ref_len; i++) {
+VCF *VCF::NextBatch(uint64_t batch_len) {
+	if (stream == NULL) return NULL;
+	while (length < batch_len) {
+		if (ReadLines(stream, batch_chromosome, batch_len)) break;
+		if (next_range >= ranges_len) break;
+		stream->SetRange(ranges[next_range].start, ranges[next_range].end);
+		next_range++;
+	}
+	if (length == 0) return NULL;
+
+	// The arrays are handed over whole, and grown again from nothing for the next batch
+	VCF *batch = new VCF(filepath);
+	batch->length = length;
+	batch->capacity = capacity;
+	batch->chromosomes = chromosomes;
+	batch->contig_ids = contig_ids;
+	batch->positions = positions;
+	batch->alleles = alleles;
+	batch->alleles_len = alleles_len;
+	batch->alleles_cap = alleles_cap;
+	batch->reference_offsets = reference_offsets;
+	batch->reference_lengths = reference_lengths;
+	batch->variant_starts = variant_starts;
+	batch->variant_counts = variant_counts;
+	batch->variant_offsets = variant_offsets;
+	batch->variant_lengths = variant_lengths;
+	batch->variants_len = variants_len;
+	batch->variants_cap = variants_cap;
+
+	length = 0;
+	capacity = 0;
+	chromosomes = NULL;
+	contig_ids = NULL;
+	positions = NULL;
+	alleles = NULL;
+	alleles_len = 0;
+	alleles_cap = 0;
+	reference_offsets = NULL;
+	reference_lengths = NULL;
+	variant_starts = NULL;
+	variant_counts = NULL;
+	variant_offsets = NULL;
+	variant_lengths = NULL;
+	variants_len = 0;
+	variants_cap = 0;
+	return batch;
+}
+
+// Chromosomes are numbered by the leading digits of their name
+static int16_t parse_chromosome(const char *name, uint64_t name_len) {
+	int16_t chromosome = 0;
+	for (uint64_t i = 0; i < name_len && name[i] >= '0' && name[i] <= '9'; i++) {
+		chromosome = chromosome * 10 + (name[i] - '0');
+	}
+	return chromosome;
+}
+
+static bool parse_region_position(const char *str, const char *end, uint64_t *position) {
+	*position = 0;
+	bool digits = false;
+	for (; str < end; str++) {
+		if (*str == ',') continue;
+		if (*str < '0' || *str > '9') return false;
+		*position = *position * 10 + (*str - '0');
+		digits = true;
+	}
+	return digits;
+}
+
+bool VCF::SetRegion(const char *region) {
+	uint64_t region_len = strlen(region);
+	uint64_t name_len = region_len;
+	region_start = 1;
+	region_end = UINT64_MAX;
+
+	// Contig names may hold colons themselves, so only a colon followed by positions starts the range
+	const char *colon = strrchr(region, ':');
+	if (colon != NULL) {
+		const char *end = region + region_len;
+		const char *dash = (const char *) memchr(colon, '-', end - colon);
+		uint64_t start, last;
+		if (parse_region_position(colon + 1, (dash == NULL) ? end : dash, &start) &&
+		    (dash == NULL || dash + 1 == end || parse_region_position(dash + 1, end, &last))) {
+			region_start = start;
+			if (dash != NULL && dash + 1 != end) region_end = last;
+			name_len = colon - region;
+		}
+	}
+	if (name_len == 0 || region_start == 0 || region_end < region_start) return false;
+
+	region_name = (char *) malloc(sizeof(char) * (name_len + 1));
+	memcpy(region_name, region, name_len);
+	region_name[name_len] = '\0';
+	return true;
+}
+
+static int compare_chunks(const void *a, const void *b) {
+	uint64_t start_a = ((const struct vcf_index_chunk *) a)->start;
+	uint64_t start_b = ((const struct vcf_index_chunk *) b)->start;
+	return (start_a > start_b) - (start_a < start_b);
+}
+
+// Finds the chunks of the file the index lists for the chromosome or region, merged into ranges.
+// Returns false, leaving no ranges, if the index does not fit the file.
+bool VCF::FindRanges(FileStream *stream, VCFIndex *index, int16_t chromosome) {
+	struct vcf_index_chunk *chunks = NULL;
+	uint64_t chunks_cap = 0;
+	uint64_t chunks_len = 0;
+	for (uint32_t i = 0; i < index->contigs_len; i++) {
+		const char *name = index->contigs[i].name;
+		bool selected = (region_name != NULL) ? (strcmp(name, region_name) == 0) : (parse_chromosome(name, strlen(name)) == chromosome);
+		if (!selected) continue;
+		// Index positions are 0-based with an exclusive end
+		chunks_len = index->Query(i, region_start - 1, region_end, &chunks, &chunks_cap, chunks_len);
+	}
+
+	// Chunks of neighbouring bins often follow each other in the file, so overlapping chunks are merged
+	if (chunks_len > 0) qsort(chunks, chunks_len, sizeof(struct vcf_index_chunk), compare_chunks);
+	uint64_t merged_len = 0;
+	for (uint64_t i = 0; i < chunks_len; i++) {
+		if (merged_len > 0 && chunks[i].start <= chunks[merged_len - 1].end) {
+			if (chunks[i].end > chunks[merged_len - 1].end) chunks[merged_len - 1].end = chunks[i].end;
+		} else {
+			chunks[merged_len++] = chunks[i];
+		}
+	}
+
+	for (uint64_t i = 0; i < merged_len; i++) {
+		if (!stream->SetRange(chunks[i].start, chunks[i].end)) {
+			printf("Index of %s does not match the file, reading all of it\n", filepath);
+			free(chunks);
+			stream->Rewind();
+			return false;
+		}
+	}
+	stream->Rewind();
+
+	ranges = chunks;
+	ranges_len = merged_len;
+	return true;
+}
+
+void VCF::GrowArrays() {
+	capacity = (capacity == 0) ? 1024 : capacity * 2;
+	chromosomes       = (int16_t *) realloc(chromosomes, sizeof(int16_t) * capacity);
+	contig_ids        = (uint32_t *) realloc(contig_ids, sizeof(uint32_t) * capacity);
+	positions         = (uint64_t *) realloc(positions, sizeof(uint64_t) * capacity);
+	reference_offsets = (uint64_t *) realloc(reference_offsets, sizeof(uint64_t) * capacity);
+	reference_lengths = (uint32_t *) realloc(reference_lengths, sizeof(uint32_t) * capacity);
+	variant_starts    = (uint64_t *) realloc(variant_starts, sizeof(uint64_t) * capacity);
+	variant_counts    = (uint32_t *) realloc(variant_counts, sizeof(uint32_t) * capacity);
+}
+
+bool is_structural_variant(const char *ref, uint32_t ref_len, const char *var, uint32_t var_len) {
+	for (uint32_t i = 0; i < ref_len; i++) {
 		char base = ref[i];
 		if (i == 0 && base == '.') break;
 		if (base != 'A' && base != 'a' && base != 'C' && base != 'c' &&
@@ -38,7 +252,7 @@ bool is_structural_variant(char *ref, uint16_t ref_len, char *var, uint16_t var_
 			return true;
 		}
 	}
-	for (uint16_t i = 0; i < var_len; i++) {
+	for (uint32_t i = 0; i < var_len; i++) {
 		char base = var[i];
 		if (i == 0 && base == '.') break;
 		if (base != 'A' && base != 'a' && base != 'C' && base != 'c' &&
@@ -50,186 +264,194 @@ bool is_structural_variant(char *ref, uint16_t ref_len, char *var, uint16_t var_
 	return false;
 }
 
-uint64_t VCF::ReadChromosomeRowCount(int16_t chromosome) {
-	uint64_t count = 0;
-	uint64_t ignored = 0;
-
-	fseek(source_file, 0, SEEK_SET);
-	while (fgets(line_buffer, 2048, source_file) != NULL) {
-		if (line_buffer[0] != '#') {
-			sscanf(line_buffer, "%s\t%s\t%s\t%s\t%s",
-				chromosome_buffer, position_buffer, dummy_buffer, reference_buffer, variant_buffer);
-			int16_t row_chromosome = strtoull(chromosome_buffer, NULL, 10);
-			if (chromosome == -1 || chromosome == row_chromosome) {
-				uint16_t reference_length = strlen(reference_buffer);
-				uint16_t variant_length = strlen(variant_buffer);
-				if (is_structural_variant(reference_buffer, reference_length,
-							  variant_buffer, variant_length)) {
-					ignored++;
-					continue;
-				}
-				count++;
-			};
+// Stores the alleles in the arena, leaving out the bases at the start that REF and every ALT allele share
+void VCF::AddVariant(uint32_t contig_id, int16_t chromosome, uint64_t position, const char *reference, uint32_t ref_len, const char *variant, uint32_t var_len) {
+	if (length == capacity) GrowArrays();
+
+	// Split ALT into the spans of its alleles, a "." meaning there are none
+	uint32_t variant_count = 0;
+	if (var_len > 0 && variant[0] != '.') {
+		uint32_t allele_start = 0;
+		while (true) {
+			if (variants_len + variant_count == variants_cap) {
+				variants_cap = (variants_cap == 0) ? 1024 : variants_cap * 2;
+				variant_offsets = (uint64_t *) realloc(variant_offsets, sizeof(uint64_t) * variants_cap);
+				variant_lengths = (uint32_t *) realloc(variant_lengths, sizeof(uint32_t) * variants_cap);
+			}
+			const char *comma = (const char *) memchr(variant + allele_start, ',', var_len - allele_start);
+			uint32_t allele_end = (comma == NULL) ? var_len : (comma - variant);
+			variant_offsets[variants_len + variant_count] = allele_start;
+			variant_lengths[variants_len + variant_count] = allele_end - allele_start;
+			variant_count++;
+			if (comma == NULL) break;
+			allele_start = allele_end + 1;
 		}
 	}
 
-	printf("Structural Variants ignored: %lu\n", ignored);
-	printf("Count: %lu\n", count);
-
-	return count;
-}
-
-void VCF::AddMultiVariant(uint64_t index, int16_t chromosome, uint64_t position, char *reference, uint16_t ref_len, char *variant_buffer, uint16_t var_len) {
-	uint16_t variant_count = 1;
-	for (uint16_t i = 0; i < var_len; i++) {
-		if (variant_buffer[i] == ',') variant_count++;
+	uint32_t shared = 0;
+	while (variant_count > 0 && shared < ref_len) {
+		bool all_equal = true;
+		for (uint32_t i = variants_len; i < variants_len + variant_count; i++) {
+			if (shared >= variant_lengths[i] || variant[variant_offsets[i] + shared] != reference[shared]) {
+				all_equal = false;
+				break;
+			}
+		}
+		if (!all_equal) break;
+		shared++;
 	}
+	reference += shared;
+	ref_len -= shared;
+	if (ref_len > 0 && reference[0] == '.') ref_len = 0;
 
-	char **all_variants = (char **) malloc(sizeof(char *) * variant_count);
-
-	char *variant = strtok(variant_buffer, ",");
-
-	variant_count = 0;
+	if (alleles_len + ref_len + var_len > alleles_cap) {
+		while (alleles_len + ref_len + var_len > alleles_cap) alleles_cap = (alleles_cap == 0) ? (1 << 20) : alleles_cap * 2;
+		alleles = (char *) realloc(alleles, sizeof(char) * alleles_cap);
+	}
+	reference_offsets[length] = alleles_len;
+	reference_lengths[length] = ref_len;
+	memcpy(alleles + alleles_len, reference, ref_len);
+	alleles_len += ref_len;
 
-	while (variant != NULL) {
-		all_variants[variant_count] = variant;
-		variant = strtok(NULL, ",");
-		variant_count++;
+	variant_starts[length] = variants_len;
+	variant_counts[length] = variant_count;
+	for (uint32_t i = variants_len; i < variants_len + variant_count; i++) {
+		const char *allele = variant + variant_offsets[i] + shared;
+		variant_lengths[i] -= shared;
+		variant_offsets[i] = alleles_len;
+		memcpy(alleles + alleles_len, allele, variant_lengths[i]);
+		alleles_len += variant_lengths[i];
 	}
+	variants_len += variant_count;
 
-	uint16_t variant_start_pos = 0;
-	bool keep_going = true;
-	while (keep_going) {
-		if (variant_start_pos >= ref_len) {
-			keep_going = false;
-			break;
-		}
-		for (uint16_t i = 0; i < variant_count; i++) {
-			if (variant_start_pos >= strlen(all_variants[i])) {
-				keep_going = false;
-				break;
+	chromosomes[length] = chromosome;
+	contig_ids[length] = contig_id;
+	positions[length] = position + shared - 1;
+	length++;
+}
+
+// Reads lines until the end of the stream, or until there are max_length variants. Returns false at the end of the stream.
+bool VCF::ReadLines(FileStream *stream, int16_t chromosome, uint64_t max_length) {
+	while (length < max_length) {
+		if (chunk_pos == chunk_len) {
+			chunk = stream->Next(&chunk_len);
+			chunk_pos = 0;
+			if (chunk == NULL) {
+				chunk_len = 0;
+				if (carry_len > 0) ReadLine(carry_buffer, carry_len, chromosome);
+				carry_len = 0;
+				return false;
 			}
-		}
-		if (!keep_going) break;
-		char ref_base = reference[variant_start_pos];
-		for (uint16_t i = 0; i < variant_count; i++) {
-			if (all_variants[i][variant_start_pos] != ref_base) {
-				keep_going = false;
-				break;
+			// A line cut off at the end of the previous chunk is completed first
+			if (carry_len > 0) {
+				const char *newline = (const char *) memchr(chunk, '\n', chunk_len);
+				AppendToCarry(chunk, (newline == NULL) ? chunk_len : (newline - chunk));
+				if (newline == NULL) {
+					chunk_pos = chunk_len;
+					continue;
+				}
+				ReadLine(carry_buffer, carry_len, chromosome);
+				carry_len = 0;
+				chunk_pos = (newline - chunk) + 1;
 			}
+			continue;
 		}
-		if (!keep_going) break;
-		variant_start_pos++;
-	}
 
-	if (variant_start_pos > 0) {
-		for (uint16_t i = variant_start_pos; i < ref_len; i++) {
-			reference[i - variant_start_pos] = reference[i];
+		const char *newline = (const char *) memchr(chunk + chunk_pos, '\n', chunk_len - chunk_pos);
+		if (newline == NULL) {
+			AppendToCarry(chunk + chunk_pos, chunk_len - chunk_pos);
+			chunk_pos = chunk_len;
+			continue;
 		}
-		ref_len -= variant_start_pos;
-		reference[ref_len] = '\0';
-		for (uint16_t i = 0; i < variant_count; i++) {
-			uint16_t this_var_len = strlen(all_variants[i]);
-			for (uint16_t j = variant_start_pos; j < this_var_len; j++) {
-				all_variants[i][j - variant_start_pos] = all_variants[i][j];
-			}
-			all_variants[i][this_var_len - variant_start_pos] = '\0';
-		}
-		position += variant_start_pos;
+		ReadLine(chunk + chunk_pos, (newline - chunk) - chunk_pos, chromosome);
+		chunk_pos = (newline - chunk) + 1;
 	}
+	return true;
+}
 
-	uint16_t variant_buffer_len = 0;
-	for (uint16_t i = 0; i < variant_count; i++) {
-		uint16_t this_var_len = strlen(all_variants[i]);
-		for (uint16_t j = 0; j < this_var_len; j++) {
-			variant_buffer[variant_buffer_len++] = all_variants[i][j];
-		}
-		variant_buffer[variant_buffer_len++] = ((i == variant_count - 1) ? '\0' : ',');
+void VCF::AppendToCarry(const char *str, uint64_t len) {
+	if (carry_len + len > carry_cap) {
+		while (carry_len + len > carry_cap) carry_cap = (carry_cap == 0) ? 4096 : carry_cap * 2;
+		carry_buffer = (char *) realloc(carry_buffer, carry_cap);
 	}
-
-	AddVariant(index, chromosome, position, reference, ref_len, variant_buffer, variant_buffer_len);
-
-	free(all_variants);
+	memcpy(carry_buffer + carry_len, str, len);
+	carry_len += len;
 }
 
-void VCF::AddSingleVariant(uint64_t index, int16_t chromosome, uint64_t position, char *reference, uint16_t ref_len, char *variant, uint16_t var_len) {
-	uint16_t variant_start_pos = 0;
-	while (variant_start_pos < ref_len && variant_start_pos < var_len &&
-	       reference[variant_start_pos] == variant[variant_start_pos]) {
-		variant_start_pos++;
-	}
-	
-	if (variant_start_pos > 0) {
-		for (uint16_t i = variant_start_pos; i < ref_len; i++) {
-			reference[i - variant_start_pos] = reference[i];
-		}
-		ref_len -= variant_start_pos;
-		reference[ref_len] = '\0';
-		for (uint16_t i = variant_start_pos; i < var_len; i++) {
-			variant[i - variant_start_pos] = variant[i];
-		}
-		var_len -= variant_start_pos;
-		variant[var_len] = '\0';
-		position += variant_start_pos;
+void VCF::ReadLine(const char *line, uint64_t line_len, int16_t chromosome) {
+	if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+	if (line_len > 10 && memcmp(line, "##contig=<", 10) == 0) ReadContigHeader(line, line_len);
+	if (line_len == 0 || line[0] == '#') return;
+
+	// Start of CHROM, POS, ID, REF and ALT, and the end of ALT
+	uint64_t fields[6];
+	fields[0] = 0;
+	uint8_t fields_len = 1;
+	while (fields_len < 6) {
+		const char *tab = (const char *) memchr(line + fields[fields_len - 1], '\t', line_len - fields[fields_len - 1]);
+		if (tab == NULL) break;
+		fields[fields_len++] = (tab - line) + 1;
 	}
+	if (fields_len < 5) return;
+	if (fields_len == 5) fields[fields_len++] = line_len + 1;
 
-	AddVariant(index, chromosome, position, reference, ref_len, variant, var_len);
-}
+	uint64_t name_len = fields[1] - 1 - fields[0];
+	int16_t row_chromosome = parse_chromosome(line + fields[0], name_len);
+	if (chromosome != -1 && chromosome != row_chromosome) return;
+	bool in_region = (region_name == NULL) || (strlen(region_name) == name_len && memcmp(region_name, line + fields[0], name_len) == 0);
+	if (!in_region) return;
 
-void VCF::AddVariant(uint64_t index, int16_t chromosome, uint64_t position, char *reference, uint16_t ref_len, char *variant, uint16_t var_len) {
-	if (reference[0] == '.') {
-		references[index] = (char *) malloc(sizeof(char));
-		references[index][0] = '\0';
-	} else {
-		references[index] = (char *) malloc(sizeof(char) * (ref_len + 1));
-		strncpy(references[index], reference, ref_len);
-		references[index][ref_len] = '\0';
+	const char *reference = line + fields[3];
+	uint32_t reference_length = fields[4] - 1 - fields[3];
+	const char *variant = line + fields[4];
+	uint32_t variant_length = fields[5] - 1 - fields[4];
+
+	uint64_t position = 0;
+	for (uint64_t i = fields[1]; i < fields[2] - 1 && line[i] >= '0' && line[i] <= '9'; i++) {
+		position = position * 10 + (line[i] - '0');
 	}
-	if (variant[0] == '.') {
-		variants[index] = (char *) malloc(sizeof(char));
-		variants[index][0] = '\0';
-	} else {
-		variants[index] = (char *) malloc(sizeof(char) * (var_len + 1));
-		strncpy(variants[index], variant, var_len);
-		variants[index][var_len] = '\0';
+	// Index chunks may hold records next to the region, which are left out like in a full scan
+	uint64_t last_position = position + ((reference_length > 0) ? reference_length - 1 : 0);
+	if (region_name != NULL && (position > region_end || last_position < region_start)) return;
+
+	if (is_structural_variant(reference, reference_length, variant, variant_length)) {
+		ignored++;
+		return;
 	}
 
-	chromosomes[index] = chromosome;
-	positions[index] = position - 1;
+	uint32_t contig_id = GetContigID(line + fields[0], name_len);
+	AddVariant(contig_id, row_chromosome, position, reference, reference_length, variant, variant_length);
 }
 
-void VCF::ReadChromosome(int16_t chromosome) {
-	uint64_t count = 0;
-
-	fseek(source_file, 0, SEEK_SET);
-	while (fgets(line_buffer, 2048, source_file) != NULL) {
-		if (line_buffer[0] != '#') {
-			sscanf(line_buffer, "%s\t%s\t%s\t%s\t%s",
-				chromosome_buffer, position_buffer, dummy_buffer, reference_buffer, variant_buffer);
-			int16_t row_chromosome = strtoull(chromosome_buffer, NULL, 10);
-			if (chromosome == -1 || chromosome == row_chromosome) {
-				uint16_t reference_length = strlen(reference_buffer);
-				uint16_t variant_length = strlen(variant_buffer);
-				if (is_structural_variant(reference_buffer, reference_length,
-							  variant_buffer, variant_length)) {
-					continue;
-				}
-				uint64_t position = strtoull(position_buffer, NULL, 10);
-
-				bool multiple_variant = (strstr(variant_buffer, ",") != NULL);
-
-				if (multiple_variant) {
-					AddMultiVariant(count, row_chromosome, position,
-							reference_buffer, reference_length,
-							variant_buffer, variant_length);
-				} else {
-					AddSingleVariant(count, row_chromosome, position,
-							 reference_buffer, reference_length,
-							 variant_buffer, variant_length);
-				}
+uint32_t VCF::GetContigID(const char *name, uint32_t name_len) {
+	if (last_contig_id == UINT32_MAX || !contigs->NameEquals(last_contig_id, name, name_len)) {
+		last_contig_id = contigs->Add(name, name_len);
+	}
+	return last_contig_id;
+}
 
-				count++;
+// Header lines like ##contig=<ID=chr1,length=248956422> number the contigs in header order
+void VCF::ReadContigHeader(const char *line, uint64_t line_len) {
+	const char *end = line + line_len;
+	const char *id = NULL;
+	uint32_t id_len = 0;
+	uint64_t contig_length = 0;
+	const char *field = line + 10;
+	while (field < end) {
+		const char *field_end = (const char *) memchr(field, ',', end - field);
+		if (field_end == NULL) field_end = end;
+		if (field_end > field && field_end[-1] == '>') field_end--;
+		if (field_end - field > 3 && memcmp(field, "ID=", 3) == 0) {
+			id = field + 3;
+			id_len = field_end - id;
+		} else if (field_end - field > 7 && memcmp(field, "length=", 7) == 0) {
+			for (const char *c = field + 7; c < field_end && *c >= '0' && *c <= '9'; c++) {
+				contig_length = contig_length * 10 + (*c - '0');
 			}
 		}
+		field = field_end + 1;
 	}
+	if (id == NULL) return;
+	uint32_t contig_id = contigs->Add(id, id_len);
+	if (contig_length > 0) contigs->lengths[contig_id] = contig_length;
 }
@@ -5,63 +5,155 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <cstring>
+#include "FileStream.hpp"
+#include "VCFIndex.hpp"
+#include "ContigDictionary.hpp"
 
 class VCF {
 public:
 	uint64_t length;
+	// The leading digits of the CHROM field, which is 0 for names like chrX
 	int16_t *chromosomes;
+	// The CHROM field of every variant as an ID in contigs, which also holds the ##contig header lines
+	uint32_t *contig_ids;
+	ContigDictionary *contigs;
 	uint64_t *positions;
-	char **references;
-	char **variants;
+	// The REF and ALT alleles of all variants, one after another and without separators
+	char *alleles;
+	uint64_t alleles_len;
+	// The REF allele of variant i is reference_lengths[i] bases at reference_offsets[i] in alleles
+	uint64_t *reference_offsets;
+	uint32_t *reference_lengths;
+	// Its ALT alleles are the variant_counts[i] spans from variant_starts[i] on
+	uint64_t *variant_starts;
+	uint32_t *variant_counts;
+	uint64_t *variant_offsets;
+	uint32_t *variant_lengths;
+	uint64_t variants_len;
 
 private:
 	char *filepath;
-	FILE *source_file;
-	char line_buffer[2048];
-	char chromosome_buffer[64];
-	char position_buffer[64];
-	char reference_buffer[512];
-	char variant_buffer[512];
-	char dummy_buffer[512];
-	uint16_t id_buffer_length;
+	uint64_t capacity;
+	uint64_t alleles_cap;
+	uint64_t variants_cap;
+	uint64_t ignored;
+	// Records are sorted, so the contig of the previous record is checked before the dictionary
+	uint32_t last_contig_id;
+	// The start of a line cut off at the end of a decompressed chunk
+	char *carry_buffer;
+	uint64_t carry_len;
+	uint64_t carry_cap;
+	// Set when reading a region or a contig, records of other contigs or outside [region_start, region_end] are skipped
+	char *region_name;
+	uint64_t region_start;
+	uint64_t region_end;
+	// The chunk of the stream being read, which ReadLines may stop partway through
+	const char *chunk;
+	uint64_t chunk_len;
+	uint64_t chunk_pos;
+	// Set by Open, the stream NextBatch reads from and the chromosome and index ranges it reads
+	FileStream *stream;
+	int16_t batch_chromosome;
+	struct vcf_index_chunk *ranges;
+	uint64_t ranges_len;
+	uint64_t next_range;
 
 public:
 	~VCF() {
 		if (chromosomes) free(chromosomes);
+		if (contig_ids) free(contig_ids);
+		delete contigs;
 		if (positions) free(positions);
-		if (references) {
-			for (uint64_t i = 0; i < length; i++) {
-				free(references[i]);
-			}
-			free(references);
-		}
-		if (variants) {
-			for (uint64_t i = 0; i < length; i++) {
-				free(variants[i]);
-			}
-			free(variants);
-		}
+		if (alleles) free(alleles);
+		if (reference_offsets) free(reference_offsets);
+		if (reference_lengths) free(reference_lengths);
+		if (variant_starts) free(variant_starts);
+		if (variant_counts) free(variant_counts);
+		if (variant_offsets) free(variant_offsets);
+		if (variant_lengths) free(variant_lengths);
+		free(carry_buffer);
+		free(region_name);
+		delete stream;
+		free(ranges);
 		free(filepath);
 	}
 
+	// Reads the variants of a chromosome, or of all chromosomes if it is -1. A BGZF file with a tabix
+	// or CSI index next to it is only read where the chromosome is. Chromosomes are matched by the
+	// leading digits of the CHROM field, so names like chrX or MT are all chromosome 0.
 	static VCF *ReadFile(char *filepath, int16_t chromosome);
+	// Reads the variants of the contig with exactly this name, which is taken whole even if it holds a colon
+	static VCF *ReadContig(char *filepath, const char *contig);
+	// Reads the variants overlapping a region written as contig, contig:start or contig:start-end,
+	// with 1-based inclusive positions
+	static VCF *ReadRegion(char *filepath, const char *region);
+	// Opens the variants of a chromosome to be read in batches by NextBatch, instead of all at once
+	static VCF *Open(char *filepath, int16_t chromosome);
+	static VCF *OpenContig(char *filepath, const char *contig);
+	// Moves the next batch_len records, or fewer at the end of the file, into a VCF of their own, whose
+	// contig IDs are those of this VCF. Returns NULL once the file is used up.
+	VCF *NextBatch(uint64_t batch_len);
+
+	const char *GetReference(uint64_t index) {
+		return alleles + reference_offsets[index];
+	}
+	// The ALT alleles of a variant, some of which may be empty after trimming
+	const char *GetVariant(uint64_t index, uint32_t allele) {
+		return alleles + variant_offsets[variant_starts[index] + allele];
+	}
+	uint32_t GetVariantLength(uint64_t index, uint32_t allele) {
+		return variant_lengths[variant_starts[index] + allele];
+	}
 private:
 
 	VCF(char *filepath) {
 		this->filepath = strdup(filepath);
 		length = 0;
+		capacity = 0;
+		alleles_len = 0;
+		alleles_cap = 0;
+		variants_len = 0;
+		variants_cap = 0;
+		ignored = 0;
+		last_contig_id = UINT32_MAX;
+		carry_buffer = NULL;
+		carry_len = 0;
+		carry_cap = 0;
+		region_name = NULL;
+		region_start = 1;
+		region_end = UINT64_MAX;
+		chunk = NULL;
+		chunk_len = 0;
+		chunk_pos = 0;
+		stream = NULL;
+		batch_chromosome = -1;
+		ranges = NULL;
+		ranges_len = 0;
+		next_range = 0;
 		chromosomes = NULL;
+		contig_ids = NULL;
+		contigs = new ContigDictionary();
 		positions = NULL;
-		references = NULL;
-		variants = NULL;
+		alleles = NULL;
+		reference_offsets = NULL;
+		reference_lengths = NULL;
+		variant_starts = NULL;
+		variant_counts = NULL;
+		variant_offsets = NULL;
+		variant_lengths = NULL;
 	}
 
-	void InitializeArrays();
-	uint64_t ReadChromosomeRowCount(int16_t chromosome);
-	void ReadChromosome(int16_t chromosome);
-	void AddVariant(uint64_t index, int16_t chromosome, uint64_t position, char *reference, uint16_t ref_len, char *variant, uint16_t var_len);
-	void AddSingleVariant(uint64_t index, int16_t chromosome, uint64_t position, char *reference, uint16_t ref_len, char *variant, uint16_t var_len);
-	void AddMultiVariant(uint64_t index, int16_t chromosome, uint64_t position, char *reference, uint16_t ref_len, char *variant_buffer, uint16_t var_len);
+	void GrowArrays();
+	static VCF *Read(char *filepath, int16_t chromosome, const char *region, const char *contig);
+	static VCF *Open(char *filepath, int16_t chromosome, const char *contig);
+	bool SetRegion(const char *region);
+	bool ReadLines(FileStream *stream, int16_t chromosome, uint64_t max_length);
+	bool FindRanges(FileStream *stream, VCFIndex *index, int16_t chromosome);
+	void ReadLine(const char *line, uint64_t line_len, int16_t chromosome);
+	void AppendToCarry(const char *str, uint64_t len);
+	void ReadContigHeader(const char *line, uint64_t line_len);
+	uint32_t GetContigID(const char *name, uint32_t name_len);
+	void AddVariant(uint32_t contig_id, int16_t chromosome, uint64_t position, const char *reference, uint32_t ref_len, const char *variant, uint32_t var_len);
 };
 
 #endif
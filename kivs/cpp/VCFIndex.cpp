@@ -0,0 +1,181 @@
+#include "VCFIndex.hpp"
+#include "FileStream.hpp"
+#include <iostream>
+
+// Little endian fields of the decompressed index
+struct index_reader {
+	const uint8_t *data;
+	uint64_t len;
+	uint64_t pos;
+};
+
+static bool read_bytes(struct index_reader *reader, void *out, uint64_t len) {
+	if (reader->len - reader->pos < len) return false;
+	memcpy(out, reader->data + reader->pos, len);
+	reader->pos += len;
+	return true;
+}
+
+static bool read_count(struct index_reader *reader, uint32_t *count) {
+	int32_t value;
+	if (!read_bytes(reader, &value, sizeof(int32_t)) || value < 0) return false;
+	*count = value;
+	return true;
+}
+
+VCFIndex *VCFIndex::ReadFile(char *vcf_filepath) {
+	const char *extensions[] = {".tbi", ".csi"};
+	uint64_t filepath_len = strlen(vcf_filepath);
+	char *index_filepath = (char *) malloc(sizeof(char) * (filepath_len + 5));
+
+	VCFIndex *index = NULL;
+	for (uint8_t i = 0; i < 2 && index == NULL; i++) {
+		memcpy(index_filepath, vcf_filepath, filepath_len);
+		memcpy(index_filepath + filepath_len, extensions[i], 5);
+
+		FileStream *stream = FileStream::Open(index_filepath, 1);
+		if (stream == NULL) continue;
+		uint64_t data_len;
+		const uint8_t *data = (const uint8_t *) stream->ReadAll(&data_len);
+
+		index = new VCFIndex();
+		if (!index->Parse(data, data_len, i == 1)) {
+			printf("Failed to read index %s\n", index_filepath);
+			delete index;
+			index = NULL;
+		}
+		delete stream;
+	}
+
+	free(index_filepath);
+	return index;
+}
+
+bool VCFIndex::Parse(const uint8_t *data, uint64_t data_len, bool csi) {
+	struct index_reader reader = {data, data_len, 0};
+	char magic[4];
+	if (!read_bytes(&reader, magic, 4) || memcmp(magic, csi ? "CSI\1" : "TBI\1", 4) != 0) return false;
+
+	// The contig names are in the tabix header, which CSI stores as auxiliary data
+	const uint8_t *header;
+	uint32_t header_len;
+	if (csi) {
+		if (!read_bytes(&reader, &min_shift, sizeof(int32_t)) || !read_bytes(&reader, &depth, sizeof(int32_t))) return false;
+		if (min_shift <= 0 || depth < 0 || min_shift + depth * 3 >= 64) return false;
+		if (!read_count(&reader, &header_len) || reader.len - reader.pos < header_len) return false;
+		header = data + reader.pos;
+		reader.pos += header_len;
+		if (!read_count(&reader, &contigs_len)) return false;
+	} else {
+		if (!read_count(&reader, &contigs_len)) return false;
+		header = data + reader.pos;
+		uint32_t names_len;
+		if (reader.len - reader.pos < sizeof(int32_t) * 6) return false;
+		reader.pos += sizeof(int32_t) * 6;
+		if (!read_count(&reader, &names_len) || reader.len - reader.pos < names_len) return false;
+		reader.pos += names_len;
+		header_len = (data + reader.pos) - header;
+	}
+
+	contigs = (struct vcf_index_contig *) calloc(contigs_len + 1, sizeof(struct vcf_index_contig));
+	if (!ReadNames(header, header_len)) return false;
+
+	for (uint32_t i = 0; i < contigs_len; i++) {
+		contigs[i].chunks_start = chunks_len;
+		contigs[i].linear_start = linear_len;
+
+		uint32_t bins_len;
+		if (!read_count(&reader, &bins_len)) return false;
+		for (uint32_t j = 0; j < bins_len; j++) {
+			uint32_t bin, bin_chunks_len;
+			uint64_t bin_offset;
+			if (!read_bytes(&reader, &bin, sizeof(uint32_t))) return false;
+			if (csi && !read_bytes(&reader, &bin_offset, sizeof(uint64_t))) return false;
+			if (!read_count(&reader, &bin_chunks_len)) return false;
+			for (uint32_t k = 0; k < bin_chunks_len; k++) {
+				if (chunks_len == chunks_cap) {
+					chunks_cap = (chunks_cap == 0) ? 1024 : chunks_cap * 2;
+					chunks = (struct vcf_index_chunk *) realloc(chunks, sizeof(struct vcf_index_chunk) * chunks_cap);
+				}
+				struct vcf_index_chunk *chunk = chunks + chunks_len;
+				chunk->bin = bin;
+				if (!read_bytes(&reader, &chunk->start, sizeof(uint64_t)) || !read_bytes(&reader, &chunk->end, sizeof(uint64_t))) return false;
+				chunks_len++;
+			}
+		}
+		contigs[i].chunks_len = chunks_len - contigs[i].chunks_start;
+
+		if (csi) continue;
+		uint32_t windows_len;
+		if (!read_count(&reader, &windows_len) || (reader.len - reader.pos) / sizeof(uint64_t) < windows_len) return false;
+		if (linear_len + windows_len > linear_cap) {
+			while (linear_len + windows_len > linear_cap) linear_cap = (linear_cap == 0) ? 1024 : linear_cap * 2;
+			linear_offsets = (uint64_t *) realloc(linear_offsets, sizeof(uint64_t) * linear_cap);
+		}
+		read_bytes(&reader, linear_offsets + linear_len, sizeof(uint64_t) * windows_len);
+		linear_len += windows_len;
+		contigs[i].linear_len = windows_len;
+	}
+
+	return true;
+}
+
+// The header holds the format, the columns of the contig and positions, the meta character, the
+// number of lines to skip, and then the contig names one after another, each ending with a 0
+bool VCFIndex::ReadNames(const uint8_t *header, uint64_t header_len) {
+	if (header_len < sizeof(int32_t) * 7) return false;
+	int32_t names_len;
+	memcpy(&names_len, header + sizeof(int32_t) * 6, sizeof(int32_t));
+	if (names_len < 0 || (uint64_t) names_len > header_len - sizeof(int32_t) * 7) return false;
+
+	names = (char *) malloc(sizeof(char) * (names_len + 1));
+	memcpy(names, header + sizeof(int32_t) * 7, names_len);
+	names[names_len] = '\0';
+
+	uint64_t name_start = 0;
+	for (uint32_t i = 0; i < contigs_len; i++) {
+		if (name_start >= (uint64_t) names_len) return false;
+		contigs[i].name = names + name_start;
+		name_start += strlen(names + name_start) + 1;
+	}
+	return true;
+}
+
+// Level l has 8^l bins, numbered after the bins of all levels above it. The bin after the last level
+// holds statistics and no records.
+bool VCFIndex::BinOverlaps(uint32_t bin, uint64_t start, uint64_t end) {
+	uint64_t level_start = 0;
+	for (int32_t level = 0; level <= depth; level++) {
+		uint64_t level_len = 1ULL << (3 * level);
+		if (bin < level_start + level_len) {
+			uint32_t shift = min_shift + 3 * (depth - level);
+			uint64_t bin_start = (bin - level_start) << shift;
+			uint64_t bin_end = bin_start + (1ULL << shift);
+			return bin_start < end && start < bin_end;
+		}
+		level_start += level_len;
+	}
+	return false;
+}
+
+uint64_t VCFIndex::Query(uint32_t contig, uint64_t start, uint64_t end, struct vcf_index_chunk **found, uint64_t *found_cap, uint64_t found_len) {
+	struct vcf_index_contig *c = contigs + contig;
+
+	// Chunks ending before the first record of the window holding start cannot overlap the region
+	uint64_t min_offset = 0;
+	if (c->linear_len > 0) {
+		uint64_t window = start >> TABIX_MIN_SHIFT;
+		if (window >= c->linear_len) window = c->linear_len - 1;
+		min_offset = linear_offsets[c->linear_start + window];
+	}
+
+	for (uint64_t i = c->chunks_start; i < c->chunks_start + c->chunks_len; i++) {
+		if (chunks[i].end <= min_offset || !BinOverlaps(chunks[i].bin, start, end)) continue;
+		if (found_len == *found_cap) {
+			*found_cap = (*found_cap == 0) ? 64 : *found_cap * 2;
+			*found = (struct vcf_index_chunk *) realloc(*found, sizeof(struct vcf_index_chunk) * *found_cap);
+		}
+		(*found)[found_len++] = chunks[i];
+	}
+	return found_len;
+}
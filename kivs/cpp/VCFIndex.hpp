@@ -0,0 +1,80 @@
+#ifndef KIVS_FILE_READER_VCF_INDEX
+#define KIVS_FILE_READER_VCF_INDEX
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+
+// Tabix indexes always use bins of 16 kbp at the lowest of their 6 levels
+#define TABIX_MIN_SHIFT 14
+#define TABIX_DEPTH 5
+
+// A run of records between two BGZF virtual offsets, all of which fall into the same bin
+struct vcf_index_chunk {
+	uint32_t bin;
+	uint64_t start;
+	uint64_t end;
+};
+
+struct vcf_index_contig {
+	char *name;
+	uint64_t chunks_start;
+	uint32_t chunks_len;
+	// Tabix only: the first virtual offset of a record overlapping each 16 kbp window
+	uint64_t linear_start;
+	uint32_t linear_len;
+};
+
+// Tabix (.tbi) or CSI (.csi) index of a BGZF compressed VCF file. Records of a contig are binned by
+// the region they cover, in levels of bins 8 times smaller than the level above.
+class VCFIndex {
+public:
+	struct vcf_index_contig *contigs;
+	uint32_t contigs_len;
+	int32_t min_shift;
+	int32_t depth;
+
+private:
+	char *names;
+	struct vcf_index_chunk *chunks;
+	uint64_t chunks_len;
+	uint64_t chunks_cap;
+	uint64_t *linear_offsets;
+	uint64_t linear_len;
+	uint64_t linear_cap;
+
+public:
+	~VCFIndex() {
+		if (contigs) free(contigs);
+		if (names) free(names);
+		if (chunks) free(chunks);
+		if (linear_offsets) free(linear_offsets);
+	}
+
+	// Reads filepath.tbi, or filepath.csi if there is no tabix index. Returns NULL if neither can be read.
+	static VCFIndex *ReadFile(char *vcf_filepath);
+	// Appends the chunks of a contig that may hold records overlapping [start, end), 0-based, to a growable array
+	uint64_t Query(uint32_t contig, uint64_t start, uint64_t end, struct vcf_index_chunk **found, uint64_t *found_cap, uint64_t found_len);
+private:
+
+	VCFIndex() {
+		contigs = NULL;
+		contigs_len = 0;
+		min_shift = TABIX_MIN_SHIFT;
+		depth = TABIX_DEPTH;
+		names = NULL;
+		chunks = NULL;
+		chunks_len = 0;
+		chunks_cap = 0;
+		linear_offsets = NULL;
+		linear_len = 0;
+		linear_cap = 0;
+	}
+
+	bool Parse(const uint8_t *data, uint64_t data_len, bool csi);
+	bool ReadNames(const uint8_t *header, uint64_t header_len);
+	bool BinOverlaps(uint32_t bin, uint64_t start, uint64_t end);
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
+
+#include "Graph.hpp"
+
+// Loads a GFA file with 1, 2, 4, ... threads and reports the throughput of each run.
+// Usage: benchmark_gfa <file.gfa> [max_threads]
+// Build with optimizations for meaningful numbers, e.g. make clean-c benchmark_gfa CFLAGS="-O2 -pthread"
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 3) {
+		printf("Usage: %s <file.gfa> [max_threads]\n", argv[0]);
+		return 1;
+	}
+
+	struct stat file_stat;
+	if (stat(argv[1], &file_stat) != 0) {
+		printf("Could not open %s\n", argv[1]);
+		return 1;
+	}
+	double megabytes = file_stat.st_size / 1e6;
+
+	uint32_t max_threads = (argc == 3) ? atoi(argv[2]) : std::thread::hardware_concurrency();
+	if (max_threads == 0) max_threads = 1;
+
+	double single_thread_seconds = 0;
+	for (uint32_t thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+		auto start = std::chrono::steady_clock::now();
+		Graph *graph = Graph::FromGFAFileEncoded(argv[1], "ACGT", thread_count);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (graph == NULL) return 1;
+		if (thread_count == 1) single_thread_seconds = seconds;
+
+		fprintf(stderr, "threads: %2u  nodes: %u  edges: %u  time: %.3f s  throughput: %.1f MB/s  speedup: %.2fx\n",
+		        thread_count, graph->nodes_len, graph->edges_len, seconds, megabytes / seconds,
+		        single_thread_seconds / seconds);
+		delete graph;
+	}
+
+	return 0;
+}
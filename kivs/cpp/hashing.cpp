@@ -1,6 +1,11 @@
 #include "hashing.hpp"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KIVS_SIMD_ENCODING
+#include <immintrin.h>
+#endif
 
 void fill_map_by_encoding(uint8_t *map, const char *encoding) {
 	for (uint8_t i = 0; i < 4; i++) {
@@ -17,9 +22,118 @@ uint64_t hash_min_kmer_by_map(const char *str, uint8_t k, uint8_t *map) {
 	return hash_max_kmer_by_map(str, k, map) >> (64 - k * 2);
 }
 
-// Same as hash_kmer, except the bits are left-aligned in the long long.
-// This is faster, but also practical for the kmer_finder algorithm
-uint64_t hash_max_kmer_by_map(const char *str, uint8_t k, uint8_t *map) {
+// A, C, G, T and N differ in their lowest 4 bits, in either case, so the codes of 16 bases at a time
+// are looked up by them with a byte shuffle. Bases are checked against the letter expected for their
+// lowest bits, which is 0 for bits no base has, as letters in lower case are never 0.
+struct base_table {
+	uint8_t codes[16];
+	uint8_t bases[16];
+};
+
+// Returns false if the map does not give the upper and lower case of a base the same 2-bit code
+static bool fill_base_table(struct base_table *table, uint8_t *map) {
+	memset(table, 0, sizeof(struct base_table));
+	const char *bases = "acgtn";
+	for (uint8_t i = 0; i < 5; i++) {
+		uint8_t base = bases[i];
+		if (map[base] != map[base & 0xDF] || map[base] > 3) return false;
+		table->codes[base & 0x0F] = map[base];
+		table->bases[base & 0x0F] = base;
+	}
+	return true;
+}
+
+#ifdef KIVS_SIMD_ENCODING
+// Words of 32 bases are encoded until one holds a letter that is not a base, returning how many were.
+// Codes are summed into bytes of 4 bases with the first in the highest bits, 2 bases at a time and then 4.
+// The bytes of a word are gathered in order and swapped, since the first base goes in the highest bits.
+__attribute__((target("sse4.1")))
+static uint64_t hash_words_sse41(const char *str, uint64_t words, const struct base_table *table, uint64_t *hashes) {
+	const __m128i low_bits = _mm_set1_epi8(0x0F);
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	const __m128i codes = _mm_loadu_si128((const __m128i *) table->codes);
+	const __m128i bases = _mm_loadu_si128((const __m128i *) table->bases);
+	const __m128i pair_weights = _mm_set1_epi16(0x0104);
+	const __m128i quad_weights = _mm_set1_epi32(0x00010010);
+	for (uint64_t word = 0; word < words; word++) {
+		__m128i first = _mm_loadu_si128((const __m128i *) (str + word * 32));
+		__m128i second = _mm_loadu_si128((const __m128i *) (str + word * 32 + 16));
+		__m128i first_index = _mm_and_si128(first, low_bits);
+		__m128i second_index = _mm_and_si128(second, low_bits);
+		__m128i valid = _mm_and_si128(_mm_cmpeq_epi8(_mm_or_si128(first, case_bit), _mm_shuffle_epi8(bases, first_index)),
+		                              _mm_cmpeq_epi8(_mm_or_si128(second, case_bit), _mm_shuffle_epi8(bases, second_index)));
+		if (_mm_movemask_epi8(valid) != 0xFFFF) return word;
+
+		__m128i first_quads = _mm_madd_epi16(_mm_maddubs_epi16(_mm_shuffle_epi8(codes, first_index), pair_weights), quad_weights);
+		__m128i second_quads = _mm_madd_epi16(_mm_maddubs_epi16(_mm_shuffle_epi8(codes, second_index), pair_weights), quad_weights);
+		__m128i packed = _mm_packus_epi32(first_quads, second_quads);
+		hashes[word] = __builtin_bswap64(_mm_cvtsi128_si64(_mm_packus_epi16(packed, packed)));
+	}
+	return words;
+}
+
+__attribute__((target("avx2")))
+static uint64_t hash_words_avx2(const char *str, uint64_t words, const struct base_table *table, uint64_t *hashes) {
+	const __m256i low_bits = _mm256_set1_epi8(0x0F);
+	const __m256i case_bit = _mm256_set1_epi8(0x20);
+	const __m256i codes = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) table->codes));
+	const __m256i bases = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) table->bases));
+	const __m256i pair_weights = _mm256_set1_epi16(0x0104);
+	const __m256i quad_weights = _mm256_set1_epi32(0x00010010);
+	// The shuffle stays within each half, so both halves gather their 4 bytes at their start
+	const __m256i gather = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	                                        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	for (uint64_t word = 0; word < words; word++) {
+		__m256i input = _mm256_loadu_si256((const __m256i *) (str + word * 32));
+		__m256i index = _mm256_and_si256(input, low_bits);
+		__m256i valid = _mm256_cmpeq_epi8(_mm256_or_si256(input, case_bit), _mm256_shuffle_epi8(bases, index));
+		if ((uint32_t) _mm256_movemask_epi8(valid) != 0xFFFFFFFF) return word;
+
+		__m256i quads = _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_shuffle_epi8(codes, index), pair_weights), quad_weights);
+		__m256i gathered = _mm256_shuffle_epi8(quads, gather);
+		uint64_t hash = (uint32_t) _mm256_extract_epi32(gathered, 0) | ((uint64_t) (uint32_t) _mm256_extract_epi32(gathered, 4) << 32);
+		hashes[word] = __builtin_bswap64(hash);
+	}
+	return words;
+}
+#endif
+
+typedef uint64_t (*hash_words_function)(const char *str, uint64_t words, const struct base_table *table, uint64_t *hashes);
+
+static hash_words_function get_hash_words(uint8_t instructions) {
+#ifdef KIVS_SIMD_ENCODING
+	if (instructions == ENCODING_AVX2) return hash_words_avx2;
+	if (instructions == ENCODING_SSE41) return hash_words_sse41;
+#endif
+	(void) instructions;
+	return NULL;
+}
+
+static uint8_t get_supported_encoding_instructions() {
+#ifdef KIVS_SIMD_ENCODING
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return ENCODING_AVX2;
+	if (__builtin_cpu_supports("sse4.1")) return ENCODING_SSE41;
+#endif
+	return ENCODING_SCALAR;
+}
+
+// Picked once for the CPU the library is loaded on
+static uint8_t encoding_instructions = get_supported_encoding_instructions();
+static hash_words_function hash_words = get_hash_words(encoding_instructions);
+
+uint8_t get_encoding_instructions() {
+	return encoding_instructions;
+}
+
+bool set_encoding_instructions(uint8_t instructions) {
+	if (instructions > get_supported_encoding_instructions()) return false;
+	encoding_instructions = instructions;
+	hash_words = get_hash_words(instructions);
+	return true;
+}
+
+static uint64_t hash_max_kmer_scalar(const char *str, uint8_t k, uint8_t *map) {
 	uint64_t hashed = 0;
 	for (uint8_t i = 0; i < k; i++) {
 		uint64_t val = map[str[i]];
@@ -28,6 +142,34 @@ uint64_t hash_max_kmer_by_map(const char *str, uint8_t k, uint8_t *map) {
 	return hashed;
 }
 
+// Same as hash_kmer, except the bits are left-aligned in the long long.
+// This is faster, but also practical for the kmer_finder algorithm
+uint64_t hash_max_kmer_by_map(const char *str, uint8_t k, uint8_t *map) {
+	uint64_t hashed;
+	if (k == 32) {
+		hash_bases_by_map(str, 32, map, &hashed);
+		return hashed;
+	}
+	return hash_max_kmer_scalar(str, k, map);
+}
+
+// Whole words are encoded with vector instructions if the CPU has them, and words holding letters that are
+// not bases one letter at a time
+void hash_bases_by_map(const char *str, uint64_t len, uint8_t *map, uint64_t *hashes) {
+	uint64_t words = len / 32;
+	uint64_t word = 0;
+	struct base_table table;
+	if (hash_words != NULL && words > 0 && fill_base_table(&table, map)) {
+		while (true) {
+			word += hash_words(str + word * 32, words - word, &table, hashes + word);
+			if (word == words) break;
+			hashes[word] = hash_max_kmer_scalar(str + word * 32, 32, map);
+			word++;
+		}
+	}
+	for (; word < words; word++) hashes[word] = hash_max_kmer_scalar(str + word * 32, 32, map);
+	if (len % 32 != 0) hashes[words] = hash_max_kmer_scalar(str + words * 32, len % 32, map);
+}
 // Alias for intuitive usage
 uint64_t hash_kmer_by_map(char *str, uint8_t k, uint8_t *map) {
 	return hash_min_kmer_by_map(str, k, map);
@@ -3,10 +3,19 @@
 
 #include <stdint.h>
 
+// Instruction sets hash_max_kmer_by_map may encode whole words of 32 bases with
+#define ENCODING_SCALAR 0
+#define ENCODING_SSE41 1
+#define ENCODING_AVX2 2
+// Words encoded at a time by callers of hash_bases_by_map that keep them on the stack
+#define ENCODE_CHUNK_WORDS 64
+
 void fill_map_by_encoding(uint8_t *map, const char *encoding);
 uint64_t hash_min_kmer_by_map(const char *str, uint8_t k, uint8_t *map);
 uint64_t hash_max_kmer_by_map(const char *str, uint8_t k, uint8_t *map);
 uint64_t hash_kmer_by_map(char *str, uint8_t k, uint8_t *map);
+// Encodes len bases into (len + 31) / 32 words like hash_max_kmer_by_map, 32 bases to a word
+void hash_bases_by_map(const char *str, uint64_t len, uint8_t *map, uint64_t *hashes);
 uint64_t hash_min_kmer_by_encoding(const char *str, uint8_t k, const char *encoding);
 char *decode_kmer_by_map(uint64_t hash, uint8_t k, uint8_t *map);
 uint64_t pack_min_kmer(char *arr, uint8_t k);
@@ -14,5 +23,9 @@ uint64_t pack_max_kmer(char *arr, uint8_t k);
 uint64_t pack_kmer(char *arr, uint8_t k);
 uint64_t pack_max_kmer_with_offset(char *arr, uint32_t offset, uint8_t k);
 uint64_t reverse_kmer(uint64_t hash, uint8_t k);
+// The best instruction set the CPU supports is used unless a lower one is set, such as to compare them.
+// Setting it is not thread safe, and fails for instruction sets the CPU does not support.
+uint8_t get_encoding_instructions();
+bool set_encoding_instructions(uint8_t instructions);
 
 #endif
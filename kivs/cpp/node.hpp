@@ -3,15 +3,19 @@
 
 #include <stdint.h>
 
+// Nodes with at most this many bases keep them in the node itself
+#define NODE_INLINE_BASES 32
+
+// Only the fields read while traversing the graph are kept here, in 16 bytes.
+// Edges, long sequences and reference indices are stored in arrays of the owning Graph.
 struct node {
+	union {
+		// The packed, left-aligned bases of a node of up to NODE_INLINE_BASES bases
+		uint64_t sequence;
+		// Where the bases of a longer node start in the sequence arena
+		uint64_t sequence_offset;
+	};
 	uint32_t length;
-	uint64_t *sequences;
-	uint32_t sequences_len;
-	uint32_t *edges;
-	uint32_t *edges_in;
-	uint8_t edges_len;
-	uint8_t edges_in_len;
-	uint32_t reference_index;
 	bool reference;
 };
 
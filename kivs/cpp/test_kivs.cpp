@@ -5,11 +5,22 @@
 #include <string.h>
 #include <stdio.h>
 #include <unordered_map>
+#include <vector>
+#include <string>
+#include <algorithm>
 
 #include "Graph.hpp"
+#include "GraphBuilder.hpp"
 #include "hashing.hpp"
 #include "KmerFinder.hpp"
 #include "node.hpp"
+#include "VCF.hpp"
+#include "FileStream.hpp"
+#include "FASTA.hpp"
+#include "ContigDictionary.hpp"
+#include <zlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 void fill_index(Graph *graph, std::unordered_map<uint64_t, uint32_t> *index, const char **kmers, const uint32_t *counts, uint32_t len) {
 	for (uint32_t i = 0; i < len; i++) {
@@ -160,6 +171,61 @@ TEST_CASE("Test kmer hashing.") {
 	}
 }
 
+TEST_CASE("Words of bases are encoded the same with any instruction set.") {
+	const char *encodings[] = {"ACGT", "ctAG", "gAtC", "TGCA"};
+	const char letters[] = "ACGTNacgtnR\n";
+	uint8_t supported = get_encoding_instructions();
+	char bases[33];
+	uint64_t state = 42;
+	for (const char *encoding : encodings) {
+		uint8_t map[256];
+		memset(map, 0, sizeof(map));
+		fill_map_by_encoding(map, encoding);
+		for (uint32_t i = 0; i < 2000; i++) {
+			// Most words only hold bases, some have a letter that is not one
+			for (uint8_t j = 0; j < 32; j++) {
+				state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+				bases[j] = letters[(state >> 33) % ((i % 4 == 0) ? 12 : 10)];
+			}
+			bases[32] = '\0';
+			CAPTURE(bases);
+			set_encoding_instructions(ENCODING_SCALAR);
+			uint64_t expected = hash_max_kmer_by_map(bases, 32, map);
+			for (uint8_t instructions = ENCODING_SSE41; instructions <= supported; instructions++) {
+				REQUIRE(set_encoding_instructions(instructions));
+				CHECK(hash_max_kmer_by_map(bases, 32, map) == expected);
+			}
+		}
+	}
+
+	// Whole sequences are encoded the same, past words holding other letters and up to a partial last word
+	uint8_t sequence_map[256];
+	memset(sequence_map, 0, sizeof(sequence_map));
+	fill_map_by_encoding(sequence_map, "TGCA");
+	std::string sequence;
+	for (uint32_t i = 0; i < 1000; i++) sequence += (i % 97 == 13) ? 'R' : letters[(i * 7 + i / 11) % 10];
+	uint64_t hashes[32];
+	for (uint8_t instructions = ENCODING_SCALAR; instructions <= supported; instructions++) {
+		REQUIRE(set_encoding_instructions(instructions));
+		hash_bases_by_map(sequence.data(), sequence.size(), sequence_map, hashes);
+		set_encoding_instructions(ENCODING_SCALAR);
+		for (uint32_t i = 0; i < sequence.size(); i += 32) {
+			uint8_t word_len = (sequence.size() - i > 32) ? 32 : (sequence.size() - i);
+			CHECK(hashes[i / 32] == hash_max_kmer_by_map(sequence.data() + i, word_len, sequence_map));
+		}
+	}
+
+	// Maps giving the two cases of a base different codes are only read one base at a time
+	uint8_t map[256];
+	memset(map, 0, sizeof(map));
+	fill_map_by_encoding(map, "ACGT");
+	map['a'] = 3;
+	set_encoding_instructions(supported);
+	CHECK(hash_max_kmer_by_map("aAaAaAaAaAaAaAaAaAaAaAaAaAaAaAaA", 32, map) == 0xCCCCCCCCCCCCCCCCULL);
+	CHECK_FALSE(set_encoding_instructions(ENCODING_AVX2 + 1));
+	CHECK(get_encoding_instructions() == supported);
+}
+
 TEST_CASE("Kmer packing") {
 	char kmers[6][38] {
 		{0, 1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
@@ -285,6 +351,1608 @@ TEST_CASE("Test small graph.") {
 	delete graph;
 }
 
+TEST_CASE("Graph edges are stored in CSR form after finalizing.") {
+	Graph *graph = new Graph("ACGT");
+
+	uint32_t root = graph->AddNode("ACGT");
+	for (uint32_t i = 0; i < 300; i++) {
+		uint32_t leaf = graph->AddNode("A");
+		graph->AddEdge(root, leaf);
+	}
+	uint32_t sink = graph->AddNode("T");
+	graph->AddEdge(1, sink);
+	graph->AddEdge(2, sink);
+
+	graph->Finalize();
+
+	CHECK(graph->edges_len == 302);
+	CHECK(graph->GetEdgesLen(root) == 300);
+	CHECK(graph->GetEdges(root)[0] == 1);
+	CHECK(graph->GetEdges(root)[299] == 300);
+	CHECK(graph->GetEdgesInLen(root) == 0);
+	CHECK(graph->GetEdgesInLen(1) == 1);
+	CHECK(graph->GetEdgesIn(1)[0] == root);
+	REQUIRE(graph->GetEdgesInLen(sink) == 2);
+	CHECK(graph->GetEdgesIn(sink)[0] == 1);
+	CHECK(graph->GetEdgesIn(sink)[1] == 2);
+
+	SUBCASE("Edges added after finalizing are merged after existing edges") {
+		uint32_t extra = graph->AddNode("C");
+		graph->AddEdge(root, extra);
+		graph->AddEdge(extra, sink);
+		graph->Finalize();
+
+		CHECK(graph->edges_len == 304);
+		CHECK(graph->GetEdgesLen(root) == 301);
+		CHECK(graph->GetEdges(root)[300] == extra);
+		CHECK(graph->GetEdgesLen(sink) == 0);
+		REQUIRE(graph->GetEdgesInLen(sink) == 3);
+		CHECK(graph->GetEdgesIn(sink)[2] == extra);
+	}
+
+	delete graph;
+}
+
+void check_node_sequence(Graph *graph, uint32_t node_id, const char *expected) {
+	struct node *n = graph->Get(node_id);
+	uint32_t length = strlen(expected);
+	REQUIRE(n->length == length);
+	for (uint32_t i = 0; i < graph->GetSequenceWordCount(n); i++) {
+		uint8_t word_len = (length - i * 32 > 32) ? 32 : (length - i * 32);
+		char *decoded = graph->DecodeKmer(graph->GetSequence(n, i) >> (64 - word_len * 2), word_len);
+		CHECK(strncmp(decoded, expected + i * 32, word_len) == 0);
+		free(decoded);
+	}
+}
+
+TEST_CASE("Node sequences are packed inline or into a shared arena.") {
+	Graph *graph = new Graph("ACGT");
+
+	const char *sequences[] = {
+		"ACGTTGCA",
+		"G",
+		"",
+		"TTTTTTTTTTTTTTTTTTTTTTTTCAGTCA",
+		"CAT"
+	};
+	for (uint32_t i = 0; i < 5; i++) graph->AddNode(sequences[i]);
+	graph->AddEdge(0, 1);
+	graph->AddEdge(1, 2);
+	graph->AddEdge(2, 3);
+	graph->AddEdge(3, 4);
+	graph->Get(0)->reference = true;
+
+	CHECK(sizeof(struct node) == 16);
+	CHECK(graph->sequences_len == 0);
+	CHECK(graph->Get(1)->sequence == (2ULL << 62));
+	for (uint32_t i = 0; i < 5; i++) check_node_sequence(graph, i, sequences[i]);
+	CHECK(graph->GetSequence(graph->Get(1), 0) == (2ULL << 62));
+
+	SUBCASE("Nodes longer than the inline limit are stored in the arena") {
+		const char *long_sequences[] = {
+			"ACGTACGTACGTACGTACGTACGTACGTACGTACGTACGT",
+			"GATTACAGATTACAGATTACAGATTACAGATTACA"
+		};
+		uint32_t first = graph->AddNode(long_sequences[0]);
+		uint32_t second = graph->AddNode(long_sequences[1]);
+		CHECK(graph->sequences_len == 75);
+		CHECK(graph->Get(first)->sequence_offset == 0);
+		CHECK(graph->Get(second)->sequence_offset == 40);
+		check_node_sequence(graph, first, long_sequences[0]);
+		check_node_sequence(graph, second, long_sequences[1]);
+		for (uint32_t i = 0; i < 5; i++) check_node_sequence(graph, i, sequences[i]);
+	}
+
+	SUBCASE("Compressing concatenates the sequences of a chain") {
+		uint32_t *id_map = graph->Compress();
+		REQUIRE(id_map != NULL);
+		for (uint32_t i = 0; i < 5; i++) CHECK(id_map[i] == 0);
+		free(id_map);
+		REQUIRE(graph->nodes_len == 1);
+		CHECK(graph->sequences_len == 42);
+		CHECK(graph->Get(0)->sequence_offset == 0);
+		check_node_sequence(graph, 0, "ACGTTGCAGTTTTTTTTTTTTTTTTTTTTTTTTCAGTCACAT");
+	}
+
+	delete graph;
+}
+
+Graph *create_bubble_graph(uint32_t bubbles) {
+	const char *bases[] = { "A", "C", "G", "T", "GA", "" };
+	Graph *graph = new Graph("ACGT");
+	uint32_t previous = graph->AddNode("ACGT");
+	for (uint32_t i = 0; i < bubbles; i++) {
+		uint32_t chain = previous;
+		for (uint32_t j = 0; j < 3; j++) {
+			uint32_t next = graph->AddNode(bases[(i + j) % 6]);
+			graph->AddEdge(chain, next);
+			chain = next;
+		}
+		uint32_t alt_a = graph->AddNode(bases[i % 6]);
+		uint32_t alt_b = graph->AddNode("T");
+		uint32_t join = graph->AddNode("C");
+		graph->AddEdge(chain, alt_a);
+		graph->AddEdge(chain, alt_b);
+		graph->AddEdge(alt_a, join);
+		graph->AddEdge(alt_b, join);
+		previous = join;
+	}
+	return graph;
+}
+
+TEST_CASE("Compress merges chains and returns the old to new ID map.") {
+	Graph *graph = new Graph("ACGT");
+	graph->AddNode("AC");
+	graph->AddNode("G");
+	graph->AddNode("T");
+	graph->AddNode("GG");
+	graph->AddNode("A");
+	graph->AddEdge(0, 1);
+	graph->AddEdge(0, 2);
+	graph->AddEdge(1, 3);
+	graph->AddEdge(2, 3);
+	graph->AddEdge(3, 4);
+
+	uint32_t *id_map = graph->Compress(1);
+	REQUIRE(id_map != NULL);
+	REQUIRE(graph->nodes_len == 4);
+	CHECK(id_map[3] == id_map[4]);
+	check_node_sequence(graph, id_map[3], "GGA");
+	CHECK(graph->GetEdgesInLen(id_map[4]) == 2);
+	free(id_map);
+
+	CHECK(graph->Compress(1) == NULL);
+	delete graph;
+
+	SUBCASE("Cycles without a head are compressed into one node") {
+		Graph *cycle = new Graph("ACGT");
+		cycle->AddNode("A");
+		cycle->AddNode("C");
+		cycle->AddNode("G");
+		cycle->AddEdge(0, 1);
+		cycle->AddEdge(1, 2);
+		cycle->AddEdge(2, 0);
+
+		uint32_t *cycle_map = cycle->Compress(1);
+		REQUIRE(cycle_map != NULL);
+		REQUIRE(cycle->nodes_len == 1);
+		check_node_sequence(cycle, 0, "ACG");
+		REQUIRE(cycle->GetEdgesLen(0) == 1);
+		CHECK(cycle->GetEdges(0)[0] == 0);
+		free(cycle_map);
+		delete cycle;
+	}
+
+	SUBCASE("Compressing in parallel gives the same graph") {
+		Graph *serial = create_bubble_graph(40000);
+		Graph *parallel = create_bubble_graph(40000);
+		uint32_t old_nodes_len = serial->nodes_len;
+
+		uint32_t *serial_map = serial->Compress(1);
+		uint32_t *parallel_map = parallel->Compress(4);
+
+		REQUIRE(serial_map != NULL);
+		REQUIRE(parallel_map != NULL);
+		REQUIRE(serial->nodes_len == 40000 * 3 + 1);
+		REQUIRE(parallel->nodes_len == serial->nodes_len);
+		CHECK(parallel->sequences_len == serial->sequences_len);
+		CHECK(parallel->edges_len == serial->edges_len);
+		CHECK(memcmp(serial_map, parallel_map, sizeof(uint32_t) * old_nodes_len) == 0);
+		CHECK(memcmp(serial->sequences, parallel->sequences, sizeof(uint64_t) * ((serial->sequences_len + 31) / 32)) == 0);
+		CHECK(memcmp(serial->edges, parallel->edges, sizeof(uint32_t) * serial->edges_len) == 0);
+		uint32_t mismatched_nodes = 0;
+		for (uint32_t i = 0; i < serial->nodes_len; i++) {
+			if (parallel->Get(i)->length != serial->Get(i)->length ||
+			    parallel->Get(i)->sequence_offset != serial->Get(i)->sequence_offset) mismatched_nodes++;
+		}
+		CHECK(mismatched_nodes == 0);
+
+		free(serial_map);
+		free(parallel_map);
+		delete serial;
+		delete parallel;
+	}
+}
+
+TEST_CASE("Reference path lookups.") {
+	Graph *graph = new Graph("ACGT");
+	graph->AddNode("T");
+	graph->AddNode("ACGT");
+	graph->AddNode("G");
+	graph->AddNode("");
+	graph->AddNode("CC");
+	graph->AddEdge(1, 2);
+	graph->AddEdge(1, 0);
+	graph->AddEdge(2, 3);
+	graph->AddEdge(0, 3);
+	graph->AddEdge(3, 4);
+	graph->Finalize();
+	// Flagged without reference indices, which are recovered from the path
+	graph->Get(1)->reference = true;
+	graph->Get(2)->reference = true;
+	graph->Get(3)->reference = true;
+	graph->Get(4)->reference = true;
+	graph->BuildReferencePath();
+
+	REQUIRE(graph->GetReferencePathLen() == 4);
+	CHECK(graph->GetReferenceLength() == 7);
+	CHECK(graph->GetReferenceNodeID(0) == 1);
+	CHECK(graph->GetReferenceNodeID(3) == 4);
+	CHECK(graph->GetReferenceIndex(4) == 3);
+	CHECK(graph->GetRootNodeID() == 1);
+	CHECK(graph->GetLastNodeID() == 4);
+	CHECK(graph->GetNextReferenceNodeID(1) == 2);
+	CHECK(graph->GetNextReferenceNodeID(2) == 3);
+	CHECK(graph->GetPreviousReferenceNodeID(4) == 3);
+	CHECK(graph->GetReferenceOffset(2) == 4);
+	CHECK(graph->GetReferenceOffset(3) == 5);
+	CHECK(graph->GetReferenceOffset(4) == 5);
+
+	uint32_t node_id;
+	uint32_t offset;
+	REQUIRE(graph->FindReferencePosition(2, &node_id, &offset));
+	CHECK(node_id == 1);
+	CHECK(offset == 2);
+	REQUIRE(graph->FindReferencePosition(4, &node_id, &offset));
+	CHECK(node_id == 2);
+	CHECK(offset == 0);
+	REQUIRE(graph->FindReferencePosition(6, &node_id, &offset));
+	CHECK(node_id == 4);
+	CHECK(offset == 1);
+	CHECK_FALSE(graph->FindReferencePosition(7, &node_id, &offset));
+
+	SUBCASE("Adding nodes rebuilds the path") {
+		uint32_t tail = graph->AddNode("AAA");
+		graph->AddEdge(4, tail);
+		graph->Get(tail)->reference = true;
+		CHECK(graph->GetReferencePathLen() == 0);
+		graph->Finalize();
+		CHECK(graph->GetReferencePathLen() == 5);
+		CHECK(graph->GetReferenceLength() == 10);
+		CHECK(graph->GetLastNodeID() == tail);
+	}
+
+	delete graph;
+}
+
+TEST_CASE("Renumbering puts nodes in topological order.") {
+	// A bubble 0 -> (1 | 2) -> 3 followed by a chain, with scattered IDs
+	const char *sequences[] = { "CA", "TTG", "ACGT", "G", "AAC", "GT" };
+	Graph *graph = new Graph("ACGT");
+	for (uint32_t i = 0; i < 6; i++) graph->AddNode(sequences[i]);
+	graph->AddEdge(4, 0);
+	graph->AddEdge(4, 5);
+	graph->AddEdge(0, 2);
+	graph->AddEdge(5, 2);
+	graph->AddEdge(2, 1);
+	graph->AddEdge(1, 3);
+	graph->Get(4)->reference = true;
+	graph->Get(0)->reference = true;
+	graph->Get(2)->reference = true;
+
+	KmerFinder *kf = new KmerFinder(graph, 4, 31);
+	kf->Find();
+	std::vector<uint64_t> kmers_before(kf->found_kmers, kf->found_kmers + kf->found_count);
+	delete kf;
+
+	uint32_t *id_map = graph->RenumberNodes();
+	REQUIRE(id_map != NULL);
+
+	CHECK(id_map[4] == 0);
+	CHECK(id_map[0] == 1);
+	CHECK(id_map[5] == 2);
+	CHECK(id_map[2] == 3);
+	CHECK(id_map[1] == 4);
+	CHECK(id_map[3] == 5);
+	for (uint32_t i = 0; i < 6; i++) {
+		check_node_sequence(graph, id_map[i], sequences[i]);
+		for (uint32_t j = 0; j < graph->GetEdgesLen(i); j++) CHECK(graph->GetEdges(i)[j] > i);
+	}
+	CHECK(graph->Get(id_map[0])->reference);
+	CHECK_FALSE(graph->Get(id_map[5])->reference);
+	CHECK(graph->GetReferenceNodeID(1) == id_map[0]);
+	CHECK(graph->GetEdgesInLen(id_map[2]) == 2);
+
+	kf = new KmerFinder(graph, 4, 31);
+	kf->Find();
+	std::vector<uint64_t> kmers_after(kf->found_kmers, kf->found_kmers + kf->found_count);
+	delete kf;
+	std::sort(kmers_before.begin(), kmers_before.end());
+	std::sort(kmers_after.begin(), kmers_after.end());
+	CHECK(kmers_before == kmers_after);
+
+	free(id_map);
+	delete graph;
+}
+
+TEST_CASE("Version 1 graph files are still read.") {
+	char filepath[] = "test_graph_v1.bcg";
+	FILE *f = fopen(filepath, "wb");
+	fputs(BCG_FORMAT_CODE, f);
+	fputc(1, f);
+	fwrite("ACGT", sizeof(char), 4, f);
+	uint32_t nodes_len = 2;
+	fwrite(&nodes_len, sizeof(uint32_t), 1, f);
+	// ACGT with an edge to GG, both on the reference
+	uint32_t length = 4, words = 1, edge = 1;
+	uint64_t packed = 0x1BULL << 56;
+	uint8_t edges_len = 1, reference = 1;
+	fwrite(&length, sizeof(uint32_t), 1, f);
+	fwrite(&words, sizeof(uint32_t), 1, f);
+	fwrite(&packed, sizeof(uint64_t), 1, f);
+	fwrite(&edges_len, sizeof(uint8_t), 1, f);
+	fwrite(&edge, sizeof(uint32_t), 1, f);
+	fwrite(&reference, sizeof(uint8_t), 1, f);
+	length = 2;
+	packed = 0xAULL << 60;
+	edges_len = 0;
+	fwrite(&length, sizeof(uint32_t), 1, f);
+	fwrite(&words, sizeof(uint32_t), 1, f);
+	fwrite(&packed, sizeof(uint64_t), 1, f);
+	fwrite(&edges_len, sizeof(uint8_t), 1, f);
+	fwrite(&reference, sizeof(uint8_t), 1, f);
+	fclose(f);
+
+	Graph *graph = Graph::FromFile(filepath);
+	REQUIRE(graph != NULL);
+	REQUIRE(graph->nodes_len == 2);
+	check_node_sequence(graph, 0, "ACGT");
+	check_node_sequence(graph, 1, "GG");
+	REQUIRE(graph->GetEdgesLen(0) == 1);
+	CHECK(graph->GetEdges(0)[0] == 1);
+	CHECK(graph->GetReferenceLength() == 6);
+
+	// Files are written in the current version
+	graph->ToFile(filepath);
+	struct bcg_header header;
+	REQUIRE(Graph::ReadFileHeader(filepath, &header));
+	CHECK(header.version == BCG_FORMAT_VERSION);
+	CHECK(BCG_FORMAT_VERSION == 2);
+	delete graph;
+
+	remove(filepath);
+}
+
+TEST_CASE("Graph files are mapped back into memory.") {
+	Graph *graph = new Graph("ACGT");
+
+	const char *sequences[] = { "ACTGACTGACTG", "G", "T", "AT", "ACT", "", "CTGCTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTT" };
+	for (uint32_t i = 0; i < 7; i++) graph->AddNode(sequences[i]);
+	graph->AddEdge(0, 1);
+	graph->AddEdge(0, 2);
+	graph->AddEdge(1, 3);
+	graph->AddEdge(2, 3);
+	graph->AddEdge(3, 4);
+	graph->AddEdge(3, 5);
+	graph->AddEdge(4, 6);
+	graph->AddEdge(5, 6);
+	graph->Get(0)->reference = true;
+	graph->Get(1)->reference = true;
+	graph->SetReferenceIndex(1, 1);
+
+	char filepath[] = "test_graph.bcg";
+	graph->ToFile(filepath);
+	Graph *loaded = Graph::FromFile(filepath);
+
+	REQUIRE(loaded != NULL);
+	CHECK(loaded->IsMapped());
+	REQUIRE(loaded->nodes_len == 7);
+	CHECK(loaded->edges_len == 8);
+	CHECK(loaded->sequences_len == graph->sequences_len);
+	CHECK(strncmp(loaded->encoding, "ACGT", 4) == 0);
+	CHECK(loaded->Get(1)->reference);
+	CHECK(loaded->GetReferenceIndex(1) == 1);
+	CHECK_FALSE(loaded->Get(2)->reference);
+	for (uint32_t i = 0; i < 7; i++) {
+		check_node_sequence(loaded, i, sequences[i]);
+		REQUIRE(loaded->GetEdgesLen(i) == graph->GetEdgesLen(i));
+		REQUIRE(loaded->GetEdgesInLen(i) == graph->GetEdgesInLen(i));
+		for (uint32_t j = 0; j < graph->GetEdgesLen(i); j++) CHECK(loaded->GetEdges(i)[j] == graph->GetEdges(i)[j]);
+		for (uint32_t j = 0; j < graph->GetEdgesInLen(i); j++) CHECK(loaded->GetEdgesIn(i)[j] == graph->GetEdgesIn(i)[j]);
+	}
+
+	SUBCASE("Reference lookups do not copy a mapped graph") {
+		CHECK(loaded->GetReferencePathLen() == 2);
+		CHECK(loaded->GetReferenceNodeID(1) == 1);
+		CHECK(loaded->GetNextReferenceNodeID(0) == 1);
+		CHECK(loaded->GetReferenceOffset(1) == 12);
+		CHECK(loaded->GetRootNodeID() == 0);
+		CHECK(loaded->IsMapped());
+	}
+
+	SUBCASE("Modifying a mapped graph copies it to the heap") {
+		uint32_t new_node = loaded->AddNode("GGGG");
+		loaded->AddEdge(6, new_node);
+		loaded->Finalize();
+		CHECK_FALSE(loaded->IsMapped());
+		CHECK(loaded->GetEdgesInLen(new_node) == 1);
+		check_node_sequence(loaded, 6, sequences[6]);
+		check_node_sequence(loaded, new_node, "GGGG");
+	}
+
+	SUBCASE("The header records the sizes of the graph") {
+		struct bcg_header header;
+		REQUIRE(Graph::ReadFileHeader(filepath, &header));
+		CHECK(header.nodes_len == 7);
+		CHECK(header.edges_len == 8);
+		CHECK(header.sequences_len == graph->sequences_len);
+		CHECK(strncmp(header.encoding, "ACGT", 4) == 0);
+	}
+
+	SUBCASE("Unmapped graphs are read into the heap") {
+		Graph *read = Graph::FromFileUnmapped(filepath);
+		REQUIRE(read != NULL);
+		CHECK_FALSE(read->IsMapped());
+		CHECK(read->GetReferenceIndex(1) == 1);
+		for (uint32_t i = 0; i < 7; i++) {
+			check_node_sequence(read, i, sequences[i]);
+			CHECK(read->GetEdgesInLen(i) == graph->GetEdgesInLen(i));
+		}
+		delete read;
+	}
+
+	SUBCASE("Headers with counts their sections do not hold are rejected") {
+		FILE *f = fopen(filepath, "r+b");
+		struct bcg_header header;
+		REQUIRE(fread(&header, sizeof(struct bcg_header), 1, f) == 1);
+		header.nodes_len = 8;
+		fseek(f, 0, SEEK_SET);
+		fwrite(&header, sizeof(struct bcg_header), 1, f);
+		fclose(f);
+		CHECK_FALSE(Graph::ReadFileHeader(filepath, &header));
+		CHECK(Graph::FromFile(filepath) == NULL);
+		CHECK(Graph::FromFileUnmapped(filepath) == NULL);
+	}
+
+	SUBCASE("Sections with IDs or offsets outside the graph are rejected") {
+		struct bcg_header header;
+		REQUIRE(Graph::ReadFileHeader(filepath, &header));
+		REQUIRE(header.reference_path_len >= 2);
+		// Writes a value over one in a section, checks that the file is rejected and puts the value back
+		auto check_rejected = [&](enum bcg_section section, uint64_t offset, const void *value, uint64_t size) {
+			char original[8];
+			FILE *f = fopen(filepath, "r+b");
+			fseek(f, header.section_offsets[section] + offset, SEEK_SET);
+			REQUIRE(fread(original, 1, size, f) == size);
+			fseek(f, header.section_offsets[section] + offset, SEEK_SET);
+			fwrite(value, 1, size, f);
+			fclose(f);
+			CHECK(Graph::ReadFileHeader(filepath, &header));
+			CHECK(Graph::FromFile(filepath) == NULL);
+			CHECK(Graph::FromFileUnmapped(filepath) == NULL);
+			f = fopen(filepath, "r+b");
+			fseek(f, header.section_offsets[section] + offset, SEEK_SET);
+			fwrite(original, 1, size, f);
+			fclose(f);
+		};
+		uint32_t past_last_node = 7;
+		uint32_t one = 1;
+		uint32_t past_last_edge = 9;
+		uint32_t past_path_end = header.reference_path_len + 1;
+		uint64_t zero = 0;
+		check_rejected(BCG_SECTION_EDGES, 0, &past_last_node, sizeof(uint32_t));
+		check_rejected(BCG_SECTION_EDGES_IN, sizeof(uint32_t) * 3, &past_last_node, sizeof(uint32_t));
+		check_rejected(BCG_SECTION_EDGES_OFFSETS, sizeof(uint32_t) * 2, &one, sizeof(uint32_t));
+		check_rejected(BCG_SECTION_EDGES_OFFSETS, sizeof(uint32_t) * 7, &past_last_edge, sizeof(uint32_t));
+		check_rejected(BCG_SECTION_EDGES_IN_OFFSETS, 0, &one, sizeof(uint32_t));
+		check_rejected(BCG_SECTION_REFERENCE_PATH, 0, &past_last_node, sizeof(uint32_t));
+		check_rejected(BCG_SECTION_REFERENCE_RANGE_STARTS, sizeof(uint32_t), &past_path_end, sizeof(uint32_t));
+		check_rejected(BCG_SECTION_REFERENCE_OFFSETS, sizeof(uint64_t) * 2, &zero, sizeof(uint64_t));
+		// The long node's bases would run past the end of the arena
+		uint64_t past_arena = graph->sequences_len;
+		check_rejected(BCG_SECTION_NODES, sizeof(struct node) * 6, &past_arena, sizeof(uint64_t));
+
+		Graph *intact = Graph::FromFile(filepath);
+		CHECK(intact != NULL);
+		delete intact;
+	}
+
+	delete loaded;
+	delete graph;
+	remove(filepath);
+}
+
+TEST_CASE("GraphBuilder grows past its reserve hints.") {
+	GraphBuilder builder("ACGT");
+	builder.Reserve(4, 4, 16);
+
+	uint32_t previous = builder.AddReferenceNode("ACGT", 4);
+	for (uint32_t i = 1; i < 1000; i++) {
+		uint32_t next = builder.AddReferenceNode("GATTACA", 7);
+		builder.AddEdge(previous, next);
+		previous = next;
+	}
+	uint32_t empty = builder.AddNode("", 0);
+	builder.AddEdge(0, empty);
+
+	Graph *graph = builder.Build();
+
+	REQUIRE(graph->nodes_len == 1001);
+	CHECK(graph->edges_len == 1000);
+	CHECK(graph->sequences_len == 0);
+	CHECK(graph->GetReferenceIndex(999) == 999);
+	CHECK_FALSE(graph->Get(empty)->reference);
+	CHECK(graph->Get(empty)->length == 0);
+	CHECK(graph->GetEdgesLen(0) == 2);
+	CHECK(graph->GetEdgesInLen(999) == 1);
+	check_node_sequence(graph, 0, "ACGT");
+	check_node_sequence(graph, 500, "GATTACA");
+
+	// The builder starts over with an empty graph
+	CHECK(builder.GetNodesLen() == 0);
+	uint32_t first = builder.AddReferenceNode("TTT", 3);
+	builder.AddEdge(first, builder.AddReferenceNode("CC", 2));
+	Graph *next = builder.Build();
+	REQUIRE(next != graph);
+	REQUIRE(next->nodes_len == 2);
+	CHECK(next->edges_len == 1);
+	CHECK(next->GetReferenceIndex(1) == 1);
+	check_node_sequence(next, 0, "TTT");
+	CHECK(graph->nodes_len == 1001);
+
+	delete next;
+	delete graph;
+}
+
+TEST_CASE("Graphs are read from GFA files in one pass.") {
+	char gfa_filepath[] = "test_graph.gfa";
+	FILE *f = fopen(gfa_filepath, "w");
+	// Links and paths may refer to segments defined further down
+	fputs("H\tVN:Z:1.0\n"
+	      "L\t11\t+\t12\t+\t0M\n"
+	      "S\t11\tACGT\n"
+	      "P\tref\t11+,12+,14+\t*\n"
+	      "L\t11\t+\t13\t+\t0M\n"
+	      "S\t12\tC\tLN:i:1\n"
+	      "S\t13\tT\r\n"
+	      "L\t12\t+\t14\t+\t0M\n"
+	      "L\t13\t+\t14\t+\t0M\n"
+	      "S\t14\tGGA", f);
+	fclose(f);
+
+	Graph *graph = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT");
+
+	REQUIRE(graph->nodes_len == 4);
+	check_node_sequence(graph, 0, "ACGT");
+	check_node_sequence(graph, 1, "C");
+	check_node_sequence(graph, 2, "T");
+	check_node_sequence(graph, 3, "GGA");
+	CHECK(graph->IsReference(0));
+	CHECK(graph->IsReference(1));
+	CHECK_FALSE(graph->IsReference(2));
+	CHECK(graph->IsReference(3));
+	CHECK(graph->GetReferenceIndex(3) == 2);
+	REQUIRE(graph->GetEdgesLen(0) == 2);
+	CHECK(graph->GetEdges(0)[0] == 1);
+	CHECK(graph->GetEdges(0)[1] == 2);
+	REQUIRE(graph->GetEdgesInLen(3) == 2);
+	CHECK(graph->GetEdgesIn(3)[0] == 1);
+	CHECK(graph->GetEdgesIn(3)[1] == 2);
+
+	delete graph;
+	remove(gfa_filepath);
+
+	CHECK(Graph::FromGFAFileEncoded(gfa_filepath, "ACGT") == NULL);
+}
+
+TEST_CASE("GFA segment names are remapped through a hash table.") {
+	char gfa_filepath[] = "test_names.gfa";
+	FILE *f = fopen(gfa_filepath, "w");
+	fputs("S\tutg7\tAC\n"
+	      "S\t100\tG\n"
+	      "S\tutg70\tTT\n"
+	      "L\tutg7\t+\t100\t+\t0M\n"
+	      "L\t100\t-\tutg70\t-\t0M\n"
+	      "L\tutg7\t+\tmissing\t+\t0M\n"
+	      "P\tref\tutg7+,utg70-\t*\n", f);
+	fclose(f);
+
+	Graph *graph = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT");
+
+	// Segments with arbitrary names are numbered in file order
+	REQUIRE(graph->nodes_len == 3);
+	check_node_sequence(graph, 0, "AC");
+	check_node_sequence(graph, 1, "G");
+	check_node_sequence(graph, 2, "TT");
+	REQUIRE(graph->GetEdgesLen(0) == 1);
+	CHECK(graph->GetEdges(0)[0] == 1);
+	REQUIRE(graph->GetEdgesLen(1) == 1);
+	CHECK(graph->GetEdges(1)[0] == 2);
+	CHECK(graph->IsReference(0));
+	CHECK_FALSE(graph->IsReference(1));
+	CHECK(graph->IsReference(2));
+	CHECK(graph->GetReferenceIndex(2) == 1);
+
+	delete graph;
+	remove(gfa_filepath);
+}
+
+TEST_CASE("Repeated numeric GFA segment names are remapped through a hash table.") {
+	char gfa_filepath[] = "test_repeated_names.gfa";
+	FILE *f = fopen(gfa_filepath, "w");
+	// As many names as the range 1 to 3 is wide, but 2 is missing
+	fputs("S\t1\tAC\n"
+	      "S\t1\tG\n"
+	      "S\t3\tTT\n"
+	      "L\t1\t+\t3\t+\t0M\n", f);
+	fclose(f);
+
+	Graph *graph = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT");
+
+	REQUIRE(graph->nodes_len == 3);
+	check_node_sequence(graph, 0, "AC");
+	check_node_sequence(graph, 1, "G");
+	check_node_sequence(graph, 2, "TT");
+	REQUIRE(graph->GetEdgesLen(0) == 1);
+	CHECK(graph->GetEdges(0)[0] == 2);
+	CHECK(graph->GetEdgesLen(1) == 0);
+
+	delete graph;
+	remove(gfa_filepath);
+}
+
+TEST_CASE("Long GFA segments are packed whole into the sequence arena.") {
+	char gfa_filepath[] = "test_long.gfa";
+	const char *long_sequence = "ACGTTGCAACGTTGCAACGTTGCAACGTTGCAGGGGCCCCAAAATTTTACGTACGTACGTACGTACGTAC";
+	const char *longer_sequence = "TTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTG";
+	FILE *f = fopen(gfa_filepath, "w");
+	fprintf(f, "S\t1\t%s\nS\t2\tCA\nS\t3\t%s\nL\t1\t+\t2\t+\t0M\nL\t2\t+\t3\t+\t0M\n",
+	        long_sequence, longer_sequence);
+	fclose(f);
+
+	Graph *graph = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT");
+
+	REQUIRE(graph->nodes_len == 3);
+	check_node_sequence(graph, 0, long_sequence);
+	check_node_sequence(graph, 1, "CA");
+	check_node_sequence(graph, 2, longer_sequence);
+	CHECK(graph->sequences_len == strlen(long_sequence) + strlen(longer_sequence));
+
+	// Graphs with nodes longer than NODE_INLINE_BASES are taken to be compressed already
+	CHECK(graph->Compress() == NULL);
+	CHECK(graph->nodes_len == 3);
+
+	delete graph;
+	remove(gfa_filepath);
+}
+
+TEST_CASE("GFA files are parsed the same on any number of threads.") {
+	// Numeric IDs without gaps are offset, others go through the ID map
+	for (uint32_t id_step : {1, 3}) {
+		char gfa_filepath[] = "test_threads.gfa";
+		const char *bases = "ACGT";
+		FILE *f = fopen(gfa_filepath, "w");
+		// Bubbles of segments with a range of lengths, so chunks split every record type
+		for (uint32_t i = 0; i < 3000; i++) {
+			fprintf(f, "S\t%u\t", i * id_step);
+			for (uint32_t j = 0; j < 1 + (i * 7) % 90; j++) fputc(bases[(i + j * j) % 4], f);
+			fputc('\n', f);
+			if (i % 3 != 2 && i > 0) fprintf(f, "L\t%u\t+\t%u\t+\t0M\n", (i - 1 - i % 3) * id_step, i * id_step);
+			if (i % 3 == 2) {
+				fprintf(f, "L\t%u\t+\t%u\t+\t0M\n", (i - 2) * id_step, i * id_step);
+				fprintf(f, "L\t%u\t+\t%u\t+\t0M\n", (i - 1) * id_step, i * id_step);
+			}
+		}
+		fputs("P\tref", f);
+		for (uint32_t i = 0; i < 3000; i++) {
+			if (i % 3 != 1) fprintf(f, "%c%u+", (i == 0) ? '\t' : ',', i * id_step);
+		}
+		fputs("\t*\n", f);
+		fclose(f);
+
+		Graph *expected = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT", 1);
+		REQUIRE(expected->nodes_len == 3000);
+
+		for (uint32_t thread_count : {2, 3, 7}) {
+			Graph *graph = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT", thread_count);
+			REQUIRE(graph->nodes_len == expected->nodes_len);
+			REQUIRE(graph->edges_len == expected->edges_len);
+			CHECK(graph->sequences_len == expected->sequences_len);
+			for (uint32_t node_id = 0; node_id < graph->nodes_len; node_id++) {
+				struct node *node = graph->Get(node_id);
+				struct node *expected_node = expected->Get(node_id);
+				REQUIRE(node->length == expected_node->length);
+				CHECK(node->reference == expected_node->reference);
+				CHECK(graph->GetReferenceIndex(node_id) == expected->GetReferenceIndex(node_id));
+				for (uint32_t i = 0; i < graph->GetSequenceWordCount(node); i++) {
+					CHECK(graph->GetSequence(node, i) == expected->GetSequence(expected_node, i));
+				}
+				REQUIRE(graph->GetEdgesLen(node_id) == expected->GetEdgesLen(node_id));
+				for (uint32_t i = 0; i < graph->GetEdgesLen(node_id); i++) {
+					CHECK(graph->GetEdges(node_id)[i] == expected->GetEdges(node_id)[i]);
+				}
+			}
+			delete graph;
+		}
+
+		delete expected;
+		remove(gfa_filepath);
+	}
+}
+
+TEST_CASE("Graphs are written to GFA files and read back unchanged.") {
+	char gfa_filepath[] = "test_export.gfa";
+	Graph *graph = create_bubble_graph(500);
+	// The reference takes the first branch of every bubble
+	for (uint32_t node_id = 0; node_id < graph->nodes_len; node_id++) {
+		graph->SetReference(node_id, node_id % 6 != 5);
+	}
+	uint32_t tail = graph->AddNode("ACGTTGCAACGTTGCAACGTTGCAACGTTGCAGGGGCCCCAAAATTTTACG");
+	graph->AddEdge(tail - 1, tail);
+	graph->SetReference(tail, true);
+	REQUIRE(graph->sequences_len > 0);
+
+	graph->ToGFAFile(gfa_filepath);
+
+	FILE *f = fopen(gfa_filepath, "r");
+	char line[64];
+	REQUIRE(fgets(line, sizeof(line), f) != NULL);
+	CHECK(strcmp(line, "H\tVN:Z:1.0\n") == 0);
+	fclose(f);
+
+	Graph *loaded = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT");
+	REQUIRE(loaded->nodes_len == graph->nodes_len);
+	REQUIRE(loaded->edges_len == graph->edges_len);
+	CHECK(loaded->GetReferencePathLen() == graph->GetReferencePathLen());
+	CHECK(loaded->GetReferenceLength() == graph->GetReferenceLength());
+	for (uint32_t node_id = 0; node_id < graph->nodes_len; node_id++) {
+		struct node *node = graph->Get(node_id);
+		struct node *loaded_node = loaded->Get(node_id);
+		REQUIRE(loaded_node->length == node->length);
+		CHECK(loaded->IsReference(node_id) == graph->IsReference(node_id));
+		CHECK(loaded->GetReferenceIndex(node_id) == graph->GetReferenceIndex(node_id));
+		for (uint32_t i = 0; i < graph->GetSequenceWordCount(node); i++) {
+			CHECK(loaded->GetSequence(loaded_node, i) == graph->GetSequence(node, i));
+		}
+		REQUIRE(loaded->GetEdgesLen(node_id) == graph->GetEdgesLen(node_id));
+		for (uint32_t i = 0; i < graph->GetEdgesLen(node_id); i++) {
+			CHECK(loaded->GetEdges(node_id)[i] == graph->GetEdges(node_id)[i]);
+		}
+	}
+
+	delete loaded;
+	delete graph;
+	remove(gfa_filepath);
+}
+
+TEST_CASE("VCF files are read in one pass, skipping the sample columns.") {
+	char vcf_filepath[] = "test_read.vcf";
+	FILE *f = fopen(vcf_filepath, "w");
+	fputs("##fileformat=VCFv4.2\n#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tS1\n", f);
+	// Sample columns far longer than any fixed line buffer
+	fputs("1\t10\t.\tAC\tAT\t.\t.\t.\tGT", f);
+	for (uint32_t i = 0; i < 5000; i++) fputs("\t0|1", f);
+	fputs("\n2\t20\t.\tG\tA\n", f);
+	fputs("1\t30\t.\tA\t<DEL>\n", f);
+	fputs("1\t40\t.\tTG\tTA,TC\r\n", f);
+	fputs("1\t50\t.\t", f);
+	for (uint32_t i = 0; i < 1000; i++) fputc("ACGT"[i % 4], f);
+	fputs("\tA", f);
+	fclose(f);
+
+	VCF *vcf = VCF::ReadFile(vcf_filepath, 1);
+	REQUIRE(vcf->length == 3);
+	CHECK(vcf->positions[0] == 10);
+	CHECK(std::string(vcf->GetReference(0), vcf->reference_lengths[0]) == "C");
+	REQUIRE(vcf->variant_counts[0] == 1);
+	CHECK(std::string(vcf->GetVariant(0, 0), vcf->GetVariantLength(0, 0)) == "T");
+	CHECK(vcf->positions[1] == 40);
+	CHECK(std::string(vcf->GetReference(1), vcf->reference_lengths[1]) == "G");
+	REQUIRE(vcf->variant_counts[1] == 2);
+	CHECK(std::string(vcf->GetVariant(1, 0), vcf->GetVariantLength(1, 0)) == "A");
+	CHECK(std::string(vcf->GetVariant(1, 1), vcf->GetVariantLength(1, 1)) == "C");
+	CHECK(vcf->positions[2] == 50);
+	CHECK(vcf->reference_lengths[2] == 999);
+	REQUIRE(vcf->variant_counts[2] == 1);
+	CHECK(vcf->GetVariantLength(2, 0) == 0);
+	delete vcf;
+
+	vcf = VCF::ReadFile(vcf_filepath, -1);
+	CHECK(vcf->length == 4);
+	CHECK(vcf->chromosomes[1] == 2);
+	delete vcf;
+
+	remove(vcf_filepath);
+	CHECK(VCF::ReadFile(vcf_filepath, -1) == NULL);
+}
+
+TEST_CASE("VCF alleles are stored in one arena and split per allele.") {
+	char vcf_filepath[] = "test_alleles.vcf";
+	FILE *f = fopen(vcf_filepath, "w");
+	fputs("1\t10\t.\tAT\tA,ATT,AG\n"
+	      "1\t20\t.\tC\t.\n"
+	      "1\t30\t.\tGA\tTC\n", f);
+	fclose(f);
+
+	VCF *vcf = VCF::ReadFile(vcf_filepath, 1);
+	REQUIRE(vcf->length == 3);
+	// The A all alleles start with is left out
+	CHECK(vcf->positions[0] == 10);
+	CHECK(std::string(vcf->GetReference(0), vcf->reference_lengths[0]) == "T");
+	REQUIRE(vcf->variant_counts[0] == 3);
+	CHECK(vcf->GetVariantLength(0, 0) == 0);
+	CHECK(std::string(vcf->GetVariant(0, 1), vcf->GetVariantLength(0, 1)) == "TT");
+	CHECK(std::string(vcf->GetVariant(0, 2), vcf->GetVariantLength(0, 2)) == "G");
+	CHECK(vcf->variant_counts[1] == 0);
+	CHECK(std::string(vcf->GetReference(2), vcf->reference_lengths[2]) == "GA");
+	CHECK(std::string(vcf->GetVariant(2, 0), vcf->GetVariantLength(2, 0)) == "TC");
+	CHECK(vcf->variants_len == 4);
+	CHECK(vcf->alleles_len == strlen("T" "TT" "G" "C" "GA" "TC"));
+	delete vcf;
+
+	remove(vcf_filepath);
+}
+
+TEST_CASE("Graphs are built from a FASTA and a VCF file.") {
+	char fasta_filepath[] = "test_graph.fa";
+	char vcf_filepath[] = "test_graph.vcf";
+	FILE *f = fopen(fasta_filepath, "w");
+	fputs(">1\nAAAACCCCGG\nGGTTTT\n", f);
+	fclose(f);
+	f = fopen(vcf_filepath, "w");
+	fputs("#CHROM\tPOS\tID\tREF\tALT\n1\t5\t.\tC\tT\n", f);
+	fclose(f);
+
+	Graph *graph = Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, 1, "ACGT");
+
+	REQUIRE(graph->nodes_len == 4);
+	check_node_sequence(graph, 0, "AAAA");
+	check_node_sequence(graph, 1, "C");
+	check_node_sequence(graph, 2, "T");
+	check_node_sequence(graph, 3, "CCCGGGGTTTT");
+	CHECK(graph->Get(0)->reference);
+	CHECK(graph->Get(1)->reference);
+	CHECK(graph->GetReferenceIndex(1) == 1);
+	CHECK_FALSE(graph->Get(2)->reference);
+	REQUIRE(graph->GetEdgesLen(0) == 2);
+	CHECK(graph->GetEdges(0)[0] == 1);
+	CHECK(graph->GetEdges(0)[1] == 2);
+	REQUIRE(graph->GetEdgesInLen(3) == 2);
+
+	delete graph;
+	remove(fasta_filepath);
+	remove("test_graph.fa.fai");
+	remove(vcf_filepath);
+}
+
+TEST_CASE("Whole genomes are built one contig per thread, by contig name.") {
+	char fasta_filepath[] = "test_genome.fa";
+	char vcf_filepath[] = "test_genome.vcf";
+	FILE *f = fopen(fasta_filepath, "w");
+	fputs(">chr1 first\nAAAACCCCGG\nGGTTTT\n>chrX\nACGTACGTAC\n>MT\nGGGG\n", f);
+	fclose(f);
+	f = fopen(vcf_filepath, "w");
+	fputs("##contig=<ID=chrX,length=10>\n"
+	      "##contig=<ID=chr1,length=16>\n"
+	      "#CHROM\tPOS\tID\tREF\tALT\n"
+	      "chrX\t8\t.\tT\tC,G\n"
+	      "chr1\t5\t.\tC\tT\n"
+	      "chrX\t3\t.\tG\tA\n"
+	      "chrUn\t1\t.\tA\tT\n", f);
+	fclose(f);
+
+	VCF *vcf = VCF::ReadFile(vcf_filepath, -1);
+	REQUIRE(vcf->contigs->contigs_len == 3);
+	CHECK(strcmp(vcf->contigs->GetName(0), "chrX") == 0);
+	CHECK(vcf->contigs->lengths[1] == 16);
+	CHECK(vcf->contig_ids[0] == 0);
+	CHECK(vcf->contig_ids[1] == 1);
+	CHECK(vcf->contig_ids[3] == 2);
+	CHECK(vcf->contigs->Find("chrY", 4) == UINT32_MAX);
+	delete vcf;
+
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	ContigDictionary *contigs = fasta->ReadContigs();
+	REQUIRE(contigs->contigs_len == 3);
+	CHECK(strcmp(contigs->GetName(0), "chr1") == 0);
+	CHECK(strcmp(contigs->GetName(2), "MT") == 0);
+	delete contigs;
+	REQUIRE(fasta->GoToContig("chrX"));
+	CHECK(strcmp(fasta->ReadNext(4), "ACGT") == 0);
+	CHECK_FALSE(fasta->GoToContig("chr"));
+	delete fasta;
+
+	std::vector<Graph *> graphs;
+	for (uint32_t threads = 1; threads <= 3; threads += 2) {
+		Graph *graph = Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, -1, "ACGT", threads);
+		REQUIRE(graph->contigs_len == 3);
+		CHECK(strcmp(graph->GetContigName(0), "chr1") == 0);
+		CHECK(strcmp(graph->GetContigName(1), "chrX") == 0);
+		CHECK(strcmp(graph->GetContigName(2), "MT") == 0);
+		for (uint32_t contig = 0; contig < 3; contig++) {
+			CHECK(graph->GetEdgesInLen(graph->GetContigRootNodeID(contig)) == 0);
+		}
+		// chr1 as in the single chromosome build, then chrX with two variants, then MT alone
+		uint32_t chrx = graph->GetContigRootNodeID(1);
+		check_node_sequence(graph, 0, "AAAA");
+		check_node_sequence(graph, 3, "CCCGGGGTTTT");
+		CHECK(chrx == 4);
+		check_node_sequence(graph, chrx, "AC");
+		REQUIRE(graph->GetEdgesLen(chrx) == 2);
+		check_node_sequence(graph, graph->GetContigRootNodeID(2), "GGGG");
+		CHECK(graph->nodes_len == 4 + 8 + 1);
+
+		// Every contig has a reference path of its own, with coordinates starting from 0.
+		// The tail of a contig after its last variant is not flagged as reference, so MT has none.
+		REQUIRE(graph->IsReference(1));
+		CHECK(graph->GetReferenceNodeID(graph->GetReferenceIndex(1) + 1) == chrx);
+		CHECK(graph->GetNextReferenceNodeID(0) == 1);
+		CHECK(graph->GetNextReferenceNodeID(1) == 0);
+		CHECK(graph->GetPreviousReferenceNodeID(chrx) == 0);
+		CHECK(graph->GetReferenceOffset(1) == 4);
+		CHECK(graph->GetReferenceOffset(chrx) == 0);
+		CHECK(graph->GetReferenceOffset(chrx + 3) == 3);
+		CHECK(graph->GetReferenceLength() == 5 + 8);
+		uint32_t node_id;
+		uint32_t offset;
+		CHECK_FALSE(graph->FindReferencePosition(5, &node_id, &offset));
+		REQUIRE(graph->FindReferencePosition(4, &node_id, &offset));
+		CHECK(node_id == 1);
+		CHECK(offset == 0);
+		REQUIRE(graph->FindReferencePosition(0, &node_id, &offset, 1));
+		CHECK(node_id == chrx);
+		CHECK(offset == 0);
+		REQUIRE(graph->FindReferencePosition(7, &node_id, &offset, 1));
+		CHECK(node_id == chrx + 4);
+		CHECK(offset == 0);
+		CHECK_FALSE(graph->FindReferencePosition(8, &node_id, &offset, 1));
+		CHECK_FALSE(graph->FindReferencePosition(0, &node_id, &offset, 2));
+		CHECK_FALSE(graph->FindReferencePosition(0, &node_id, &offset, 3));
+		graphs.push_back(graph);
+	}
+	REQUIRE(graphs[0]->nodes_len == graphs[1]->nodes_len);
+	REQUIRE(graphs[0]->edges_len == graphs[1]->edges_len);
+	for (uint32_t node_id = 0; node_id < graphs[0]->nodes_len; node_id++) {
+		CHECK(graphs[0]->GetNodeLength(node_id) == graphs[1]->GetNodeLength(node_id));
+		CHECK(graphs[0]->GetSequence(graphs[0]->Get(node_id), 0) == graphs[1]->GetSequence(graphs[1]->Get(node_id), 0));
+		REQUIRE(graphs[0]->GetEdgesLen(node_id) == graphs[1]->GetEdgesLen(node_id));
+		for (uint32_t i = 0; i < graphs[0]->GetEdgesLen(node_id); i++) {
+			CHECK(graphs[0]->GetEdges(node_id)[i] == graphs[1]->GetEdges(node_id)[i]);
+		}
+	}
+
+	// Graph files keep the contigs and the path of each
+	char graph_filepath[] = "test_genome.bcg";
+	graphs[0]->ToFile(graph_filepath);
+	for (uint8_t map = 0; map < 2; map++) {
+		Graph *loaded = map ? Graph::FromFile(graph_filepath) : Graph::FromFileUnmapped(graph_filepath);
+		REQUIRE(loaded != NULL);
+		CHECK(loaded->IsMapped() == (map == 1));
+		REQUIRE(loaded->contigs_len == 3);
+		for (uint32_t contig = 0; contig < 3; contig++) {
+			CHECK(strcmp(loaded->GetContigName(contig), graphs[0]->GetContigName(contig)) == 0);
+			CHECK(loaded->GetContigRootNodeID(contig) == graphs[0]->GetContigRootNodeID(contig));
+		}
+		REQUIRE(loaded->GetReferencePathLen() == graphs[0]->GetReferencePathLen());
+		for (uint32_t i = 0; i < loaded->GetReferencePathLen(); i++) {
+			CHECK(loaded->GetReferenceNodeID(i) == graphs[0]->GetReferenceNodeID(i));
+		}
+		uint32_t chrx = loaded->GetContigRootNodeID(1);
+		CHECK(loaded->GetNextReferenceNodeID(1) == 0);
+		CHECK(loaded->GetReferenceOffset(chrx + 3) == 3);
+		uint32_t node_id;
+		uint32_t offset;
+		REQUIRE(loaded->FindReferencePosition(7, &node_id, &offset, 1));
+		CHECK(node_id == chrx + 4);
+		CHECK(loaded->IsMapped() == (map == 1));
+
+		// A modified graph builds its path again, from the contigs it was loaded with
+		uint32_t node = loaded->AddNode("A");
+		loaded->AddEdge(chrx, node);
+		loaded->Finalize();
+		CHECK_FALSE(loaded->IsMapped());
+		CHECK(loaded->GetReferencePathLen() == graphs[0]->GetReferencePathLen());
+		CHECK(loaded->GetNextReferenceNodeID(1) == 0);
+		CHECK(loaded->GetReferenceOffset(chrx + 3) == 3);
+		delete loaded;
+	}
+	remove(graph_filepath);
+
+	// GFA files get a path for every contig with reference nodes, which MT has none of
+	char gfa_filepath[] = "test_genome.gfa";
+	graphs[0]->ToGFAFile(gfa_filepath);
+	f = fopen(gfa_filepath, "r");
+	char line[256];
+	std::vector<std::string> paths;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == 'P') paths.push_back(line);
+	}
+	fclose(f);
+	REQUIRE(paths.size() == 2);
+	CHECK(paths[0] == "P\tchr1\t1+,2+\t*\n");
+	CHECK(paths[1] == "P\tchrX\t5+,6+,8+,9+\t*\n");
+
+	Graph *loaded = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT");
+	REQUIRE(loaded->nodes_len == graphs[0]->nodes_len);
+	REQUIRE(loaded->edges_len == graphs[0]->edges_len);
+	CHECK(loaded->GetReferencePathLen() == graphs[0]->GetReferencePathLen());
+	CHECK(loaded->GetReferenceLength() == graphs[0]->GetReferenceLength());
+	for (uint32_t node_id = 0; node_id < loaded->nodes_len; node_id++) {
+		CHECK(loaded->GetNodeLength(node_id) == graphs[0]->GetNodeLength(node_id));
+		CHECK(loaded->GetSequence(loaded->Get(node_id), 0) == graphs[0]->GetSequence(graphs[0]->Get(node_id), 0));
+		CHECK(loaded->IsReference(node_id) == graphs[0]->IsReference(node_id));
+		REQUIRE(loaded->GetEdgesLen(node_id) == graphs[0]->GetEdgesLen(node_id));
+		for (uint32_t i = 0; i < loaded->GetEdgesLen(node_id); i++) {
+			CHECK(loaded->GetEdges(node_id)[i] == graphs[0]->GetEdges(node_id)[i]);
+		}
+	}
+	delete loaded;
+	remove(gfa_filepath);
+
+	for (Graph *graph : graphs) delete graph;
+
+	remove(fasta_filepath);
+	remove("test_genome.fa.fai");
+	remove(vcf_filepath);
+}
+
+static void write_gzip(const char *filepath, const char *data, uint64_t len) {
+	gzFile f = gzopen(filepath, "wb");
+	gzwrite(f, data, len);
+	gzclose(f);
+}
+
+static void write_bgzf_block(FILE *f, const char *data, uint32_t len) {
+	uint8_t compressed[70000];
+	z_stream stream;
+	memset(&stream, 0, sizeof(z_stream));
+	deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	stream.next_in = (Bytef *) data;
+	stream.avail_in = len;
+	stream.next_out = compressed;
+	stream.avail_out = sizeof(compressed);
+	deflate(&stream, Z_FINISH);
+	uint32_t compressed_len = stream.total_out;
+	deflateEnd(&stream);
+
+	uint32_t block_size = 18 + compressed_len + 8 - 1;
+	uint8_t header[18] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+		(uint8_t) block_size, (uint8_t) (block_size >> 8)};
+	uint32_t crc = crc32(0, (const Bytef *) data, len);
+	uint8_t footer[8] = {(uint8_t) crc, (uint8_t) (crc >> 8), (uint8_t) (crc >> 16), (uint8_t) (crc >> 24),
+		(uint8_t) len, (uint8_t) (len >> 8), (uint8_t) (len >> 16), (uint8_t) (len >> 24)};
+	fwrite(header, 1, 18, f);
+	fwrite(compressed, 1, compressed_len, f);
+	fwrite(footer, 1, 8, f);
+}
+
+static void write_bgzf(const char *filepath, const char *data, uint64_t len, uint32_t block_len) {
+	FILE *f = fopen(filepath, "wb");
+	for (uint64_t i = 0; i < len; i += block_len) {
+		write_bgzf_block(f, data + i, (len - i < block_len) ? len - i : block_len);
+	}
+	// End of file marker
+	write_bgzf_block(f, "", 0);
+	fclose(f);
+}
+
+TEST_CASE("Whole genomes read the FASTA index once, or gzip files in one pass.") {
+	char fasta_filepath[] = "test_genome_shared.fa";
+	char gzip_filepath[] = "test_genome_shared.fa.gz";
+	char vcf_filepath[] = "test_genome_shared.vcf";
+	const char fasta_text[] = ">chr1\nAAAACCCCGG\nGGTTTT\n>chrX\nACGTACGTAC\n>MT\nGGGG\n";
+	FILE *f = fopen(fasta_filepath, "w");
+	fputs(fasta_text, f);
+	fclose(f);
+	write_gzip(gzip_filepath, fasta_text, strlen(fasta_text));
+	f = fopen(vcf_filepath, "w");
+	fputs("#CHROM\tPOS\tID\tREF\tALT\n"
+	      "chrX\t8\t.\tT\tC,G\n"
+	      "chr1\t5\t.\tC\tT\n"
+	      "chrX\t3\t.\tG\tA\n", f);
+	fclose(f);
+
+	// Readers sharing an index seek without a .fai file of their own
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	REQUIRE(fasta->GetIndex() != NULL);
+	remove("test_genome_shared.fa.fai");
+	FASTA *shared = FASTA::ReadFile(fasta_filepath, fasta->GetIndex(), 1);
+	REQUIRE(shared->GetIndex() == fasta->GetIndex());
+	REQUIRE(shared->GoToContig("MT"));
+	CHECK(strcmp(shared->ReadNext(4), "GGGG") == 0);
+	REQUIRE(shared->GoToContig("chrX"));
+	CHECK(strcmp(shared->ReadNext(4), "ACGT") == 0);
+	delete shared;
+	delete fasta;
+
+	// Without an index, contigs are searched from the current position before the start
+	FASTA *gzip = FASTA::ReadFile(gzip_filepath);
+	REQUIRE(gzip->GetIndex() == NULL);
+	REQUIRE(gzip->GoToContig("chrX"));
+	CHECK(strcmp(gzip->ReadNext(4), "ACGT") == 0);
+	REQUIRE(gzip->GoToContig("MT"));
+	CHECK(strcmp(gzip->ReadNext(4), "GGGG") == 0);
+	REQUIRE(gzip->GoToContig("chr1"));
+	CHECK(strcmp(gzip->ReadNext(4), "AAAA") == 0);
+	CHECK_FALSE(gzip->GoToContig("chrY"));
+	delete gzip;
+
+	Graph *plain = Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, -1, "ACGT", 3);
+	Graph *compressed = Graph::FromFastaVCFEncoded(gzip_filepath, vcf_filepath, -1, "ACGT", 3);
+	REQUIRE(compressed != NULL);
+	REQUIRE(compressed->contigs_len == 3);
+	REQUIRE(compressed->nodes_len == plain->nodes_len);
+	REQUIRE(compressed->edges_len == plain->edges_len);
+	for (uint32_t node_id = 0; node_id < plain->nodes_len; node_id++) {
+		CHECK(compressed->GetNodeLength(node_id) == plain->GetNodeLength(node_id));
+		CHECK(compressed->GetSequence(compressed->Get(node_id), 0) == plain->GetSequence(plain->Get(node_id), 0));
+	}
+	delete compressed;
+	delete plain;
+
+	remove(fasta_filepath);
+	remove("test_genome_shared.fa.fai");
+	remove(gzip_filepath);
+	remove(vcf_filepath);
+}
+
+TEST_CASE("FASTA bases are read in runs and packed without ASCII copies.") {
+	char fasta_filepath[] = "test_packed.fa.gz";
+	// Over one decompressed chunk of mixed case bases, with CRLF line breaks and a skipped IUPAC code
+	std::string bases;
+	std::string text = ">1\r\n";
+	uint64_t seed = 7;
+	for (uint32_t i = 0; i < 5000000; i++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		char base = "ACGTNacgtn"[(seed >> 33) % 10];
+		bases += base;
+		text += base;
+		if (i % 61 == 60) text += "\r\n";
+		if (i % 1000 == 999) text += 'R';
+	}
+	text += "\n>2\nGATTACA\n";
+	write_gzip(fasta_filepath, text.data(), text.size());
+
+	uint8_t map[256];
+	memset(map, 0, sizeof(map));
+	fill_map_by_encoding(map, "ACGT");
+
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	REQUIRE(fasta->GoToChromosome(1));
+	uint64_t position = 0;
+	const uint32_t counts[] = {1, 31, 32, 33, 1000, 100000, 4000000};
+	for (uint32_t count : counts) {
+		uint32_t read = fasta->ReadNextPacked(count, map);
+		REQUIRE(read == count);
+		for (uint32_t i = 0; i < read; i += 32) {
+			uint8_t word_len = (read - i > 32) ? 32 : (read - i);
+			CHECK(fasta->packed[i / 32] == hash_max_kmer_by_map(bases.data() + position + i, word_len, map));
+		}
+		position += read;
+	}
+	char *rest = fasta->ReadNext(bases.size());
+	REQUIRE(rest != NULL);
+	CHECK(std::string(rest) == bases.substr(position));
+	// Reading stops at the next header, which is still found afterwards
+	CHECK(fasta->ReadNextPacked(10, map) == 0);
+	REQUIRE(fasta->GoToChromosome(2));
+	CHECK(fasta->ReadNextPacked(100, map) == 7);
+	CHECK(fasta->packed[0] == hash_max_kmer_by_map("GATTACA", 7, map));
+	delete fasta;
+
+	remove(fasta_filepath);
+}
+
+TEST_CASE("The reference after the last variant is read once, in whole words.") {
+	char fasta_filepath[] = "test_tail.fa.gz";
+	char vcf_filepath[] = "test_tail.vcf";
+	const char bases[] = "ACGT";
+	std::string sequence;
+	for (uint32_t i = 0; i < 2500007; i++) sequence += bases[(i * 13 + i / 3) % 4];
+	std::string text = ">1\n";
+	for (uint32_t i = 0; i < sequence.size(); i += 61) text += sequence.substr(i, 61) + "\n";
+	text += ">2\nGGGG\n";
+	write_gzip(fasta_filepath, text.data(), text.size());
+	FILE *f = fopen(vcf_filepath, "w");
+	fprintf(f, "#CHROM\tPOS\tID\tREF\tALT\n1\t4\t.\t%c\tN\n", sequence[3]);
+	fclose(f);
+
+	Graph *graph = Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, 1, "ACGT");
+	REQUIRE(graph->nodes_len == 4);
+	check_node_sequence(graph, 0, sequence.substr(0, 3).c_str());
+	check_node_sequence(graph, 3, sequence.substr(4).c_str());
+	CHECK(graph->GetEdgesInLen(3) == 2);
+	delete graph;
+
+	remove(fasta_filepath);
+	remove(vcf_filepath);
+}
+
+TEST_CASE("Pipelined builds match builds from a VCF read whole.") {
+	char fasta_filepath[] = "test_pipeline.fa";
+	char vcf_filepath[] = "test_pipeline.vcf.gz";
+	const char bases[] = "ACGT";
+	std::string sequence;
+	for (uint32_t i = 0; i < 3000000; i++) sequence += bases[(i * 11 + i / 7) % 4];
+	std::string text = ">2\nACGT\n>1\n";
+	for (uint32_t i = 0; i < sequence.size(); i += 80) text += sequence.substr(i, 80) + "\n";
+	FILE *f = fopen(fasta_filepath, "w");
+	fputs(text.c_str(), f);
+	fclose(f);
+
+	// Enough records for several batches, some of them overlapping the one before
+	std::string vcf = "#CHROM\tPOS\tID\tREF\tALT\tQUAL\n";
+	char line[128];
+	for (uint64_t position = 10; position < 2900000; position += 53 + position % 37) {
+		uint32_t ref_len = 1 + position % 3;
+		char alt = bases[(position + 1) % 4];
+		snprintf(line, sizeof(line), "1\t%lu\t.\t%s\t%c,%c%c\t.\n", position, sequence.substr(position - 1, ref_len).c_str(), alt, alt, alt);
+		vcf += line;
+		if (position % 5 == 0) {
+			snprintf(line, sizeof(line), "1\t%lu\t.\t%c\t%c\t.\n", position + 1, sequence[position], alt);
+			vcf += line;
+		}
+	}
+	vcf += "2\t2\t.\tC\tG\t.\n";
+	write_gzip(vcf_filepath, vcf.data(), vcf.size());
+
+	Graph *whole = Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, 1, "ACGT");
+	Graph *pipelined = Graph::FromFastaVCFPipelined(fasta_filepath, vcf_filepath, 1, "ACGT");
+	REQUIRE(whole->nodes_len > 100000);
+	REQUIRE(pipelined->nodes_len == whole->nodes_len);
+	REQUIRE(pipelined->edges_len == whole->edges_len);
+	for (uint32_t node_id = 0; node_id < whole->nodes_len; node_id++) {
+		REQUIRE(pipelined->GetNodeLength(node_id) == whole->GetNodeLength(node_id));
+		REQUIRE(pipelined->Get(node_id)->reference == whole->Get(node_id)->reference);
+		for (uint32_t i = 0; i < whole->GetSequenceWordCount(whole->Get(node_id)); i++) {
+			REQUIRE(pipelined->GetSequence(pipelined->Get(node_id), i) == whole->GetSequence(whole->Get(node_id), i));
+		}
+		REQUIRE(pipelined->GetEdgesLen(node_id) == whole->GetEdgesLen(node_id));
+		for (uint32_t i = 0; i < whole->GetEdgesLen(node_id); i++) {
+			REQUIRE(pipelined->GetEdges(node_id)[i] == whole->GetEdges(node_id)[i]);
+		}
+	}
+	delete whole;
+	delete pipelined;
+
+	// Records past the end of the chromosome stop the build, leaving batches in the queue
+	for (uint64_t position = 3000100; position < 3000100 + 50000; position++) {
+		snprintf(line, sizeof(line), "1\t%lu\t.\tA\tC\t.\n", position);
+		vcf += line;
+	}
+	write_gzip(vcf_filepath, vcf.data(), vcf.size());
+	pipelined = Graph::FromFastaVCFPipelined(fasta_filepath, vcf_filepath, 1, "ACGT");
+	whole = Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, 1, "ACGT");
+	CHECK(pipelined->nodes_len == whole->nodes_len);
+	delete whole;
+	delete pipelined;
+
+	// A chromosome missing from the FASTA builds no graph
+	CHECK(Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, 7, "ACGT") == NULL);
+	CHECK(Graph::FromFastaVCFPipelined(fasta_filepath, vcf_filepath, 7, "ACGT") == NULL);
+
+	remove(fasta_filepath);
+	remove("test_pipeline.fa.fai");
+	remove(vcf_filepath);
+}
+
+TEST_CASE("Contigs are built by name, which leading digits would not tell apart.") {
+	char fasta_filepath[] = "test_named.fa";
+	char vcf_filepath[] = "test_named.vcf";
+	FILE *f = fopen(fasta_filepath, "w");
+	fputs(">chr1\nAAAACCCCGGGG\n>X\nCCCCGGGGTTTT\n>MT\nGGGGTTTTAAAA\n>HLA-A*01:01:01:01\nTTTTAAAACCCC\n", f);
+	fclose(f);
+	f = fopen(vcf_filepath, "w");
+	fputs("#CHROM\tPOS\tID\tREF\tALT\n"
+	      "chr1\t5\t.\tC\tT\n"
+	      "X\t5\t.\tG\tA\n"
+	      "X\t9\t.\tT\tC,G\n"
+	      "MT\t2\t.\tG\tC\n"
+	      "HLA-A*01:01:01:01\t1\t.\tT\tA\n", f);
+	fclose(f);
+
+	const char *names[] = {"chr1", "X", "MT", "HLA-A*01:01:01:01"};
+	const char *first_bases[] = {"AAAA", "CCCC", "G", "T"};
+	const uint32_t nodes_lens[] = {4, 8, 4, 3};
+	for (uint8_t i = 0; i < 4; i++) {
+		Graph *graph = Graph::FromFastaVCFContig(fasta_filepath, vcf_filepath, names[i], "ACGT");
+		Graph *pipelined = Graph::FromFastaVCFContigPipelined(fasta_filepath, vcf_filepath, names[i], "ACGT");
+		REQUIRE(graph != NULL);
+		REQUIRE(pipelined != NULL);
+		CHECK(graph->nodes_len == nodes_lens[i]);
+		CHECK(pipelined->nodes_len == graph->nodes_len);
+		CHECK(pipelined->edges_len == graph->edges_len);
+		check_node_sequence(graph, 0, first_bases[i]);
+		delete graph;
+		delete pipelined;
+	}
+
+	// chr1, X and MT would all be chromosome 0 by number
+	VCF *vcf = VCF::ReadContig(vcf_filepath, "X");
+	CHECK(vcf->length == 2);
+	delete vcf;
+	vcf = VCF::ReadFile(vcf_filepath, 0);
+	CHECK(vcf->length == 5);
+	delete vcf;
+
+	CHECK(Graph::FromFastaVCFContig(fasta_filepath, vcf_filepath, "chrY", "ACGT") == NULL);
+	CHECK(Graph::FromFastaVCFContigPipelined(fasta_filepath, vcf_filepath, "chr", "ACGT") == NULL);
+
+	remove(fasta_filepath);
+	remove("test_named.fa.fai");
+	remove(vcf_filepath);
+}
+
+TEST_CASE("FASTA files are indexed and seeked through .fai files.") {
+	char fasta_filepath[] = "test_index.fa";
+	char index_filepath[] = "test_index.fa.fai";
+	char bgzf_filepath[] = "test_index.fa.gz";
+	char bgzf_index_filepath[] = "test_index.fa.gz.fai";
+	const char bases[] = "ACGT";
+	std::string text = ">1 first\r\n";
+	std::string chromosome_1;
+	for (uint32_t i = 0; i < 1003; i++) chromosome_1 += bases[(i * 7 + i / 5) % 4];
+	for (uint32_t i = 0; i < chromosome_1.size(); i += 60) text += chromosome_1.substr(i, 60) + "\r\n";
+	text += ">chr2\nGATTACA\n>empty\n>3\nTTTTT\nCC";
+	FILE *f = fopen(fasta_filepath, "w");
+	fputs(text.c_str(), f);
+	fclose(f);
+	remove(index_filepath);
+
+	FASTA *fasta = FASTA::ReadFile(fasta_filepath);
+	delete fasta;
+	f = fopen(index_filepath, "r");
+	REQUIRE(f != NULL);
+	char line[256];
+	REQUIRE(fgets(line, sizeof(line), f) != NULL);
+	CHECK(strcmp(line, "1\t1003\t10\t60\t62\n") == 0);
+	REQUIRE(fgets(line, sizeof(line), f) != NULL);
+	CHECK(strcmp(line, "chr2\t7\t1053\t7\t8\n") == 0);
+	REQUIRE(fgets(line, sizeof(line), f) != NULL);
+	CHECK(strcmp(line, "empty\t0\t1068\t0\t0\n") == 0);
+	REQUIRE(fgets(line, sizeof(line), f) != NULL);
+	CHECK(strcmp(line, "3\t7\t1071\t5\t6\n") == 0);
+	CHECK(fgets(line, sizeof(line), f) == NULL);
+	fclose(f);
+
+	// Plain files are read through the written index, and BGZF files through an index built the same way
+	write_bgzf(bgzf_filepath, text.data(), text.size(), 100);
+	for (char *filepath : {fasta_filepath, bgzf_filepath}) {
+		fasta = FASTA::ReadFile(filepath);
+		ContigDictionary *contigs = fasta->ReadContigs();
+		REQUIRE(contigs->contigs_len == 4);
+		CHECK(contigs->lengths[0] == 1003);
+		CHECK(contigs->lengths[3] == 7);
+		delete contigs;
+
+		REQUIRE(fasta->GoToContig("chr2"));
+		CHECK(strcmp(fasta->ReadNext(100), "GATTACA") == 0);
+		REQUIRE(fasta->GoToChromosome(3));
+		CHECK(strcmp(fasta->ReadNext(100), "TTTTTCC") == 0);
+		REQUIRE(fasta->GoToContig("empty"));
+		CHECK(fasta->ReadNext(100) == NULL);
+		CHECK_FALSE(fasta->GoToContig("chr"));
+		for (uint64_t position : {0, 59, 60, 61, 119, 120, 999}) {
+			REQUIRE(fasta->GoToPosition("1", position));
+			CHECK(strcmp(fasta->ReadNext(4), chromosome_1.substr(position, 4).c_str()) == 0);
+		}
+		REQUIRE(fasta->GoToPosition("1", 1001));
+		CHECK(strcmp(fasta->ReadNext(100), chromosome_1.substr(1001).c_str()) == 0);
+		CHECK_FALSE(fasta->GoToPosition("3", 8));
+		delete fasta;
+	}
+
+	// An index older than the file is written again
+	f = fopen(index_filepath, "w");
+	fputs("1\t5\t0\t5\t6\n", f);
+	fclose(f);
+	struct timespec times[2] = {{0, 0}, {0, 0}};
+	utimensat(AT_FDCWD, index_filepath, times, 0);
+	fasta = FASTA::ReadFile(fasta_filepath);
+	REQUIRE(fasta->GoToContig("3"));
+	CHECK(strcmp(fasta->ReadNext(100), "TTTTTCC") == 0);
+	delete fasta;
+
+	// Lines of differing lengths cannot be indexed, so contigs are found by reading the file
+	remove(index_filepath);
+	f = fopen(fasta_filepath, "w");
+	fputs(">1\nAC\nGTA\n>2\nCCGG\n", f);
+	fclose(f);
+	fasta = FASTA::ReadFile(fasta_filepath);
+	struct stat index_stat;
+	CHECK(stat(index_filepath, &index_stat) == -1);
+	REQUIRE(fasta->GoToContig("2"));
+	CHECK(strcmp(fasta->ReadNext(100), "CCGG") == 0);
+	REQUIRE(fasta->GoToPosition("1", 3));
+	CHECK(strcmp(fasta->ReadNext(100), "TA") == 0);
+	delete fasta;
+
+	remove(fasta_filepath);
+	remove(bgzf_filepath);
+	remove(bgzf_index_filepath);
+}
+
+TEST_CASE("Gzip and BGZF files are read the same as plain files.") {
+	std::string text;
+	for (uint32_t i = 0; i < 20000; i++) text += "line " + std::to_string(i) + "\n";
+
+	char plain_filepath[] = "test_stream.txt";
+	char gzip_filepath[] = "test_stream.txt.gz";
+	char bgzf_filepath[] = "test_stream.txt.bgz";
+	FILE *f = fopen(plain_filepath, "w");
+	fwrite(text.data(), 1, text.size(), f);
+	fclose(f);
+	write_gzip(gzip_filepath, text.data(), text.size());
+	// Small blocks, so the file spans several batches of blocks
+	write_bgzf(bgzf_filepath, text.data(), text.size(), 1000);
+
+	char *filepaths[] = {plain_filepath, gzip_filepath, bgzf_filepath};
+	uint8_t modes[] = {FILE_STREAM_PLAIN, FILE_STREAM_GZIP, FILE_STREAM_BGZF};
+	for (uint32_t i = 0; i < 3; i++) {
+		for (uint32_t threads = 1; threads <= 3; threads += 2) {
+			FileStream *stream = FileStream::Open(filepaths[i], threads);
+			REQUIRE(stream != NULL);
+			CHECK(stream->mode == modes[i]);
+
+			for (uint32_t pass = 0; pass < 2; pass++) {
+				std::string read;
+				uint64_t chunk_len;
+				const char *chunk;
+				while ((chunk = stream->Next(&chunk_len)) != NULL) read.append(chunk, chunk_len);
+				CHECK(read == text);
+				stream->Rewind();
+			}
+
+			uint64_t all_len;
+			const char *all = stream->ReadAll(&all_len);
+			REQUIRE(all_len == text.size());
+			CHECK(memcmp(all, text.data(), all_len) == 0);
+			delete stream;
+		}
+	}
+	for (uint32_t i = 0; i < 3; i++) remove(filepaths[i]);
+
+	char fasta_filepath[] = "test_stream.fa.gz";
+	char vcf_filepath[] = "test_stream.vcf.gz";
+	char gfa_filepath[] = "test_stream.gfa.gz";
+	const char fasta[] = ">1\nAAAACCCCGG\nGGTTTT\n";
+	const char vcf[] = "#CHROM\tPOS\tID\tREF\tALT\n1\t5\t.\tC\tT\n";
+	const char gfa[] = "S\t1\tACGT\nS\t2\tC\nL\t1\t+\t2\t+\t0M\nP\tref\t1+,2+\t*\n";
+	write_gzip(fasta_filepath, fasta, strlen(fasta));
+	write_bgzf(vcf_filepath, vcf, strlen(vcf), 16);
+	write_bgzf(gfa_filepath, gfa, strlen(gfa), 8);
+
+	Graph *graph = Graph::FromFastaVCFEncoded(fasta_filepath, vcf_filepath, 1, "ACGT");
+	REQUIRE(graph->nodes_len == 4);
+	check_node_sequence(graph, 0, "AAAA");
+	check_node_sequence(graph, 2, "T");
+	check_node_sequence(graph, 3, "CCCGGGGTTTT");
+	delete graph;
+
+	graph = Graph::FromGFAFileEncoded(gfa_filepath, "ACGT");
+	REQUIRE(graph->nodes_len == 2);
+	check_node_sequence(graph, 0, "ACGT");
+	check_node_sequence(graph, 1, "C");
+	CHECK(graph->IsReference(1));
+	REQUIRE(graph->GetEdgesLen(0) == 1);
+	delete graph;
+
+	remove(fasta_filepath);
+	remove(vcf_filepath);
+	remove(gfa_filepath);
+}
+
+static void append_int(std::string *data, uint64_t value, uint8_t size) {
+	for (uint8_t i = 0; i < size; i++) data->push_back((char) (value >> (8 * i)));
+}
+
+// Writes a tabix or CSI index in which contig i has a single chunk per bin, chunks[i] of bins[i]
+static void write_vcf_index(const char *filepath, bool csi, std::vector<std::string> names,
+                            std::vector<std::vector<uint32_t>> bins, std::vector<std::vector<uint64_t>> chunks,
+                            std::vector<std::vector<uint64_t>> linear) {
+	std::string header;
+	const uint32_t columns[] = {2, 1, 2, 0, '#', 0};
+	for (uint32_t column : columns) append_int(&header, column, 4);
+	std::string all_names;
+	for (std::string &name : names) all_names += name + '\0';
+	append_int(&header, all_names.size(), 4);
+	header += all_names;
+
+	std::string index = csi ? "CSI\1" : "TBI\1";
+	if (csi) {
+		append_int(&index, 14, 4);
+		append_int(&index, 5, 4);
+		append_int(&index, header.size(), 4);
+		index += header;
+		append_int(&index, names.size(), 4);
+	} else {
+		append_int(&index, names.size(), 4);
+		index += header;
+	}
+	for (uint32_t i = 0; i < names.size(); i++) {
+		append_int(&index, bins[i].size(), 4);
+		for (uint32_t j = 0; j < bins[i].size(); j++) {
+			append_int(&index, bins[i][j], 4);
+			if (csi) append_int(&index, chunks[i][j * 2], 8);
+			append_int(&index, 1, 4);
+			append_int(&index, chunks[i][j * 2], 8);
+			append_int(&index, chunks[i][j * 2 + 1], 8);
+		}
+		if (csi) continue;
+		append_int(&index, linear[i].size(), 4);
+		for (uint64_t offset : linear[i]) append_int(&index, offset, 8);
+	}
+	write_bgzf(filepath, index.data(), index.size(), 65280);
+}
+
+TEST_CASE("Indexed BGZF VCF files are only read where the region is.") {
+	char vcf_filepath[] = "test_indexed.vcf.gz";
+	char tbi_filepath[] = "test_indexed.vcf.gz.tbi";
+	char csi_filepath[] = "test_indexed.vcf.gz.csi";
+	const char *blocks[] = {
+		"##fileformat=VCFv4.2\n#CHROM\tPOS\tID\tREF\tALT\n",
+		"1\t100\t.\tA\tC\n",
+		"1\t50000\t.\tG\tT\n2\t100\t.\tA\tG\n",
+		"10\t5\t.\tC\tA\n",
+		""
+	};
+	// Compressed offset of every block
+	uint64_t offsets[5];
+	FILE *f = fopen(vcf_filepath, "wb");
+	for (uint32_t i = 0; i < 5; i++) {
+		offsets[i] = ftell(f);
+		write_bgzf_block(f, blocks[i], strlen(blocks[i]));
+	}
+	fclose(f);
+
+	// Records of contig 1 fall into the 16 kbp bins 4681 + 0 and 4681 + 3, the rest into 4681
+	uint64_t second_line = strlen("1\t50000\t.\tG\tT\n");
+	std::vector<std::vector<uint64_t>> chunks = {
+		{offsets[1] << 16, offsets[2] << 16, offsets[2] << 16, (offsets[2] << 16) | second_line},
+		{(offsets[2] << 16) | second_line, offsets[3] << 16},
+		{offsets[3] << 16, offsets[4] << 16}};
+	std::vector<std::vector<uint64_t>> linear = {
+		{offsets[1] << 16, offsets[2] << 16, offsets[2] << 16, offsets[2] << 16},
+		{(offsets[2] << 16) | second_line},
+		{offsets[3] << 16}};
+	write_vcf_index(tbi_filepath, false, {"1", "2", "10"}, {{4681, 4684}, {4681}, {4681}}, chunks, linear);
+
+	VCF *vcf = VCF::ReadFile(vcf_filepath, 1);
+	REQUIRE(vcf->length == 2);
+	CHECK(vcf->positions[0] == 99);
+	CHECK(vcf->positions[1] == 49999);
+	delete vcf;
+
+	vcf = VCF::ReadRegion(vcf_filepath, "1:40,000-60000");
+	REQUIRE(vcf->length == 1);
+	CHECK(vcf->positions[0] == 49999);
+	CHECK(std::string(vcf->GetVariant(0, 0), vcf->GetVariantLength(0, 0)) == "T");
+	delete vcf;
+
+	vcf = VCF::ReadRegion(vcf_filepath, "2");
+	REQUIRE(vcf->length == 1);
+	CHECK(vcf->chromosomes[0] == 2);
+	delete vcf;
+
+	vcf = VCF::ReadRegion(vcf_filepath, "10:1-5");
+	REQUIRE(vcf->length == 1);
+	CHECK(vcf->chromosomes[0] == 10);
+	delete vcf;
+
+	vcf = VCF::ReadRegion(vcf_filepath, "3");
+	CHECK(vcf->length == 0);
+	delete vcf;
+	CHECK(VCF::ReadRegion(vcf_filepath, "1:60000-40000") == NULL);
+
+	// The CSI index leaves out the first record, which is only skipped if the reader seeks
+	remove(tbi_filepath);
+	write_vcf_index(csi_filepath, true, {"1", "2", "10"}, {{4684}, {4681}, {4681}},
+	                {{chunks[0][2], chunks[0][3]}, chunks[1], chunks[2]}, linear);
+	vcf = VCF::ReadFile(vcf_filepath, 1);
+	REQUIRE(vcf->length == 1);
+	CHECK(vcf->positions[0] == 49999);
+	delete vcf;
+
+	// Without an index the whole file is scanned
+	remove(csi_filepath);
+	vcf = VCF::ReadRegion(vcf_filepath, "1:1-200");
+	REQUIRE(vcf->length == 1);
+	CHECK(vcf->positions[0] == 99);
+	delete vcf;
+
+	remove(vcf_filepath);
+}
+
 TEST_CASE("Test finding minimal variant windows.") {
 
 	SUBCASE("Variant and reference of equal length.") {
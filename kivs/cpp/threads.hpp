@@ -0,0 +1,73 @@
+#ifndef KIVS_THREADS_H
+#define KIVS_THREADS_H
+
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Splits [0, len) into one range per thread and runs f(start, end, thread_index) on each.
+// Ranges start on multiples of 64, so threads never share a word of a bitset indexed by node ID.
+template <typename F>
+static void run_in_threads(uint32_t thread_count, uint32_t len, F f) {
+	uint64_t chunk = (((uint64_t) len + thread_count - 1) / thread_count + 63) / 64 * 64;
+	if (thread_count <= 1 || chunk >= len) {
+		f(0, len, 0);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for (uint32_t t = 0; t < thread_count && (uint64_t) t * chunk < len; t++) {
+		uint32_t start = t * chunk;
+		uint32_t end = ((uint64_t) start + chunk > len) ? len : start + chunk;
+		threads.emplace_back(f, start, end, t);
+	}
+	for (std::thread &thread : threads) thread.join();
+}
+
+// Hands items from one thread to another, blocking the producer while capacity items are waiting.
+// Once closed, Push refuses items and Pop returns the ones left before reporting the end.
+template <typename T>
+class BoundedQueue {
+	std::deque<T> items;
+	size_t capacity;
+	bool closed;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+public:
+	BoundedQueue(size_t capacity) {
+		this->capacity = capacity;
+		closed = false;
+	}
+
+	// Returns false, keeping the item with the caller, if the queue was closed
+	bool Push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this]() { return closed || items.size() < capacity; });
+		if (closed) return false;
+		items.push_back(item);
+		condition.notify_all();
+		return true;
+	}
+
+	// Returns false once the queue is closed and empty
+	bool Pop(T *item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this]() { return closed || !items.empty(); });
+		if (items.empty()) return false;
+		*item = items.front();
+		items.pop_front();
+		condition.notify_all();
+		return true;
+	}
+
+	void Close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		condition.notify_all();
+	}
+};
+
+#endif
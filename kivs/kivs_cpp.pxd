@@ -5,45 +5,99 @@ from libcpp cimport bool
 
 cdef extern from "cpp/node.hpp":
     struct node:
+        uint64_t sequence
+        uint64_t sequence_offset
         uint32_t length
-        uint64_t *sequences
-        uint32_t sequences_len
-        uint32_t *edges
-        uint32_t *edges_in
-        uint8_t edges_len
-        uint8_t edges_in_len
-        uint32_t reference_index
         bool reference
 
 cdef extern from "cpp/Graph.hpp":
+    struct bcg_header:
+        char encoding[4]
+        uint8_t version
+        uint32_t nodes_len
+        uint32_t edges_len
+        uint64_t sequences_len
+        uint32_t reference_path_len
+        uint32_t contigs_len
+
     cdef cppclass Graph:
         Graph(char *) except +
         node *nodes
         uint32_t nodes_len
         char encoding[4]
         uint8_t encoding_map[256]
+        uint32_t *edges_offsets
+        uint32_t *edges
+        uint32_t *edges_in_offsets
+        uint32_t *edges_in
+        uint32_t edges_len
+        uint64_t *sequences
+        uint64_t sequences_len
+        uint32_t contigs_len
 
         @staticmethod
         Graph *FromFile(char *)
         @staticmethod
+        Graph *FromFileUnmapped(char *)
+        @staticmethod
+        bool ReadFileHeader(char *, bcg_header *)
+        @staticmethod
         Graph *FromGFAFile(char *)
         @staticmethod
-        Graph *FromGFAFileEncoded(char *, char *)
+        Graph *FromGFAFileEncoded(char *, char *, uint32_t)
+        @staticmethod
+        Graph *FromFastaVCFEncoded(char *, char *, int16_t, char *, uint32_t)
         @staticmethod
-        Graph *FromFastaVCFEncoded(char *, char *, int16_t, char *)
+        Graph *FromFastaVCFContig(char *, char *, const char *, char *)
+        @staticmethod
+        Graph *FromFastaVCFPipelined(char *, char *, int16_t, char *)
+        @staticmethod
+        Graph *FromFastaVCFContigPipelined(char *, char *, const char *, char *)
 
-        void Compress()
+        uint32_t *Compress(uint32_t)
+        uint32_t *RenumberNodes()
 
         void ToFile(char *)
+        void ToGFAFile(char *)
+        bool IsMapped()
 
         uint64_t HashMinKmer(char *, uint8_t)
         uint64_t HashMaxKmer(char *, uint8_t)
         uint64_t HashKmer(char *, uint8_t)
         char *DecodeKmer(uint64_t, uint8_t)
 
-        void AddInEdges()
-
+        void AddEdge(uint32_t, uint32_t)
+        void Finalize()
+        uint32_t *GetEdges(uint32_t)
+        uint32_t GetEdgesLen(uint32_t)
+        uint32_t *GetEdgesIn(uint32_t)
+        uint32_t GetEdgesInLen(uint32_t)
+
+        uint32_t GetNodeLength(uint32_t)
+        bool IsReference(uint32_t)
+        void SetReference(uint32_t, bool)
+        uint32_t GetReferenceIndex(uint32_t)
+        void SetReferenceIndex(uint32_t, uint32_t)
+        void SetNodeSequence(uint32_t, char *, uint32_t)
+        void SetNodePackedSequence(uint32_t, uint64_t, uint32_t)
+        void SetNodeSequenceOffset(uint32_t, uint64_t, uint32_t)
+        uint32_t AppendEmptyNodes(uint32_t)
+        uint32_t GetContigRootNodeID(uint32_t)
+        const char *GetContigName(uint32_t)
+
+        uint64_t GetSequence(node *, uint32_t)
+        uint32_t GetSequenceWordCount(node *)
+        uint64_t AppendSequence(char *, uint32_t)
+        uint64_t AppendPackedSequence(uint64_t, uint8_t)
+
+        void BuildReferencePath()
+        uint32_t GetReferencePathLen()
+        uint64_t GetReferenceLength()
+        uint32_t GetReferenceNodeID(uint32_t)
         uint32_t GetNextReferenceNodeID(uint32_t)
+        uint32_t GetPreviousReferenceNodeID(uint32_t)
+        uint64_t GetReferenceOffset(uint32_t)
+        bool FindReferencePosition(uint64_t, uint32_t *, uint32_t *, uint32_t)
 
 cdef extern from "cpp/KmerFinder.hpp":
     enum: FILTER_NODE_ID
@@ -21,8 +21,11 @@ test_requirements = ['pytest>=3', ]
 extensions = [
     Extension("kivs_core",
               ["kivs/kivs_core.pyx",
-               "kivs/cpp/Graph.cpp", "kivs/cpp/KmerFinder.cpp", "kivs/cpp/GFA.cpp", "kivs/cpp/VCF.cpp", "kivs/cpp/FASTA.cpp", "kivs/cpp/hashing.cpp"],
-              include_dirs=[numpy.get_include()]),
+               "kivs/cpp/Graph.cpp", "kivs/cpp/GraphBuilder.cpp", "kivs/cpp/KmerFinder.cpp", "kivs/cpp/GFA.cpp", "kivs/cpp/VCF.cpp", "kivs/cpp/FASTA.cpp", "kivs/cpp/FileStream.cpp", "kivs/cpp/VCFIndex.cpp", "kivs/cpp/ContigDictionary.cpp", "kivs/cpp/FASTAIndex.cpp", "kivs/cpp/hashing.cpp"],
+              include_dirs=[numpy.get_include()],
+              extra_compile_args=["-pthread"],
+              libraries=["z"],
+              extra_link_args=["-pthread"]),
 ]
 
 extensions = cythonize(extensions, annotate=True)
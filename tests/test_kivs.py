@@ -185,3 +185,22 @@ def test_obgraph_against_kage_big_graph(file, k, max_var):
         f.close()
     compare_kmer_node_lists(res_kmers, res_nodes, ob_kmers, ob_nodes, k)
 
+
+@pytest.mark.parametrize("pipelined", [False, True])
+def test_from_fasta_vcf_missing_file(pipelined):
+    with pytest.raises(IOError):
+        Graph.from_fasta_vcf("tests/data/missing.fa", "tests/data/missing.vcf", 1, pipelined=pipelined)
+
+
+@pytest.mark.parametrize("pipelined", [False, True])
+def test_from_fasta_vcf_contig_name(tmp_path, pipelined):
+    fasta = tmp_path / "named.fa"
+    fasta.write_text(">chr1\nAAAACCCCGGGG\n>X\nCCCCGGGGTTTT\n")
+    vcf = tmp_path / "named.vcf"
+    vcf.write_text("#CHROM\tPOS\tID\tREF\tALT\nchr1\t5\t.\tC\tT\nX\t5\t.\tG\tA\nX\t9\t.\tT\tC,G\n")
+    for name, nodes_len in (("chr1", 4), ("X", 8)):
+        graph = Graph.from_fasta_vcf(str(fasta), str(vcf), name, pipelined=pipelined)
+        graph.to_file(str(tmp_path / "named.bcg"))
+        assert Graph.read_file_header(str(tmp_path / "named.bcg"))['nodes_len'] == nodes_len
+    with pytest.raises(IOError):
+        Graph.from_fasta_vcf(str(fasta), str(vcf), "chrY", pipelined=pipelined)